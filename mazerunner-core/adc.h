@@ -24,9 +24,14 @@
  *
  * The first set of samples is stored in the array m_adc_dark[].
  *
- * The second set, with the emitter on, is stored in m_adc_lit[].
+ * As each sample with the emitter on arrives, only the difference (lit-dark) is kept. It
+ * goes into one of two result sets. When the sequence is finished, that set is published
+ * by incrementing a sequence number and the next cycle fills the other set.
  *
  * for wall sensors, you should use the get_raw() method to read the (lit-dark) values.
+ * It reads from the published set and tries again if a new set was published while it
+ * was reading. There is no need to turn off the interrupts. Use sequence() to find out
+ * whether there are new results since the last time you looked.
  *
  * The class does not care what is connected to the adc channel. It just gathers readings.
  *
@@ -49,33 +54,48 @@
  * instance of the class and its interrupt service routine to be somewhere in a .cpp file.
  * I have placed the instances in the main project file.
  *
- * TODO: some space and time could be saved by only storing the difference between the
- * lit and dark values but it complicates matters elsewhere if code tries to read the
- * values in the middle of the interrupt sequence. If you have all the channels read
- * in one go in a single interrupt service routine - or in systick - then that will not
- * be a problem.
+ * The sequence used is chosen by ADC_SEQUENCE:
  *
- * TODO: The inclusion in the class of information about the emitters is unfortunate but this
- * is the simplest scheme I could envisage. If there are two emitters, both are turned on
- * together in this version. It would be better to use different emitters for each sensor type.
- * that is left as an exercise for the reader.
+ *  - ADC_SEQUENCE_ALL   : all 8 channels are converted dark and then all 8 again with both
+ *                         emitters on. That is twenty conversions in all.
+ *  - ADC_SEQUENCE_WALLS : only the four wall sensor channels are converted dark. Then the
+ *                         front sensors are converted with only the front emitter on and
+ *                         the side sensors with only the diagonal emitter on so that one
+ *                         sensor cannot see the light from the other emitter. The battery
+ *                         and switch channels take turns to get a single dark conversion
+ *                         every ADC_AUX_DIVISOR cycles. That is ten conversions on most
+ *                         cycles so the whole sequence takes about 300us. A4 and A5 are
+ *                         never touched so they are free for I2C.
+ *
+ * With ADC_SEQUENCE_WALLS, only the channels in the sequence are ever updated. The
+ * separate emitters mean that the lit readings may be a little lower than before so check
+ * the sensor calibration.
+ *
+ * The inclusion in the class of information about the emitters is unfortunate but this
+ * is the simplest scheme I could envisage.
  *
  * The code assumes the use of the advanced wall sensor board where there are two emitters. It
  * will work just as well with the basic wall sensor if you simply use the same pin name for
  * both emitter entries.
  *
- * TODO: The A4 and A5 channels get converted in the sequence. If you are expecting to use
- * these for an I2C device, they will need to be skipped.
- *
- * TODO: If only four sensor channels are used, there are opportunities to optimise this
- * code if you are so inclined.
- *
  * PORTING: A simulator may provide fake values as it sees fit and without the delays
- * or interrupts
+ * or interrupts. The one in the sim folder leaves this class alone and answers at the
+ * register level instead. See documents/simulator.md
  *
  *
  */
 
+#define ADC_SEQUENCE_ALL 0
+#define ADC_SEQUENCE_WALLS 1
+
+#ifndef ADC_SEQUENCE
+#define ADC_SEQUENCE ADC_SEQUENCE_WALLS
+#endif
+
+#ifndef ADC_AUX_DIVISOR
+#define ADC_AUX_DIVISOR 4
+#endif
+
 class AnalogueConverter;
 
 extern AnalogueConverter adc;
@@ -99,6 +119,17 @@ class AnalogueConverter {
     set_front_emitter_pin(EMITTER_FRONT);
     set_side_emitter_pin(EMITTER_DIAGONAL);
     converter_init();
+    for (uint8_t i = 0; i < MAX_CHANNELS; i++) {
+      m_raw[0][i] = 1;
+      m_raw[1][i] = 1;
+    }
+#if ADC_SEQUENCE == ADC_SEQUENCE_WALLS
+    // the battery and switches are converted only now and then so get
+    // them started with a manual reading
+    for (uint8_t i = 0; i < AUX_COUNT; i++) {
+      m_adc_dark[aux_channels[i]] = do_conversion(aux_channels[i]);
+    }
+#endif
     m_configured = true;
   };
 
@@ -133,10 +164,24 @@ class AnalogueConverter {
       return;
     }
 
+#if ADC_SEQUENCE == ADC_SEQUENCE_WALLS
+    m_dark_count = WALL_COUNT;
+    if (--m_aux_countdown == 0) {
+      m_aux_countdown = ADC_AUX_DIVISOR;
+      m_aux_channel = aux_channels[m_aux_index];
+      m_aux_index = (m_aux_index + 1) % AUX_COUNT;
+      m_dark_count++;
+    }
+    m_phase = PHASE_DARK;  // sync up the start of the sensor sequence
+    m_index = 0;
+    bitSet(ADCSRA, ADIE);              // enable the ADC interrupt
+    start_conversion(dark_channel(0));  // begin a conversion to get things started
+#else
     m_phase = 1;  // sync up the start of the sensor sequence
     m_channel = 0;
     bitSet(ADCSRA, ADIE);         // enable the ADC interrupt
     start_conversion(m_channel);  // begin a conversion to get things started
+#endif
   }
 
   void end_conversion_cycle() {
@@ -152,20 +197,34 @@ class AnalogueConverter {
     return ADC;
   }
 
+  /// The lit value is not stored. This is near enough for calibration.
   int get_lit(const int i) const {
-    return m_adc_lit[i];
+    return get_raw(i) + get_dark(i);
   }
 
   int get_dark(const int i) const {
     return m_adc_dark[i];
   }
 
+  /***
+   * The ISR never writes to the published set so the only risk is that a new
+   * set is published, and the next one started, while the value is being read.
+   * From systick that cannot happen because the sequence is only started at
+   * the end of systick.
+   */
   int get_raw(const int i) const {
-    int diff;
-    ATOMIC {
-      diff = max(1, m_adc_lit[i] - m_adc_dark[i]);
-    }
-    return diff;
+    uint8_t sequence;
+    int raw;
+    do {
+      sequence = m_sequence;
+      raw = m_raw[sequence & 1][i];
+    } while (sequence != m_sequence);
+    return raw;
+  }
+
+  /// @brief  changes every time a new set of results is published
+  uint8_t sequence() const {
+    return m_sequence;
   }
 
   /// Perform a 'manual' conversion of a channel
@@ -178,6 +237,75 @@ class AnalogueConverter {
     return get_adc_result();
   }
 
+#if ADC_SEQUENCE == ADC_SEQUENCE_WALLS
+  void callback_adc_isr() {
+    switch (m_phase) {
+      case PHASE_DARK:
+        // the wall sensors, and perhaps one other channel, with emitters off
+        m_adc_dark[dark_channel(m_index)] = get_adc_result();
+        m_index++;
+        if (m_index < m_dark_count) {
+          start_conversion(dark_channel(m_index));
+        } else {
+          if (m_emitters_enabled) {
+            digitalWrite(emitter_front(), 1);
+          }
+          start_conversion(front_channels[0]);
+          m_phase = PHASE_FRONT_SETTLE;
+        }
+        break;
+      case PHASE_FRONT_SETTLE:
+        // skip one cycle for the detectors to respond
+        get_adc_result();  // dummy read clears the interrupt flag
+        m_index = 0;
+        start_conversion(front_channels[0]);
+        m_phase = PHASE_FRONT;
+        break;
+      case PHASE_FRONT:
+        // avoid zero result so we know it is working
+        store_raw(front_channels[m_index], get_adc_result());
+        m_index++;
+        if (m_index < 2) {
+          start_conversion(front_channels[m_index]);
+        } else {
+          digitalWrite(emitter_front(), 0);
+          if (m_emitters_enabled) {
+            digitalWrite(emitter_diagonal(), 1);
+          }
+          start_conversion(side_channels[0]);
+          m_phase = PHASE_SIDE_SETTLE;
+        }
+        break;
+      case PHASE_SIDE_SETTLE:
+        get_adc_result();  // dummy read clears the interrupt flag
+        m_index = 0;
+        start_conversion(side_channels[0]);
+        m_phase = PHASE_SIDE;
+        break;
+      case PHASE_SIDE:
+        store_raw(side_channels[m_index], get_adc_result());
+        m_index++;
+        if (m_index < 2) {
+          start_conversion(side_channels[m_index]);
+        } else {
+          // unconditionally turn off emitters for safety
+          digitalWrite(emitter_diagonal(), 0);
+          digitalWrite(emitter_front(), 0);
+          bitClear(ADCSRA, ADIE);  // turn off the interrupt
+          m_phase = PHASE_DONE;
+          m_sequence++;  // publish the results
+        }
+        break;
+      case PHASE_DONE:
+      default:
+        get_adc_result();  // dummy read clears the interrupt flag
+        digitalWrite(emitter_diagonal(), 0);
+        digitalWrite(emitter_front(), 0);
+        bitClear(ADCSRA, ADIE);  // turn off the interrupt
+        break;
+    }
+  }
+#else
   void callback_adc_isr() {
     switch (m_phase) {
       case 1:
@@ -207,11 +335,11 @@ class AnalogueConverter {
         break;
       case 4:
         // cycle through the channels again with the emitters on
-        // avoid zero result so we know it is working
-        m_adc_lit[m_channel] = max(1, get_adc_result());
+        store_raw(m_channel, get_adc_result());
         m_channel++;
         start_conversion(m_channel);
         if (m_channel >= MAX_CHANNELS) {
+          m_sequence++;  // publish the results
           m_phase = 13;
         }
         break;
@@ -225,10 +353,51 @@ class AnalogueConverter {
         break;
     }
   }
+#endif
 
  private:
+  /// keep (lit-dark) in the set that is not published. Avoid zero so we know it is working
+  void store_raw(uint8_t channel, int lit) {
+    m_raw[(m_sequence + 1) & 1][channel] = max(1, lit - m_adc_dark[channel]);
+  }
+
+#if ADC_SEQUENCE == ADC_SEQUENCE_WALLS
+  enum {
+    PHASE_DARK,
+    PHASE_FRONT_SETTLE,
+    PHASE_FRONT,
+    PHASE_SIDE_SETTLE,
+    PHASE_SIDE,
+    PHASE_DONE,
+  };
+  enum {
+    WALL_COUNT = 4,
+    AUX_COUNT = 2,
+  };
+  const uint8_t front_channels[2] = {LFS_ADC_CHANNEL, RFS_ADC_CHANNEL};
+  const uint8_t side_channels[2] = {LSS_ADC_CHANNEL, RSS_ADC_CHANNEL};
+  const uint8_t aux_channels[AUX_COUNT] = {BATTERY_ADC_CHANNEL, SWITCHES_ADC_CHANNEL};
+
+  /// the wall channels come first and then the auxiliary channel, if any
+  uint8_t dark_channel(uint8_t index) const {
+    if (index < 2) {
+      return front_channels[index];
+    }
+    if (index < WALL_COUNT) {
+      return side_channels[index - 2];
+    }
+    return m_aux_channel;
+  }
+
+  uint8_t m_dark_count = WALL_COUNT;
+  uint8_t m_aux_channel = BATTERY_ADC_CHANNEL;
+  uint8_t m_aux_index = 0;
+  uint8_t m_aux_countdown = 1;
+#endif
+
   volatile int m_adc_dark[MAX_CHANNELS];
-  volatile int m_adc_lit[MAX_CHANNELS];
+  volatile int m_raw[2][MAX_CHANNELS];
+  volatile uint8_t m_sequence = 0;
   uint8_t m_emitter_front_pin = -1;
   uint8_t m_emitter_diagonal_pin = -1;
   uint8_t m_index = 0;
@@ -14,6 +14,7 @@
 #include <Arduino.h>
 #include "adc.h"
 #include "config.h"
+#include "fixed.h"
 
 class Battery;
 
@@ -30,23 +31,66 @@ extern Battery battery;
  * used in the battery monitor circuit. This is stored as a constant
  * in the config because it saves storage and/or a calculation step.
  *
+ * The motors draw large currents when they accelerate and the battery
+ * voltage sags for a moment. A single reading would pass that straight on
+ * to the motor voltages as noise so the voltage is low-pass filtered. Each
+ * update moves the filtered value BATTERY_FILTER_GAIN of the way towards
+ * the new reading.
+ *
+ * The motors need the number of PWM counts for each volt. That needs a
+ * division so it is worked out here, at the slow battery rate, rather
+ * than for each motor in every tick.
+ *
+ * If the filtered voltage ever falls below BATTERY_LOW_VOLTS, low() will
+ * return true until the next reset.
  */
+#ifndef BATTERY_FILTER_GAIN
+#define BATTERY_FILTER_GAIN 0.125f
+#endif
+
 class Battery {
  public:
   explicit Battery(uint8_t channel) : m_adc_channel(channel){};
 
   void update() {
     m_adc_value = adc.get_dark(m_adc_channel);
-    m_battery_volts = BATTERY_MULTIPLIER * m_adc_value;
+    float volts = BATTERY_MULTIPLIER * m_adc_value;
+    if (m_first_reading) {
+      m_battery_volts = volts;
+      m_first_reading = false;
+    } else {
+      m_battery_volts += BATTERY_FILTER_GAIN * (volts - m_battery_volts);
+    }
+    m_pwm_per_volt = to_gain(constrain(MOTOR_MAX_PWM / m_battery_volts, 0.0f, 127.0f));
+    if (m_battery_volts < BATTERY_LOW_VOLTS) {
+      m_low = true;
+    }
   }
 
+  /// @brief the filtered battery voltage
   float voltage() {
     return m_battery_volts;
   }
 
+  /// @brief PWM counts for each volt at the motors
+  gain_t pwm_per_volt() {
+    gain_t pwm_per_volt;
+    ATOMIC {
+      pwm_per_volt = m_pwm_per_volt;
+    }
+    return pwm_per_volt;
+  }
+
+  bool low() {
+    return m_low;
+  }
+
  private:
   Battery();  // no instantiation without an adc channel
   int m_adc_value;
   int m_adc_channel;
   float m_battery_volts;
+  gain_t m_pwm_per_volt = 0;
+  bool m_first_reading = true;
+  bool m_low = false;
 };
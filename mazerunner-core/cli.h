@@ -17,8 +17,14 @@
 #include "config.h"
 #include "maze.h"
 #include "mouse.h"
+#include "receiver.h"
+#include "recorder.h"
 #include "reporting.h"
 #include "sensors.h"
+#include "settings.h"
+#include "storage.h"
+#include "systick.h"
+#include "telemetry.h"
 
 const int MAX_ARGC = 16;
 #define MAX_DIGITS 8
@@ -145,10 +151,13 @@ const int INPUT_BUFFER_SIZE = 32;
 class CommandLineInterface {
  public:
   /***
-   * Read characters from the serial port into the buffer.
+   * Read characters from the receiver into the buffer.
    * return true if there is a complete line available
    * return false if not.
    *
+   * This never waits. Characters that arrived while a function
+   * was running have been kept by the receiver and are read now.
+   *
    * Input is echoed back through the serial port and can be
    * edited by the user using the backspace key. Accepted
    * characters are converted to upper case for convenience.
@@ -165,8 +174,8 @@ class CommandLineInterface {
    */
   const char BACKSPACE = 0x08;
   bool read_serial() {
-    while (Serial.available()) {
-      char c = Serial.read();
+    while (receiver.available()) {
+      char c = receiver.read();
       if (c == '\r') {
         Serial.println();
         return true;
@@ -199,15 +208,16 @@ class CommandLineInterface {
    * After tokenising, the arguments are examined and processed.
    *
    * Single character commands are handled separately for simplicity.
+   * So are the settings commands, which all start with '$'.
    *
    * Commands that consist of more than one token have their own
    * handler which executes a function that is passed a reference to
    * the list of tokens as an argument.
    *
    * Once a command line has been dealt with, the input buffer is
-   * cleared. That means that new characters that arrive while a
-   * function is executing will be lost. A side effect of that
-   * is that commands cannot be aborted over the serial link.
+   * cleared. Characters that arrive while a function is executing
+   * wait in the receiver until it is finished, except for the abort
+   * keys which stop a search or a run at once. See receiver.h.
    *
    * NOTES:
    *    - serial input is dealt with by polling so you must
@@ -218,8 +228,11 @@ class CommandLineInterface {
    */
   void interpret_line() {
     Args args;
+    receiver.clear_abort();
     if (get_tokens(args) > 0) {
-      if (strlen(args.argv[0]) == 1) {
+      if (args.argv[0][0] == '$') {
+        run_settings_cmd(args);
+      } else if (strlen(args.argv[0]) == 1) {
         run_short_cmd(args);
       } else {
         run_long_cmd(args);
@@ -289,9 +302,271 @@ class CommandLineInterface {
         y = 7;
       };
       mouse.search_to(Location(x, y));
+    } else if (strcmp("FLOOD", args.argv[0]) == 0) {
+      // time the flood. Systick interrupts are included in the result
+      const int count = 10;
+      uint32_t start = micros();
+      for (int i = 0; i < count; i++) {
+        maze.flood(maze.goal());
+      }
+      uint32_t elapsed = micros() - start;
+      Serial.print(F("Flood: "));
+      Serial.print(elapsed / count);
+      Serial.println(F(" us"));
+    } else if (strcmp("TIMING", args.argv[0]) == 0) {
+      print_systick_timing();
+    } else if (strcmp("RECORD", args.argv[0]) == 0) {
+      arm_recorder(args);
+    } else if (strcmp("DUMP", args.argv[0]) == 0) {
+#if RECORDER_SAMPLES > 0
+      reporter.print_recorder();
+#else
+      Serial.println(F("No recorder. Set RECORDER_SAMPLES in the robot config"));
+#endif
+    } else if (strcmp("SAVE", args.argv[0]) == 0) {
+      save_maze();
+    } else if (strcmp("LOAD", args.argv[0]) == 0) {
+      if (storage.load()) {
+        Serial.println(F("Maze loaded"));
+      } else {
+        Serial.println(F("No saved maze"));
+      }
+    } else if (strcmp("REFLOOD", args.argv[0]) == 0) {
+      maze.set_mask(MASK_OPEN);
+      maze.flood(maze.goal());
+      reporter.print_maze(COSTS);
+    } else if (strcmp("TURN", args.argv[0]) == 0) {
+      turn_cmd(args);
+    }
+  }
+
+  /***
+   * The settings commands. See settings.h and documents/cli.md
+   *
+   *   $      list all the settings by index number
+   *   $n     show setting n
+   *   $n=v   change setting n to v
+   *   $$     list all the settings as declarations for the robot config
+   *   $#     put all the settings back to the robot config values
+   *
+   * Each line of the list is a command that would set the value again.
+   */
+  void run_settings_cmd(const Args &args) {
+    const char *cmd = args.argv[0] + 1;
+    if (*cmd == 0) {
+      for (int i = 0; i < SETTING_COUNT; i++) {
+        print_setting(i);
+      }
+    } else if (*cmd == '$') {
+      for (int i = 0; i < SETTING_COUNT; i++) {
+        print_setting_declaration(i);
+      }
+    } else if (*cmd == '#') {
+      settings.reset();
+      Serial.println(F("Settings reset"));
+    } else {
+      int index = -1;
+      read_integer(cmd, index);
+      if (index < 0 || index >= SETTING_COUNT) {
+        Serial.println(F("No such setting"));
+        return;
+      }
+      if (args.argc > 1) {
+        float value;
+        if (not read_float(args.argv[1], value) || not settings.set(index, value)) {
+          Serial.println(F("Bad value"));
+        }
+      }
+      print_setting(index);
+    }
+  }
+
+  void print_setting(int index) {
+    Serial.print('$');
+    Serial.print(index);
+    Serial.print('=');
+    print_setting_value(index);
+    Serial.print(F(" // "));
+    settings.print_name(Serial, index);
+    Serial.println();
+  }
+
+  void print_setting_declaration(int index) {
+    Serial.print(settings.type(index) == SETTING_FLOAT ? F("constexpr float ") : F("const int "));
+    settings.print_name(Serial, index);
+    Serial.print(F(" = "));
+    print_setting_value(index);
+    Serial.println(';');
+  }
+
+  void print_setting_value(int index) {
+    if (settings.type(index) == SETTING_FLOAT) {
+      Serial.print(settings.get(index), 5);
+    } else {
+      Serial.print(int(settings.get(index)));
     }
   }
 
+  /***
+   * Show an entry in the turn_params table with 'TURN n' or change one
+   * of its fields with 'TURN n f v'. The fields are numbered as they are
+   * in the robot config:
+   *
+   *   0 speed, 1 entry, 2 exit, 3 angle, 4 omega, 5 alpha, 6 trigger
+   */
+  void turn_cmd(const Args &args) {
+    const int turn_count = sizeof(turn_params) / sizeof(turn_params[0]);
+    int turn = -1;
+    if (args.argc > 1) {
+      read_integer(args.argv[1], turn);
+    }
+    if (turn < 0 || turn >= turn_count) {
+      Serial.println(F("No such turn"));
+      return;
+    }
+    TurnParameters &params = turn_params[turn];
+    if (args.argc > 3) {
+      int field = -1;
+      float value = 0;
+      read_integer(args.argv[2], field);
+      if (not read_float(args.argv[3], value)) {
+        field = -1;
+      }
+      switch (field) {
+        case 0:
+          params.speed = value;
+          break;
+        case 1:
+          params.entry_offset = value;
+          break;
+        case 2:
+          params.exit_offset = value;
+          break;
+        case 3:
+          params.angle = value;
+          break;
+        case 4:
+          params.omega = value;
+          break;
+        case 5:
+          params.alpha = value;
+          break;
+        case 6:
+          params.trigger = value;
+          break;
+        default:
+          Serial.println(F("Bad field"));
+          break;
+      }
+    }
+    Serial.print(F("TURN "));
+    Serial.print(turn);
+    Serial.print(F(": speed "));
+    Serial.print(params.speed);
+    Serial.print(F(" entry "));
+    Serial.print(params.entry_offset);
+    Serial.print(F(" exit "));
+    Serial.print(params.exit_offset);
+    Serial.print(F(" angle "));
+    Serial.print(params.angle);
+    Serial.print(F(" omega "));
+    Serial.print(params.omega);
+    Serial.print(F(" alpha "));
+    Serial.print(params.alpha);
+    Serial.print(F(" trigger "));
+    Serial.println(params.trigger);
+  }
+
+  /***
+   * Save the maze and wait for systick to write it. It takes about half a
+   * second for a 16x16 maze into a new slot.
+   */
+  void save_maze() {
+    storage.save();
+    uint32_t start = millis();
+    while (storage.busy()) {
+      if (millis() - start > 5000) {
+        Serial.println(F("Save timed out"));
+        return;
+      }
+    }
+    Serial.print(F("Maze saved in slot "));
+    Serial.println(storage.slot());
+  }
+
+  /***
+   * Arm the flight recorder with 'RECORD t d' where t is the trigger and d
+   * is the number of systick ticks for each sample. Both are optional.
+   */
+  void arm_recorder(const Args &args) {
+#if RECORDER_SAMPLES > 0
+    int trigger = REC_TRIGGER_NOW;
+    int divisor = RECORDER_DIVISOR;
+    if (args.argc > 1) {
+      read_integer(args.argv[1], trigger);
+    }
+    if (args.argc > 2) {
+      read_integer(args.argv[2], divisor);
+    }
+    if (trigger < REC_TRIGGER_NOW || trigger > REC_TRIGGER_STEERING || divisor < 1 || divisor > 255) {
+      Serial.println(F("Bad recorder settings"));
+      return;
+    }
+    recorder.arm(RecorderTrigger(trigger), divisor);
+    Serial.print(F("Recorder armed: trigger "));
+    Serial.print(trigger);
+    Serial.print(F(" every "));
+    Serial.print(divisor);
+    Serial.println(F(" ticks"));
+#else
+    (void)args;
+    Serial.println(F("No recorder. Set RECORDER_SAMPLES in the robot config"));
+#endif
+  }
+
+  /***
+   * Show the time taken by each stage of the systick since the last time
+   * this was called and then start again. All the times are in microseconds.
+   * The load is the mean total time as a percentage of the systick period.
+   */
+  void print_systick_timing() {
+#if SYSTICK_TIMING
+    StageTime stats[Systick::STAGE_COUNT];
+    uint32_t ticks = systick.get_timing(stats);
+    systick.reset_timing();
+    if (ticks == 0) {
+      Serial.println(F("No ticks timed"));
+      return;
+    }
+    Serial.print(F("Systick timing over "));
+    Serial.print(ticks);
+    Serial.print(F(" ticks (us, resolution "));
+    Serial.print(int(Systick::US_PER_COUNT));
+    Serial.println(F("us)"));
+    Serial.println(F("stage         min   max  mean"));
+    print_stage_time(F("encoders   "), stats[Systick::STAGE_ENCODERS], ticks);
+    print_stage_time(F("motion     "), stats[Systick::STAGE_MOTION], ticks);
+    print_stage_time(F("sensors    "), stats[Systick::STAGE_SENSORS], ticks);
+    print_stage_time(F("battery    "), stats[Systick::STAGE_BATTERY], ticks);
+    print_stage_time(F("controllers"), stats[Systick::STAGE_CONTROLLERS], ticks);
+    print_stage_time(F("total      "), stats[Systick::STAGE_TOTAL], ticks);
+    print_stage_time(F("jitter     "), stats[Systick::STAGE_JITTER], ticks);
+    Serial.print(F("load: "));
+    Serial.print((100 * stats[Systick::STAGE_TOTAL].total) / (ticks * Systick::TIMER_COUNTS));
+    Serial.println('%');
+#else
+    Serial.println(F("SYSTICK_TIMING is not enabled"));
+#endif
+  }
+
+  void print_stage_time(const __FlashStringHelper *name, const StageTime &stat, uint32_t ticks) {
+    Serial.print(name);
+    reporter.print_justified(stat.min_time * Systick::US_PER_COUNT, 6);
+    reporter.print_justified(stat.max_time * Systick::US_PER_COUNT, 6);
+    reporter.print_justified((stat.total * Systick::US_PER_COUNT) / ticks, 6);
+    Serial.println();
+  }
+
   /***
    * Simple commands represented by a single character
    *
@@ -304,6 +579,7 @@ class CommandLineInterface {
         break;
       case 'X':
         Serial.println(F("Reset Maze"));
+        storage.stop();
         maze.initialise();
         break;
       case 'W':
@@ -318,7 +594,11 @@ class CommandLineInterface {
       case 'B':
         Serial.print(F("Battery: "));
         Serial.print(battery.voltage(), 2);
-        Serial.print(F(" Volts\n"));
+        Serial.print(F(" Volts"));
+        if (battery.low()) {
+          Serial.print(F(" LOW"));
+        }
+        Serial.println();
         break;
       case 'S':
         sensors.enable();
@@ -326,14 +606,25 @@ class CommandLineInterface {
         reporter.print_wall_sensors();
         sensors.disable();
         break;
+      case 'T': {
+        // choose the binary telemetry for runs. 0 means text.
+        int mode = -1;
+        if (args.argc > 1) {
+          read_integer(args.argv[1], mode);
+        }
+        if (mode >= TLM_NONE && mode < TLM_ACTION) {
+          telemetry.set_mode(TelemetryType(mode));
+        }
+        Serial.print(F("Telemetry: "));
+        Serial.println(int(telemetry.mode()));
+      } break;
       case 'F': {
         // simulate the function switches
         int function = -1;
-        int digits = read_integer(args.argv[1], function);
-        if (digits) {
+        if (args.argc > 1 && read_integer(args.argv[1], function)) {
           run_function(function);
         }
-      }
+      } break;
       default:
         break;
     }
@@ -356,6 +647,10 @@ class CommandLineInterface {
     if (cmd == 0) {
       return;
     }
+    receiver.clear_abort();
+    if (battery.low()) {
+      Serial.println(F("Low battery!"));
+    }
     switch (cmd) {
       case 1:
         mouse.show_sensor_calibration();
@@ -381,6 +676,9 @@ class CommandLineInterface {
       case 8:
         mouse.conf_log_front_sensor();
         break;
+      case 9:
+        mouse.run_maze();
+        break;
       default:
         // just to be safe...
         sensors.disable();
@@ -414,6 +712,7 @@ class CommandLineInterface {
     Serial.println(F("D   : display maze with directions"));
     Serial.println(F("B   : show battery voltage"));
     Serial.println(F("S   : show sensor readings"));
+    Serial.println(F("T n : telemetry for runs 0=text 1=profile 2=sensors"));
     Serial.println(F("F n : Run user function n"));
     Serial.println(F("       0 = ---"));
     Serial.println(F("       1 = Sensor Static Calibration"));
@@ -424,7 +723,7 @@ class CommandLineInterface {
     Serial.println(F("       6 = Test Edge Detect Position"));
     Serial.println(F("       7 = Sensor Spin Calibration"));
     Serial.println(F("       8 = "));
-    Serial.println(F("       9 = "));
+    Serial.println(F("       9 = Speed run to the goal"));
     Serial.println(F("      10 = "));
     Serial.println(F("      11 = "));
     Serial.println(F("      12 = "));
@@ -432,6 +731,19 @@ class CommandLineInterface {
     Serial.println(F("      14 = "));
     Serial.println(F("      15 = "));
     Serial.println(F("SEARCH x y : search to location (x,y)"));
+    Serial.println(F("FLOOD      : time the maze flood"));
+    Serial.println(F("TIMING     : show and reset the systick stage timing"));
+    Serial.println(F("RECORD t d : arm the recorder 0=now 1=turn 2=steering, d ticks/sample"));
+    Serial.println(F("DUMP       : stop the recorder and print it"));
+    Serial.println(F("SAVE       : save the maze to EEPROM and keep it up to date"));
+    Serial.println(F("LOAD       : load the saved maze from EEPROM"));
+    Serial.println(F("REFLOOD    : flood the maze for the goal and show the costs"));
+    Serial.println(F("TURN n f v : show turn n or set its field f 0..6 to v"));
+    Serial.println(F("$          : list the settings"));
+    Serial.println(F("$n  $n=v   : show or change setting n"));
+    Serial.println(F("$$         : list the settings as C declarations"));
+    Serial.println(F("$#         : reset the settings to the robot config"));
+    Serial.println(F("Ctrl-C/ESC : abort a search or run"));
     Serial.println(F("HELP       : this text"));
   }
 
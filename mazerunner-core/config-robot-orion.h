@@ -179,9 +179,9 @@ const int BACK_WALL_TO_CENTER = 48;
 // the pulses.
 // Finally, move the mouse in a straight line through 1000mm of travel to work
 // out the wheel diameter.
-const float WHEEL_DIAMETER = 32.240;
-const float ENCODER_PULSES = 36.0;
-const float GEAR_RATIO = 10.7917;
+constexpr float WHEEL_DIAMETER = 32.240;
+constexpr float ENCODER_PULSES = 36.0;
+constexpr float GEAR_RATIO = 10.7917;
 
 // Mouse radius is the distance between the contact patches of the drive wheels.
 // A good starting approximation is half the distance between the wheel centres.
@@ -189,35 +189,46 @@ const float GEAR_RATIO = 10.7917;
 // small amount. AFTER you have the wheel diameter and gear ratio calibrated,
 // have the mouse turn in place and adjust the MOUSE_RADIUS until these turns are
 // as accurate as you can get them
-const float MOUSE_RADIUS = 38.70;  // 39.50; // Adjust on test
+constexpr float MOUSE_RADIUS = 38.70;  // 39.50; // Adjust on test
 
 // The robot is likely to have wheels of different diameters or motors of slightly
 // different characteristics and that must be compensated for if the robot is to
 // reliably drive in a straight line.
 // This number adjusts the encoder count and must be  added to the right
 // and subtracted from the left motor.
-const float ROTATION_BIAS = -0.005;  // Negative makes robot curve to left
+constexpr float ROTATION_BIAS = -0.005;  // Negative makes robot curve to left
 
 // Now we can pre-calculate the key constats for the motion control
-const float MM_PER_COUNT = PI * WHEEL_DIAMETER / (ENCODER_PULSES * GEAR_RATIO);
-const float MM_PER_COUNT_LEFT = (1 - ROTATION_BIAS) * MM_PER_COUNT;
-const float MM_PER_COUNT_RIGHT = (1 + ROTATION_BIAS) * MM_PER_COUNT;
-const float DEG_PER_MM_DIFFERENCE = (180.0 / (2 * MOUSE_RADIUS * PI));
+constexpr float MM_PER_COUNT = PI * WHEEL_DIAMETER / (ENCODER_PULSES * GEAR_RATIO);
+constexpr float MM_PER_COUNT_LEFT = (1 - ROTATION_BIAS) * MM_PER_COUNT;
+constexpr float MM_PER_COUNT_RIGHT = (1 + ROTATION_BIAS) * MM_PER_COUNT;
+constexpr float DEG_PER_MM_DIFFERENCE = (180.0 / (2 * MOUSE_RADIUS * PI));
 
 //*** MOTION CONTROLLER CONSTANTS **********************************************//
 
 //***************************************************************************//
 // Control loop timing. Pre-calculate to save time in interrupts
-const float LOOP_FREQUENCY = 500.0;
-const float LOOP_INTERVAL = (1.0 / LOOP_FREQUENCY);
+// The encoders, profiles and motor controllers run on every systick. The
+// timer can give a SYSTICK_FREQUENCY of 500, 1000 or 2000 Hz.
+const int SYSTICK_FREQUENCY = 500;
+// Slower tasks run once every so many ticks. The sensor ADC cycle takes about
+// 620us so the sensors cannot run more often than 1000 times a second. The
+// battery is read from the same ADC cycle so its divisor must be a multiple
+// of the sensor divisor.
+const uint8_t SENSOR_DIVISOR = 1;
+const uint8_t BATTERY_DIVISOR = 10;
+
+constexpr float LOOP_FREQUENCY = SYSTICK_FREQUENCY;
+constexpr float LOOP_INTERVAL = (1.0 / LOOP_FREQUENCY);
+constexpr float SENSOR_FREQUENCY = LOOP_FREQUENCY / SENSOR_DIVISOR;
 
 // Dynamic performance constants
 // There is a video describing how to get these numbers and calculate the feedforward
 // constnats here: https://youtu.be/BrabDeHGsa0
-const float FWD_KM = 475.0;  // mm/s/Volt
-const float FWD_TM = 0.190;  // forward time constant
-const float ROT_KM = 775.0;  // deg/s/Volt
-const float ROT_TM = 0.210;  // rotation time constant
+constexpr float FWD_KM = 475.0;  // mm/s/Volt
+constexpr float FWD_TM = 0.190;  // forward time constant
+constexpr float ROT_KM = 775.0;  // deg/s/Volt
+constexpr float ROT_TM = 0.210;  // rotation time constant
 
 // Motor Feedforward
 /***
@@ -236,33 +247,33 @@ const float ROT_TM = 0.210;  // rotation time constant
  * That minimum voltage is the BIAS_FF. It is not dependent upon speed but is expressed
  * here as a fraction for comparison.
  */
-const float MAX_MOTOR_VOLTS = 6.0;
+constexpr float MAX_MOTOR_VOLTS = 6.0;
 
-const float SPEED_FF = (1.0 / FWD_KM);
-const float ACC_FF = (FWD_TM / FWD_KM);
-const float BIAS_FF = 0.340;
-const float TOP_SPEED = (6.0 - BIAS_FF) / SPEED_FF;
+constexpr float SPEED_FF = (1.0 / FWD_KM);
+constexpr float ACC_FF = (FWD_TM / FWD_KM);
+constexpr float BIAS_FF = 0.340;
+constexpr float TOP_SPEED = (6.0 - BIAS_FF) / SPEED_FF;
 
 //*** MOTION CONTROL CONSTANTS **********************************************//
 
 // forward motion controller constants
-const float FWD_ZETA = 0.707;
-const float FWD_TD = FWD_TM;
+constexpr float FWD_ZETA = 0.707;
+constexpr float FWD_TD = FWD_TM;
 
-const float FWD_KP = 16 * FWD_TM / (FWD_KM * FWD_ZETA * FWD_ZETA * FWD_TD * FWD_TD);
-const float FWD_KD = LOOP_FREQUENCY * (8 * FWD_TM - FWD_TD) / (FWD_KM * FWD_TD);
+constexpr float FWD_KP = 16 * FWD_TM / (FWD_KM * FWD_ZETA * FWD_ZETA * FWD_TD * FWD_TD);
+constexpr float FWD_KD = LOOP_FREQUENCY * (8 * FWD_TM - FWD_TD) / (FWD_KM * FWD_TD);
 
 // rotation motion controller constants
-const float ROT_ZETA = 0.707;
-const float ROT_TD = ROT_TM;
+constexpr float ROT_ZETA = 0.707;
+constexpr float ROT_TD = ROT_TM;
 
-const float ROT_KP = 16 * ROT_TM / (ROT_KM * ROT_ZETA * ROT_ZETA * ROT_TD * ROT_TD);
-const float ROT_KD = LOOP_FREQUENCY * (8 * ROT_TM - ROT_TD) / (ROT_KM * ROT_TD);
+constexpr float ROT_KP = 16 * ROT_TM / (ROT_KM * ROT_ZETA * ROT_ZETA * ROT_TD * ROT_TD);
+constexpr float ROT_KD = LOOP_FREQUENCY * (8 * ROT_TM - ROT_TD) / (ROT_KM * ROT_TD);
 
 // controller constants for the steering controller
-const float STEERING_KP = 0.6;
-const float STEERING_KD = 0.00;
-const float STEERING_ADJUST_LIMIT = 10.0;  // deg/s
+constexpr float STEERING_KP = 0.6;
+constexpr float STEERING_KD = 0.00;
+constexpr float STEERING_ADJUST_LIMIT = 10.0;  // deg/s
 
 // encoder polarity is either 1 or -1 and is used to account for reversal of the encoder phases
 #define ENCODER_LEFT_POLARITY (-1)
@@ -284,7 +295,10 @@ const int SMOOTH_TURN_SPEED = 500;
 const int FAST_TURN_SPEED = 600;
 const int FAST_RUN_SPEED_MAX = 2500;
 
-const float FAST_RUN_ACCELERATION = 3000;
+constexpr float FAST_RUN_ACCELERATION = 3000;
+// the straights of a speed run ramp the acceleration up and down at this
+// jerk (mm/s/s/s) so that the wheels do not slip. Zero for a trapezoid
+constexpr float FAST_RUN_JERK = 50000;
 
 const int OMEGA_SPIN_TURN = 360;
 const int ALPHA_SPIN_TURN = 3600;
@@ -302,10 +316,10 @@ const int FRONT_NOMINAL = 100;
 const int FRONT_WALL_RELIABILITY_LIMIT = 100;
 
 // Sensor brightness adjustment factor. The compiler calculates these so it saves processor time
-const float FRONT_LEFT_SCALE = (float)FRONT_NOMINAL / FRONT_LEFT_CALIBRATION;
-const float FRONT_RIGHT_SCALE = (float)FRONT_NOMINAL / FRONT_RIGHT_CALIBRATION;
-const float LEFT_SCALE = (float)SIDE_NOMINAL / LEFT_CALIBRATION;
-const float RIGHT_SCALE = (float)SIDE_NOMINAL / RIGHT_CALIBRATION;
+constexpr float FRONT_LEFT_SCALE = (float)FRONT_NOMINAL / FRONT_LEFT_CALIBRATION;
+constexpr float FRONT_RIGHT_SCALE = (float)FRONT_NOMINAL / FRONT_RIGHT_CALIBRATION;
+constexpr float LEFT_SCALE = (float)SIDE_NOMINAL / LEFT_CALIBRATION;
+constexpr float RIGHT_SCALE = (float)SIDE_NOMINAL / RIGHT_CALIBRATION;
 
 // the values above which, a wall is seen
 const int LEFT_THRESHOLD = 40;   // minimum value to register a wall
@@ -318,16 +332,34 @@ const int LEFT_EDGE_POS = 90;
 const int RIGHT_EDGE_POS = 90;
 
 // clang-format off
-// These take no storage - the compiler uses the values directly
-const TurnParameters turn_params[4] = {
+// These are in RAM so that the TURN command in the CLI can change them
+// The speed run turns from SS90L onwards have symmetrical offsets worked out
+// from the turn profile. They are a starting point for tuning and the speed
+// run does not use the sensor threshold. Nothing puts the robot back on line
+// during a diagonal so an entry offset that is a few mm out moves the robot
+// sideways by that much after the turn and the errors add up.
+TurnParameters turn_params[14] = {
 //               speed, entry,   exit, angle, omega,  alpha, sensor threshold
     {SEARCH_TURN_SPEED,    70,     80,  90.0, 280.0, 4000.0, TURN_THRESHOLD_SS90E}, // 0 => SS90EL
-    {SEARCH_TURN_SPEED,    70,     80, -90.0, 280.0, 4000.0, TURN_THRESHOLD_SS90E}, // 0 => SS90ER
-    {SEARCH_TURN_SPEED,    70,     80,  90.0, 280.0, 4000.0, TURN_THRESHOLD_SS90E}, // 0 => SS90L
-    {SEARCH_TURN_SPEED,    70,     80, -90.0, 280.0, 4000.0, TURN_THRESHOLD_SS90E}, // 0 => SS90R
+    {SEARCH_TURN_SPEED,    70,     80, -90.0, 280.0, 4000.0, TURN_THRESHOLD_SS90E}, // 1 => SS90ER
+    {SEARCH_TURN_SPEED,    72,     72,  90.0, 280.0, 4000.0, TURN_THRESHOLD_SS90E}, // 2 => SS90L
+    {SEARCH_TURN_SPEED,    72,     72, -90.0, 280.0, 4000.0, TURN_THRESHOLD_SS90E}, // 3 => SS90R
+    {SEARCH_TURN_SPEED,    36,     36,  45.0, 280.0, 4000.0,                    0}, // 4 => SD45L
+    {SEARCH_TURN_SPEED,    36,     36, -45.0, 280.0, 4000.0,                    0}, // 5 => SD45R
+    {SEARCH_TURN_SPEED,   159,    159, 135.0, 280.0, 4000.0,                    0}, // 6 => SD135L
+    {SEARCH_TURN_SPEED,   159,    159,-135.0, 280.0, 4000.0,                    0}, // 7 => SD135R
+    {SEARCH_TURN_SPEED,    36,     36,  45.0, 280.0, 4000.0,                    0}, // 8 => DS45L
+    {SEARCH_TURN_SPEED,    36,     36, -45.0, 280.0, 4000.0,                    0}, // 9 => DS45R
+    {SEARCH_TURN_SPEED,   159,    159, 135.0, 280.0, 4000.0,                    0}, // 10 => DS135L
+    {SEARCH_TURN_SPEED,   159,    159,-135.0, 280.0, 4000.0,                    0}, // 11 => DS135R
+    {SEARCH_TURN_SPEED,    72,     72,  90.0, 280.0, 4000.0,                    0}, // 12 => DD90L
+    {SEARCH_TURN_SPEED,    72,     72, -90.0, 280.0, 4000.0,                    0}, // 13 => DD90R
 };
 // clang-format on
 
+// the weighted flood uses these to prefer routes with fewer turns
+const FloodCosts flood_costs = {2, 6, 12};
+
 //***************************************************************************//
 // Battery resistor bridge //Derek Hall//
 // The battery measurement is performed by first reducing the battery voltage
@@ -352,15 +384,18 @@ const TurnParameters turn_params[4] = {
 // battery voltage calulation is done as efficiently as possible.
 // The compiler will do all these calculations so your program does not have to.
 
-const float BATTERY_R1 = 10000.0;  // resistor to battery +
-const float BATTERY_R2 = 10000.0;  // resistor to Gnd
-const float BATTERY_DIVIDER_RATIO = BATTERY_R2 / (BATTERY_R1 + BATTERY_R2);
-const float ADC_FSR = 1023.0;     // The maximum reading for the ADC
-const float ADC_REF_VOLTS = 5.0;  // Reference voltage of ADC
+constexpr float BATTERY_R1 = 10000.0;  // resistor to battery +
+constexpr float BATTERY_R2 = 10000.0;  // resistor to Gnd
+constexpr float BATTERY_DIVIDER_RATIO = BATTERY_R2 / (BATTERY_R1 + BATTERY_R2);
+constexpr float ADC_FSR = 1023.0;     // The maximum reading for the ADC
+constexpr float ADC_REF_VOLTS = 5.0;  // Reference voltage of ADC
+
+constexpr float BATTERY_MULTIPLIER = (ADC_REF_VOLTS / ADC_FSR / BATTERY_DIVIDER_RATIO);
 
-const float BATTERY_MULTIPLIER = (ADC_REF_VOLTS / ADC_FSR / BATTERY_DIVIDER_RATIO);
+// Below this, the battery is flat. This is 3.4 Volts per cell for a 2S LiPo.
+constexpr float BATTERY_LOW_VOLTS = 6.8;
 
 const int MOTOR_MAX_PWM = 255;
 
 // the position in the cell where the sensors are sampled.
-const float SENSING_POSITION = 170.0;
+constexpr float SENSING_POSITION = 170.0;
@@ -69,6 +69,8 @@ const int adc_thesholds[] PROGMEM = {660, 647, 630, 614, 590, 570, 545, 522, 461
 #define __digitalPinToDDRReg(P) (((P) <= 7) ? &DDRD : (((P) >= 8 && (P) <= 13) ? &DDRB : &DDRC))
 #define __digitalPinToPINReg(P) (((P) <= 7) ? &PIND : (((P) >= 8 && (P) <= 13) ? &PINB : &PINC))
 #define __digitalPinToBit(P) (((P) <= 7) ? (P) : (((P) >= 8 && (P) <= 13) ? (P)-8 : (P)-14))
+// the port letter, for checks that the compiler can do
+#define __digitalPinToPort(P) (((P) <= 7) ? 'D' : (((P) >= 8 && (P) <= 13) ? 'B' : 'C'))
 
 // general macros/defines
 #if !defined(BIT_READ)
@@ -117,7 +119,7 @@ const int adc_thesholds[] PROGMEM = {660, 647, 630, 614, 590, 570, 545, 522, 461
 #if defined(__AVR__)
 #include <util/atomic.h>
 #define ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-#else
+#elif !defined(ATOMIC)
 #define ATOMIC
 #endif
 //***************************************************************************//
@@ -32,8 +32,8 @@
 #define STRING2(x) #x
 #define STRING(x) STRING2(x)
 
-const float RADIANS_PER_DEGREE = 2 * PI / 360.0;
-const float DEGREES_PER_RADIAN = 360.0 / 2 * PI;
+constexpr float RADIANS_PER_DEGREE = 2 * PI / 360.0;
+constexpr float DEGREES_PER_RADIAN = 360.0 / 2 * PI;
 
 /***
  * Structure definitions used in the software. Declared here for lack of a
@@ -54,6 +54,17 @@ struct TurnParameters {
   int trigger;       //         - front sensor value at start of turn
 };
 
+/***
+ * The weighted flood used for speed runs charges for each cell moved and
+ * adds a penalty for every turn. The units are arbitrary - only the ratios
+ * matter - but the total for the worst route must stay below 0x3FFF.
+ */
+struct FloodCosts {
+  uint8_t straight;  // cost of moving one cell forward
+  uint8_t turn;      // extra cost of a 90 degree turn
+  uint8_t reverse;   // extra cost of turning around
+};
+
 /*************************************************************************/
 /***
  * You may use a slightly different hardware platform than UKMARSBOT
@@ -84,17 +95,32 @@ struct TurnParameters {
 #define EVENT_UK 2
 #define EVENT_PORTUGAL 3
 #define EVENT_APEC 4
+#define EVENT_HALF_SIZE 5
 
 // choose the one you will be using BEFORE selecting the robot below
 #define EVENT EVENT_UK
+// GOAL is the south west corner of the goal area
 #if EVENT == EVENT_HOME
 #define GOAL Location(2, 2)
+#define GOAL_WIDTH 1
+#define GOAL_HEIGHT 1
+#elif EVENT == EVENT_HALF_SIZE
+// The maze size must be set before maze.h is included
+#define MAZE_WIDTH 32
+#define MAZE_HEIGHT 32
+#define GOAL Location(15, 15)
+#define GOAL_WIDTH 2
+#define GOAL_HEIGHT 2
 #else
 #define GOAL Location(7, 7)
+#define GOAL_WIDTH 2
+#define GOAL_HEIGHT 2
 #endif
 // This is the size, in mm,  for each cell in the maze.
-const float FULL_CELL = 180.0f;
-const float HALF_CELL = FULL_CELL / 2.0;
+constexpr float FULL_CELL = 180.0f;
+constexpr float HALF_CELL = FULL_CELL / 2.0;
+// A diagonal runs between the centres of neighbouring cell edges
+constexpr float DIAGONAL_STEP = HALF_CELL * 1.41421356f;
 
 /*************************************************************************/
 /***
@@ -122,6 +148,39 @@ const float HALF_CELL = FULL_CELL / 2.0;
 #error "NO ROBOT DEFINED"
 #endif
 
+/*************************************************************************/
+/***
+ * Constants that the control code works out from the robot config. The
+ * robot config values are all constexpr so the compiler does the arithmetic
+ * and the conversion to fixed point here. Code that runs in systick should
+ * use these rather than writing something like to_gain(1.0 / FWD_KM) in
+ * place. If one of them could not be worked out when compiling, the build
+ * fails instead of leaving a float divide in the interrupt.
+ *
+ * With USE_FIXED_POINT, a gain must be less than 128. That is checked here
+ * for the gains that are always fixed and for the starting values of the
+ * controller gains. Those can be changed from the CLI, which checks them
+ * again.
+ */
+#include "fixed.h"
+
+static_assert(gain_fits(ACC_FF * LOOP_FREQUENCY) && gain_fits(MOUSE_RADIUS * RADIANS_PER_DEGREE) && gain_fits(DEG_PER_MM_DIFFERENCE),
+              "A derived gain is too big for USE_FIXED_POINT");
+static_assert(gain_fits(FWD_KP) && gain_fits(FWD_KD) && gain_fits(ROT_KP) && gain_fits(ROT_KD), "The controller gains are too big for USE_FIXED_POINT");
+static_assert(gain_fits(STEERING_KP) && gain_fits(STEERING_KD * SENSOR_FREQUENCY), "The steering gains are too big for USE_FIXED_POINT");
+
+constexpr gain_t LOOP_INTERVAL_GAIN = to_gain(LOOP_INTERVAL);
+constexpr gain_t HALF_LOOP_INTERVAL_GAIN = to_gain(LOOP_INTERVAL / 2);
+constexpr gain_t SPEED_FF_GAIN = to_gain(SPEED_FF);
+constexpr gain_t ACC_FF_GAIN = to_gain(ACC_FF * LOOP_FREQUENCY);  // per change in speed each tick
+constexpr gain_t TANGENT_SPEED_GAIN = to_gain(MOUSE_RADIUS * RADIANS_PER_DEGREE);  // mm/s per deg/s
+constexpr gain_t DEG_PER_MM_DIFFERENCE_GAIN = to_gain(DEG_PER_MM_DIFFERENCE);
+constexpr real_t MM_PER_COUNT_LEFT_REAL = to_real(MM_PER_COUNT_LEFT);
+constexpr real_t MM_PER_COUNT_RIGHT_REAL = to_real(MM_PER_COUNT_RIGHT);
+constexpr real_t BIAS_FF_REAL = to_real(BIAS_FF);
+constexpr real_t MAX_MOTOR_VOLTS_REAL = to_real(MAX_MOTOR_VOLTS);
+constexpr real_t STEERING_ADJUST_LIMIT_REAL = to_real(STEERING_ADJUST_LIMIT);
+
 /*************************************************************************/
 /***
  * This piece of magic lets you define a variable, such as the maze, that can
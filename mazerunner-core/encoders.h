@@ -14,6 +14,7 @@
 #include <Arduino.h>
 #include <stdint.h>
 #include "config.h"
+#include "fixed.h"
 
 /*******************************************************************************
  *
@@ -29,6 +30,40 @@
  *
  * ****************************************************************************/
 
+/***
+ * With ENCODER_PERIOD_TIMING set, each encoder ISR also records the time of
+ * the edge. robot_speed() and robot_omega() then work out the wheel speeds
+ * from the time taken for the counts rather than just the counts in the last
+ * tick. At low speed there may be only one or two counts per tick so that is
+ * a great improvement. It costs a few more microseconds per interrupt.
+ *
+ * The ATmega328 only has input capture on pin 8 which is not an encoder
+ * input so the times come from micros(). They have 4us resolution.
+ *
+ * The controllers still use the change in position in each tick.
+ */
+#ifndef ENCODER_PERIOD_TIMING
+#define ENCODER_PERIOD_TIMING 0
+#endif
+
+// a wheel with no encoder edges for this long is taken to be stopped
+const uint32_t ENCODER_STOP_TIME_US = 50000;
+
+/***
+ * The encoder state is two bits with A in bit 1 and B in bit 0. The table
+ * gives the count for every change from an old state (the high two bits of
+ * the index) to a new state. Changes of both bits at once are impossible
+ * and give zero.
+ */
+// clang-format off
+const int8_t quadrature_table[16] PROGMEM = {
+     0,  1, -1,  0,
+    -1,  0,  0,  1,
+     1,  0,  0, -1,
+     0, -1,  1,  0,
+};
+// clang-format on
+
 // TODO: consider a single Encoder class with objects for each wheel.
 //       Then a Localisation class would get two of these (and possibly
 //       an IMU) to do the actual localisation.
@@ -50,6 +85,8 @@ class Encoders {
     pinMode(ENCODER_LEFT_B, INPUT);
     pinMode(ENCODER_RIGHT_CLK, INPUT);
     pinMode(ENCODER_RIGHT_B, INPUT);
+    m_left_state = read_state(ENCODER_LEFT_CLK, ENCODER_LEFT_B);
+    m_right_state = read_state(ENCODER_RIGHT_CLK, ENCODER_RIGHT_B);
     attachInterrupt(digitalPinToInterrupt(ENCODER_LEFT_CLK), callback_left_encoder_isr, CHANGE);
     attachInterrupt(digitalPinToInterrupt(ENCODER_RIGHT_CLK), callback_right_encoder_isr, CHANGE);
     reset();
@@ -59,18 +96,52 @@ class Encoders {
     ATOMIC {
       m_left_counter = 0;
       m_right_counter = 0;
+#if USE_FIXED_POINT
+      m_left_total = 0;
+      m_right_total = 0;
+#else
       m_robot_distance = 0;
       m_robot_angle = 0;
+#endif
+#if ENCODER_PERIOD_TIMING
+      m_left_timer = EdgeTimer();
+      m_right_timer = EdgeTimer();
+      m_left_edge_time = 0;
+      m_right_edge_time = 0;
+#endif
     }
   }
 
+  /***
+   * The UKMARSBOT encoder board gives the interrupt pin the XOR of the two
+   * channels so A has to be recovered from that. With the AVR, both pins are
+   * read from the port in one go so they must be on the same port.
+   */
+#if defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__)
+  static_assert(__digitalPinToPort(ENCODER_LEFT_CLK) == __digitalPinToPort(ENCODER_LEFT_B), "The left encoder pins must be on the same port");
+  static_assert(__digitalPinToPort(ENCODER_RIGHT_CLK) == __digitalPinToPort(ENCODER_RIGHT_B), "The right encoder pins must be on the same port");
+#endif
+  static uint8_t read_state(const uint8_t clk_pin, const uint8_t b_pin) {
+#if defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__)
+    uint8_t pins = *__digitalPinToPINReg(clk_pin);
+    uint8_t b = (pins >> __digitalPinToBit(b_pin)) & 1;
+    uint8_t clk = (pins >> __digitalPinToBit(clk_pin)) & 1;
+#else
+    uint8_t b = fast_read_pin(b_pin);
+    uint8_t clk = fast_read_pin(clk_pin);
+#endif
+    return ((clk ^ b) << 1) | b;
+  }
+
   /**
    * For the ATmega328 and ATmega4809:
    *   Measurements indicate that even at 1500mm/s the total load due to
    *   the encoder interrupts is less than 3% of the available bandwidth.
    *   The ISR will respond to the XOR-ed pulse train from the encoder
-   *   Runs in constant time of around 3us per interrupt.
-   *   Would be faster with direct port access
+   *
+   * Both pins are read at once and the old and new states index a table
+   * of counts so there is no arithmetic to do. The polarity is a constant
+   * so the compiler turns the multiply into nothing or a negation.
    *
    * A more generic solution where the pin names are not constants would be slower
    * unless we can make their definition known at compile time.
@@ -80,26 +151,23 @@ class Encoders {
    * quadrature input.
    */
   void left_input_change() {
-    static bool oldA = false;
-    static bool oldB = false;
-    // bool newB = digitalReadFast(ENCODER_LEFT_B);
-    bool newB = fast_read_pin(ENCODER_LEFT_B);
-    bool newA = fast_read_pin(ENCODER_LEFT_CLK) ^ newB;
-    int delta = ENCODER_LEFT_POLARITY * ((oldA ^ newB) - (newA ^ oldB));
-    m_left_counter += delta;
-    oldA = newA;
-    oldB = newB;
+    uint8_t state = read_state(ENCODER_LEFT_CLK, ENCODER_LEFT_B);
+    int8_t delta = pgm_read_byte_near(quadrature_table + ((m_left_state << 2) | state));
+    m_left_counter += ENCODER_LEFT_POLARITY * delta;
+    m_left_state = state;
+#if ENCODER_PERIOD_TIMING
+    m_left_edge_time = micros();
+#endif
   }
 
   void right_input_change() {
-    static bool oldA = false;
-    static bool oldB = false;
-    bool newB = fast_read_pin(ENCODER_RIGHT_B);
-    bool newA = fast_read_pin(ENCODER_RIGHT_CLK) ^ newB;
-    int delta = ENCODER_RIGHT_POLARITY * ((oldA ^ newB) - (newA ^ oldB));
-    m_right_counter += delta;
-    oldA = newA;
-    oldB = newB;
+    uint8_t state = read_state(ENCODER_RIGHT_CLK, ENCODER_RIGHT_B);
+    int8_t delta = pgm_read_byte_near(quadrature_table + ((m_right_state << 2) | state));
+    m_right_counter += ENCODER_RIGHT_POLARITY * delta;
+    m_right_state = state;
+#if ENCODER_PERIOD_TIMING
+    m_right_edge_time = micros();
+#endif
   }
 
   /**
@@ -129,23 +197,44 @@ class Encoders {
    *
    * If using an IMU, prefer that for measurement of angular velocity
    * and angle.
+   *
+   * With USE_FIXED_POINT set, the changes are calculated in fixed point.
+   * A Q16.16 distance would overflow after about 32 metres so, instead,
+   * the total counts are kept and converted only when they are asked for.
    */
   void update() {
     int left_delta = 0;
     int right_delta = 0;
+#if ENCODER_PERIOD_TIMING
+    uint32_t left_edge_time;
+    uint32_t right_edge_time;
+#endif
     // Make sure values don't change while being read. Be quick.
     ATOMIC {
       left_delta = m_left_counter;
       right_delta = m_right_counter;
       m_left_counter = 0;
       m_right_counter = 0;
+#if ENCODER_PERIOD_TIMING
+      left_edge_time = m_left_edge_time;
+      right_edge_time = m_right_edge_time;
+#endif
     }
-    float left_change = left_delta * MM_PER_COUNT_LEFT;
-    float right_change = right_delta * MM_PER_COUNT_RIGHT;
-    m_fwd_change = 0.5 * (right_change + left_change);
+#if ENCODER_PERIOD_TIMING
+    m_left_timer.update(left_delta, left_edge_time);
+    m_right_timer.update(right_delta, right_edge_time);
+#endif
+    real_t left_change = left_delta * MM_PER_COUNT_LEFT_REAL;
+    real_t right_change = right_delta * MM_PER_COUNT_RIGHT_REAL;
+    m_fwd_change = (right_change + left_change) / 2;
+    m_rot_change = scale(right_change - left_change, DEG_PER_MM_DIFFERENCE_GAIN);
+#if USE_FIXED_POINT
+    m_left_total += left_delta;
+    m_right_total += right_delta;
+#else
     m_robot_distance += m_fwd_change;
-    m_rot_change = (right_change - left_change) * DEG_PER_MM_DIFFERENCE;
     m_robot_angle += m_rot_change;
+#endif
   }
 
   /**
@@ -165,65 +254,192 @@ class Encoders {
    * calls so there will not even be a function call overhead.
    */
   float robot_distance() {
+#if USE_FIXED_POINT
+    long left, right;
+    ATOMIC {
+      left = m_left_total;
+      right = m_right_total;
+    }
+    return 0.5f * (right * MM_PER_COUNT_RIGHT + left * MM_PER_COUNT_LEFT);
+#else
     float distance;
     ATOMIC {
       distance = m_robot_distance;
     }
     return distance;
+#endif
   }
 
+#if ENCODER_PERIOD_TIMING
   float robot_speed() {
-    float speed;
+    float left, right;
+    wheel_speeds(left, right);
+    return 0.5f * (right + left);
+  }
+
+  float robot_omega() {
+    float left, right;
+    wheel_speeds(left, right);
+    return (right - left) * DEG_PER_MM_DIFFERENCE;
+  }
+#else
+  float robot_speed() {
+    real_t change;
     ATOMIC {
-      speed = LOOP_FREQUENCY * m_fwd_change;
+      change = m_fwd_change;
     }
-    return speed;
+    return LOOP_FREQUENCY * real_to_float(change);
   }
 
   float robot_omega() {
-    float omega;
+    real_t change;
     ATOMIC {
-      omega = LOOP_FREQUENCY * m_rot_change;
+      change = m_rot_change;
     }
-    return omega;
+    return LOOP_FREQUENCY * real_to_float(change);
   }
+#endif
 
   float robot_fwd_change() {
-    float distance;
+    real_t distance;
     ATOMIC {
-      ;
       distance = m_fwd_change;
     }
-    return distance;
+    return real_to_float(distance);
   }
 
   float robot_rot_change() {
-    float distance;
+    real_t distance;
     ATOMIC {
       distance = m_rot_change;
     }
-    return distance;
+    return real_to_float(distance);
   }
 
   float robot_angle() {
+#if USE_FIXED_POINT
+    long left, right;
+    ATOMIC {
+      left = m_left_total;
+      right = m_right_total;
+    }
+    return (right * MM_PER_COUNT_RIGHT - left * MM_PER_COUNT_LEFT) * DEG_PER_MM_DIFFERENCE;
+#else
     float angle;
     ATOMIC {
       angle = m_robot_angle;
     }
     return angle;
+#endif
+  }
+
+  /**
+   * The controllers run inside systick, straight after update(), so they can
+   * have the changes without a guard and without converting them to float.
+   */
+  real_t isr_fwd_change() {
+    return m_fwd_change;
+  }
+
+  real_t isr_rot_change() {
+    return m_rot_change;
+  }
+
+  /// @brief  the same as robot_distance() in whole mm, for reporting from systick
+  long isr_robot_distance() {
+#if USE_FIXED_POINT
+    int64_t sum = (int64_t)m_right_total * MM_PER_COUNT_RIGHT_REAL + (int64_t)m_left_total * MM_PER_COUNT_LEFT_REAL;
+    return long(sum / (2 * 65536L));
+#else
+    return long(m_robot_distance);
+#endif
+  }
+
+  /// @brief  the same as robot_angle() times the factor, for reporting from systick
+  long isr_robot_angle(int factor = 1) {
+#if USE_FIXED_POINT
+    int64_t difference = (int64_t)m_right_total * MM_PER_COUNT_RIGHT_REAL - (int64_t)m_left_total * MM_PER_COUNT_LEFT_REAL;
+    return long((difference * factor * DEG_PER_MM_DIFFERENCE_GAIN) / ((int64_t)65536L << GAIN_FRACTION_BITS));
+#else
+    return long(factor * m_robot_angle);
+#endif
   }
 
   // None of the variables in this class should be directly available to the rest
   // of the code without a guard to ensure atomic access
  private:
+#if ENCODER_PERIOD_TIMING
+  /***
+   * Kept by update() for each wheel. Whenever there have been edges since
+   * the last update, the counts and the time they took are recorded. The
+   * floating point work is left until someone asks for the speed.
+   */
+  struct EdgeTimer {
+    uint32_t last_edge = 0;  // time of the latest edge seen by update()
+    uint32_t interval = 0;   // time taken for the counts below
+    int counts = 0;
+
+    void update(int delta, uint32_t edge_time) {
+      if (edge_time == last_edge) {
+        return;
+      }
+      interval = edge_time - last_edge;
+      counts = delta;
+      last_edge = edge_time;
+    }
+
+    /***
+     * If it has been longer than the last interval since the latest edge,
+     * the wheel must have slowed down so the speed can be no more than one
+     * count in the time since that edge.
+     */
+    float speed(float mm_per_count, uint32_t now) const {
+      uint32_t waiting = now - last_edge;
+      if (counts == 0 || interval == 0 || waiting > ENCODER_STOP_TIME_US) {
+        return 0;
+      }
+      float speed = counts * mm_per_count * 1.0e6f / interval;
+      if (waiting > interval) {
+        float limit = mm_per_count * 1.0e6f / waiting;
+        speed = constrain(speed, -limit, limit);
+      }
+      return speed;
+    }
+  };
+
+  void wheel_speeds(float &left, float &right) {
+    EdgeTimer left_timer;
+    EdgeTimer right_timer;
+    uint32_t now;
+    ATOMIC {
+      left_timer = m_left_timer;
+      right_timer = m_right_timer;
+      now = micros();
+    }
+    left = left_timer.speed(MM_PER_COUNT_LEFT, now);
+    right = right_timer.speed(MM_PER_COUNT_RIGHT, now);
+  }
+
+  EdgeTimer m_left_timer;
+  EdgeTimer m_right_timer;
+  volatile uint32_t m_left_edge_time;
+  volatile uint32_t m_right_edge_time;
+#endif
+#if USE_FIXED_POINT
+  volatile long m_left_total;
+  volatile long m_right_total;
+#else
   volatile float m_robot_distance;
   volatile float m_robot_angle;
+#endif
   // the change in distance or angle in the last tick.
-  float m_fwd_change;
-  float m_rot_change;
+  real_t m_fwd_change;
+  real_t m_rot_change;
   // internal use only to track encoder input edges
   int m_left_counter;
   int m_right_counter;
+  uint8_t m_left_state = 0;
+  uint8_t m_right_state = 0;
 };
 
 // A bit of indirection for convenience because the encoder instance is
@@ -0,0 +1,179 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef ESTIMATOR_H
+#define ESTIMATOR_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "encoders.h"
+#include "fixed.h"
+
+/***
+ * The encoders only tell us how many whole counts the wheels moved in each
+ * tick. At 500Hz that is just a few counts so the speed has a lot of
+ * quantisation noise and the D term of the controllers makes it worse.
+ *
+ * The Estimator is an observer that sits between the encoders and the
+ * controllers. It has a model of the drive train - the same first order
+ * motor model, KM and TM, that the controllers are designed from - and uses
+ * the voltage applied to the motors in the last tick to predict how far the
+ * robot will move and how its speed will change. The prediction is then
+ * corrected by the difference between that and the encoder reading. This
+ * is an alpha-beta filter with the motor model in the prediction step. It
+ * is also what a steady-state Kalman filter for this model would do.
+ *
+ * The position is not held directly. That would overflow in fixed point.
+ * Instead, the estimator keeps the difference between the estimated
+ * position and the encoder position. That stays small.
+ *
+ * ESTIMATOR_BANDWIDTH sets how quickly the estimate follows the encoders.
+ * Lower values give a smoother speed but more reliance on the model. The
+ * gains are for a critically damped pair of poles at that frequency.
+ *
+ * The estimator is only built with USE_ESTIMATOR set. Then the controllers
+ * use the filtered changes instead of the raw encoder changes and the
+ * filtered values can be read at any time. That may allow higher controller
+ * gains without chatter. Otherwise there is no estimator and systick does
+ * not spend any time on it.
+ *
+ * Call update() from systick straight after the encoders are updated.
+ */
+
+#ifndef USE_ESTIMATOR
+#define USE_ESTIMATOR 0
+#endif
+
+#ifndef ESTIMATOR_BANDWIDTH
+#define ESTIMATOR_BANDWIDTH 25.0f  // Hz
+#endif
+
+#if USE_ESTIMATOR
+
+constexpr float ESTIMATOR_POLE = 1.0f / (1.0f + 2.0f * PI * ESTIMATOR_BANDWIDTH / SYSTICK_FREQUENCY);
+constexpr float ESTIMATOR_ALPHA = 1.0f - ESTIMATOR_POLE * ESTIMATOR_POLE;
+constexpr float ESTIMATOR_BETA = (1.0f - ESTIMATOR_POLE) * (1.0f - ESTIMATOR_POLE);
+
+#if USE_FIXED_POINT
+static_assert(ESTIMATOR_BETA * SYSTICK_FREQUENCY < 127, "ESTIMATOR_BANDWIDTH is too high for the fixed point gains");
+#endif
+
+constexpr gain_t ESTIMATOR_BETA_GAIN = to_gain(ESTIMATOR_BETA * LOOP_FREQUENCY);
+constexpr gain_t ESTIMATOR_OFFSET_GAIN = to_gain(1.0f - ESTIMATOR_ALPHA);
+constexpr gain_t ESTIMATOR_FWD_VOLTS_GAIN = to_gain(FWD_KM * LOOP_INTERVAL / FWD_TM);
+constexpr gain_t ESTIMATOR_FWD_DECAY_GAIN = to_gain(LOOP_INTERVAL / FWD_TM);
+constexpr gain_t ESTIMATOR_ROT_VOLTS_GAIN = to_gain(ROT_KM * LOOP_INTERVAL / ROT_TM);
+constexpr gain_t ESTIMATOR_ROT_DECAY_GAIN = to_gain(LOOP_INTERVAL / ROT_TM);
+
+class Estimator;
+extern Estimator estimator;
+
+class Estimator {
+ public:
+  void reset() {
+    ATOMIC {
+      m_fwd = Channel();
+      m_rot = Channel();
+    }
+  }
+
+  /***
+   * Note: Runs from the systick interrupt. DO NOT call this directly.
+   * @param left_volts, right_volts the motor voltages from the last tick
+   */
+  void update(real_t left_volts, real_t right_volts) {
+    real_t fwd_volts = (right_volts + left_volts) / 2;
+    real_t rot_volts = (right_volts - left_volts) / 2;
+    m_fwd.update(encoders.isr_fwd_change(), fwd_volts, ESTIMATOR_FWD_VOLTS_GAIN, ESTIMATOR_FWD_DECAY_GAIN);
+    m_rot.update(encoders.isr_rot_change(), rot_volts, ESTIMATOR_ROT_VOLTS_GAIN, ESTIMATOR_ROT_DECAY_GAIN);
+  }
+
+  /***
+   * The filtered changes in the last tick. Only for use in systick,
+   * straight after update().
+   */
+  real_t isr_fwd_change() {
+    return m_fwd.change;
+  }
+
+  real_t isr_rot_change() {
+    return m_rot.change;
+  }
+
+  float robot_speed() {
+    real_t speed;
+    ATOMIC {
+      speed = m_fwd.speed;
+    }
+    return real_to_float(speed);
+  }
+
+  float robot_omega() {
+    real_t omega;
+    ATOMIC {
+      omega = m_rot.speed;
+    }
+    return real_to_float(omega);
+  }
+
+  float robot_distance() {
+    real_t offset;
+    float distance;
+    ATOMIC {
+      offset = m_fwd.offset;
+      distance = encoders.robot_distance();
+    }
+    return distance + real_to_float(offset);
+  }
+
+  float robot_angle() {
+    real_t offset;
+    float angle;
+    ATOMIC {
+      offset = m_rot.offset;
+      angle = encoders.robot_angle();
+    }
+    return angle + real_to_float(offset);
+  }
+
+ private:
+  struct Channel {
+    real_t offset = 0;  // estimated position - encoder position
+    real_t speed = 0;
+    real_t change = 0;  // estimated change in position over the last tick
+
+    /***
+     * The friction is modelled as BIAS_FF volts opposing the motion. Very
+     * small gains lose precision in fixed point so the speed decay and
+     * the push from the voltage are worked out separately.
+     */
+    void update(real_t measured, real_t volts, gain_t volts_gain, gain_t decay_gain) {
+      if (speed > 0) {
+        volts -= BIAS_FF_REAL;
+      } else if (speed < 0) {
+        volts += BIAS_FF_REAL;
+      }
+      real_t predicted = offset + scale(speed, LOOP_INTERVAL_GAIN) - measured;
+      speed += scale(volts, volts_gain) - scale(speed, decay_gain);
+      speed -= scale(predicted, ESTIMATOR_BETA_GAIN);
+      real_t new_offset = scale(predicted, ESTIMATOR_OFFSET_GAIN);
+      change = measured + new_offset - offset;
+      offset = new_offset;
+    }
+  };
+
+  Channel m_fwd;
+  Channel m_rot;
+};
+
+#endif  // USE_ESTIMATOR
+
+#endif
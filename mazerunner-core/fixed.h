@@ -0,0 +1,146 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <Arduino.h>
+
+/***
+ * The ATmega328 has no floating point hardware. Every float add or multiply
+ * in the systick chain is a library call of a hundred cycles or more. With
+ * USE_FIXED_POINT set, the profiles, encoders, steering and motor controllers
+ * do their systick work in fixed point instead.
+ *
+ * Two types are used. A real_t holds a value such as a position, speed or
+ * voltage. A gain_t holds a constant that it gets multiplied by, such as a
+ * controller gain or the loop interval. Without USE_FIXED_POINT both are
+ * just floats and all the helpers below do nothing at all.
+ *
+ * With USE_FIXED_POINT set:
+ *
+ *  - real_t is Q16.16. Values must stay inside +/-32767 with a resolution
+ *    of about 0.000015. That is fine for speeds in mm/s or deg/s, positions
+ *    within a single move and voltages. Accelerations are only used in the
+ *    start() method of a profile so they may be larger.
+ *  - gain_t is Q8.24. A gain must be less than 128 but small constants like
+ *    SPEED_FF (about 0.002) still keep six significant figures.
+ *
+ * Conversions from float constants are done by the compiler. Conversions
+ * from variables, as in Profile::start(), are done at run time so keep them
+ * out of the systick code.
+ *
+ * The public methods of all the classes still take and return floats so the
+ * rest of the code does not need to know which is in use.
+ *
+ * USE_FIXED_POINT is off by default because it has not been validated on a
+ * robot and its systick timings have not been measured. In the simulator
+ * with -d it does as well as the float build, but only because scale()
+ * rounds. When it truncated, every controller and encoder step lost half a
+ * count on average, the heading drifted away from what the robot believed
+ * and 7 of the 50 generated mazes crashed against 2 for the float build.
+ */
+
+#ifndef USE_FIXED_POINT
+#define USE_FIXED_POINT 0
+#endif
+
+#if USE_FIXED_POINT
+
+typedef int32_t real_t;
+typedef int32_t gain_t;
+
+const uint8_t GAIN_FRACTION_BITS = 24;
+
+constexpr real_t to_real(float x) {
+  return real_t(x * 65536.0f + (x < 0 ? -0.5f : 0.5f));
+}
+
+constexpr gain_t to_gain(float x) {
+  return gain_t(x * 16777216.0f + (x < 0 ? -0.5f : 0.5f));
+}
+
+inline real_t int_to_real(int x) {
+  return real_t(x) * 65536L;
+}
+
+inline float real_to_float(real_t x) {
+  return x * (1.0f / 65536.0f);
+}
+
+/// @brief  truncate towards zero like a cast from float does
+inline int real_to_int(real_t x) {
+  return int(x / 65536L);
+}
+
+inline real_t real_abs(real_t x) {
+  return x < 0 ? -x : x;
+}
+
+/// @brief  multiply a real_t value by a gain_t constant, rounding to nearest
+inline real_t scale(real_t x, gain_t k) {
+  return real_t(((int64_t)x * k + (1L << (GAIN_FRACTION_BITS - 1))) >> GAIN_FRACTION_BITS);
+}
+
+/// @brief  convert a fraction where 32768 is 1.0 into a gain
+inline gain_t fraction_to_gain(uint16_t fraction) {
+  return gain_t(fraction) << (GAIN_FRACTION_BITS - 15);
+}
+
+/// @brief  true if a value will fit in a gain
+constexpr bool gain_fits(float x) {
+  return x < 128.0f && x > -128.0f;
+}
+
+#else
+
+typedef float real_t;
+typedef float gain_t;
+
+constexpr real_t to_real(float x) {
+  return x;
+}
+
+constexpr gain_t to_gain(float x) {
+  return x;
+}
+
+inline real_t int_to_real(int x) {
+  return x;
+}
+
+inline float real_to_float(real_t x) {
+  return x;
+}
+
+inline int real_to_int(real_t x) {
+  return int(x);
+}
+
+inline real_t real_abs(real_t x) {
+  return fabsf(x);
+}
+
+inline real_t scale(real_t x, gain_t k) {
+  return x * k;
+}
+
+inline gain_t fraction_to_gain(uint16_t fraction) {
+  return fraction * (1.0f / 32768.0f);
+}
+
+constexpr bool gain_fits(float) {
+  return true;
+}
+
+#endif
+
+#endif
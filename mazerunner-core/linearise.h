@@ -0,0 +1,79 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef LINEARISE_H
+#define LINEARISE_H
+
+#include <Arduino.h>
+
+/***
+ * The wall sensors give a reading that is roughly proportional to the
+ * inverse square of the distance to the wall. The distance is then about
+ * k/sqrt(reading) where k is a calibration constant for the sensor.
+ *
+ * The square root and division are far too slow for systick so the table
+ * below holds 32768/sqrt(v) and the distance is read from that with one
+ * multiply by k. The same table serves every sensor so each channel only
+ * needs its own constant in the robot config.
+ *
+ * The readings are spread over more than a thousand counts but the curve
+ * is steepest at small values. The table is laid out like a tiny floating
+ * point number. The values 0-7 have their own entries. After that each
+ * power of two gets eight evenly spaced entries up to 4096. Interpolating
+ * between them is good to about 0.2% everywhere.
+ */
+
+const int LINEAR_MAX_DISTANCE = 200;
+const int LINEAR_MAX_VALUE = 4095;
+
+// clang-format off
+const uint16_t inverse_root_table[] PROGMEM = {
+    32768, 32768, 23170, 18919, 16384, 14654, 13377, 12385,
+    11585, 10923, 10362,  9880,  9459,  9088,  8758,  8461,
+     8192,  7723,  7327,  6986,  6689,  6426,  6193,  5983,
+     5793,  5461,  5181,  4940,  4730,  4544,  4379,  4230,
+     4096,  3862,  3664,  3493,  3344,  3213,  3096,  2991,
+     2896,  2731,  2591,  2470,  2365,  2272,  2189,  2115,
+     2048,  1931,  1832,  1747,  1672,  1607,  1548,  1496,
+     1448,  1365,  1295,  1235,  1182,  1136,  1095,  1058,
+     1024,   965,   916,   873,   836,   803,   774,   748,
+      724,   683,   648,   617,   591,   568,   547,   529,
+      512,
+};
+// clang-format on
+
+/// @brief  The integer equivalent of min(200, k/sqrt(value)). Safe in systick.
+/// @param  value a sensor reading. Anything below 1 is treated as 1
+/// @param  k the calibration constant for the sensor
+/// @return the distance in mm
+inline int linear_distance(int value, int k) {
+  value = constrain(value, 1, LINEAR_MAX_VALUE);
+  uint16_t v = value;
+  uint8_t shift = 0;
+  while (v >= 16) {
+    v >>= 1;
+    shift++;
+  }
+  uint8_t index = v;
+  if (v >= 8) {
+    index = 8 * (shift + 1) + (v - 8);
+  }
+  uint16_t root = pgm_read_word_near(inverse_root_table + index);
+  if (shift > 0) {
+    uint16_t next = pgm_read_word_near(inverse_root_table + index + 1);
+    uint16_t fraction = value & ((1 << shift) - 1);
+    root -= ((uint32_t)(root - next) * fraction) >> shift;
+  }
+  uint32_t distance = ((uint32_t)k * root + 16384) >> 15;
+  return min(distance, (uint32_t)LINEAR_MAX_DISTANCE);
+}
+
+#endif
@@ -33,6 +33,50 @@
 
 #define START Location(0, 0)
 
+/***
+ * The wall map can be stored in one of two ways. With bitboards, each row of
+ * the maze has a pair of bitmasks for its north walls and another pair for its
+ * east walls. That uses half the RAM of the WallInfo array and lets the flood
+ * work on a whole row of cells at a time.
+ *
+ * Set this to zero to use the original array of WallInfo for every cell.
+ */
+#ifndef MAZE_USE_BITBOARDS
+#define MAZE_USE_BITBOARDS 1
+#endif
+
+/***
+ * For debugging, the maze can keep track of the deepest that any of its
+ * flood queues has been and whether any of them filled up. The Reporter
+ * can print the result after a run. It costs a few bytes of RAM and a
+ * little time so leave it turned off for contests.
+ */
+#ifndef MAZE_QUEUE_STATS
+#define MAZE_QUEUE_STATS 0
+#endif
+
+/***
+ * For benchmarking, the maze can count the calls to its flood functions and
+ * heading_to_smallest() and add up the time spent in each. The time comes
+ * from MAZE_STATS_CLOCK(), which is micros() unless the benchmark has a
+ * better clock. See tools/maze-bench. Leave it turned off for contests.
+ */
+#ifndef MAZE_CALL_STATS
+#define MAZE_CALL_STATS 0
+#endif
+#if MAZE_CALL_STATS && !defined(MAZE_STATS_CLOCK)
+#define MAZE_STATS_CLOCK() micros()
+#endif
+
+/***
+ * The flood queue holds as many cells as there are around the edge of the
+ * maze. The stress test in tools/flood-stress overrides this to find out
+ * how much is really used.
+ */
+#ifndef MAZE_FLOOD_QUEUE_SIZE
+#define MAZE_FLOOD_QUEUE_SIZE (2 * (MAZE_WIDTH + MAZE_HEIGHT))
+#endif
+
 /***
  * Walls exist in the map in one of four states and so get recorded using
  * two bits in the map. There are various schemes for this but here the
@@ -131,17 +175,70 @@ enum Direction { AHEAD, RIGHT, BACK, LEFT, DIRECTION_COUNT };
  * convenient because a single byte can be used to store the cost associated
  * with each cell when performing a simple flood.
  *
- * If you extend the code to cope with a half-size maze of up to 32x32 cells
- * you will need to make changes to the way the cost is stored.
- *
- * A more sophisticated method for flooding the maze might also require larger
- * values for cost and changes will be needed. the AVR has very limited RAM
- * so the simplest option is used here.
+ * A half-size maze can have up to 32x32 cells. The size must be defined
+ * before this file is included. The EVENT setting in config.h does that.
+ * Neither dimension can be more than 32 because each row of walls is held
+ * as a single bitmask.
  */
+#ifndef MAZE_WIDTH
 #define MAZE_WIDTH 16
+#endif
+#ifndef MAZE_HEIGHT
 #define MAZE_HEIGHT 16
+#endif
 #define MAZE_CELL_COUNT (MAZE_WIDTH * MAZE_HEIGHT)
+
+#if MAZE_WIDTH > 32 || MAZE_HEIGHT > 32
+#error "The maze can be no bigger than 32x32 cells"
+#endif
+
+/***
+ * A half-size maze is not supported on the AVR. A cost can be as big as
+ * 1023 so the costs for 32x32 cells need 16 bits and take 2048 bytes.
+ * That is all the RAM of an ATmega328 before the walls take another 512
+ * bytes. The budget is in documents/maze.md.
+ */
+#if defined(__AVR__) && MAZE_CELL_COUNT > 256
+#error "A half-size maze will not fit in the RAM of the AVR"
+#endif
+
+/***
+ * The weighted flood can be used to plan speed runs. It charges extra for
+ * turns so its costs will not fit in a byte. It needs another
+ * MAZE_CELL_COUNT bytes of RAM for the cost map. That is more than the AVR
+ * can spare so it is off unless you ask for it. It is off for the simulator
+ * too so that the simulator runs the same code as the robot. Without it,
+ * the speed run follows the simple cell counting flood.
+ *
+ * The weighted costs use 14 bits. The top two bits of each cost hold the
+ * heading the robot should leave that cell by.
+ */
+#ifndef MAZE_WEIGHTED_FLOOD
+#define MAZE_WEIGHTED_FLOOD 0
+#endif
+
+/***
+ * The cost type is chosen to be as small as possible. A simple flood of a
+ * classic maze never needs more than 8 bits. Anything bigger needs 16 bits.
+ *
+ * MAX_COST marks a cell that the flood did not reach. No real cell can be
+ * further than MAZE_CELL_COUNT - 1 cells from the target so that is what
+ * MAX_COST is but the cost of a reachable cell stops at FAR_COST. That way
+ * a cell at the very end of the longest possible route is still seen as
+ * far away rather than unreachable. A cell at FAR_COST may then have no
+ * neighbour that is cheaper. It is always next to one that also has
+ * FAR_COST and is one step nearer.
+ */
+#if MAZE_WEIGHTED_FLOOD || MAZE_CELL_COUNT > 256
+typedef uint16_t cost_t;
+#else
+typedef uint8_t cost_t;
+#endif
 #define MAX_COST (MAZE_CELL_COUNT - 1)
+#define FAR_COST (MAX_COST - 1)
+#if MAZE_WEIGHTED_FLOOD
+#define MAX_WEIGHTED_COST 0x3FFF
+#endif
 
 //***************************************************************************//
 
@@ -222,15 +319,21 @@ class Location {
 /***
  * The Maze class is the heart of the micromouse data.
  *
- * In this basic version, the maze has a single goal location even though all
- * micromouse mazes can have a rectangular region that defines a goal area.
+ * The goal is a rectangle of cells. In a classic maze it is the four cells in
+ * the middle. goal() is its south west corner and is the cell to use as the
+ * target when flooding for the goal. A flood to goal() starts from every cell
+ * of the goal area at once so the costs lead to whichever goal cell is
+ * nearest. Use in_target() rather than comparing locations to see if the
+ * robot has got there.
  *
  * The two main data blocks in the class store the wall state of every cell
  * and a cost associated with every cell after the maze is flooded.
  *
  * To keep code simple, you will note that each wall is stored twice - once
  * as seen from each side. The methods in the maze take care to ensure that
- * changes to a wall are recorded in both associated cells.
+ * changes to a wall are recorded in both associated cells. The bitboard
+ * storage only records the north and east walls of each cell since the south
+ * and west walls belong to the neighbours.
  *
  * Before flooding the maze, take care to set the maze mask as appropriate.
  * See the description above for details of the mask.
@@ -241,28 +344,146 @@ class Location {
  * result in walls being changed after they were frst seen.
  *
  */
+#if MAZE_CALL_STATS
+/// @brief the number of calls to a function and the total clock ticks taken
+struct MazeCallCount {
+  uint32_t calls;
+  uint32_t time;
+};
+
+/***
+ * A full flood done by update_flood() when it has too many orphans counts
+ * as a flood as well as a repair.
+ */
+struct MazeCallStats {
+  MazeCallCount flood;
+  MazeCallCount repair;  // update_flood()
+  MazeCallCount weighted_flood;
+  MazeCallCount heading_to_smallest;
+};
+
+/// @brief adds one call and the time since it was made to a count when it goes out of scope
+class MazeCallTimer {
+ public:
+  explicit MazeCallTimer(MazeCallCount &count) : m_count(count), m_start(MAZE_STATS_CLOCK()) {
+  }
+
+  ~MazeCallTimer() {
+    m_count.calls++;
+    m_count.time += uint32_t(MAZE_STATS_CLOCK()) - m_start;
+  }
+
+ private:
+  MazeCallCount &m_count;
+  uint32_t m_start;
+};
+#define MAZE_TIME_CALL(count) MazeCallTimer maze_call_timer(count)
+#else
+#define MAZE_TIME_CALL(count)
+#endif
+
 class Maze {
  public:
   Maze() {
   }
 
+  /// @brief  the south west corner of the goal area
   Location goal() const {
     return m_goal;
   }
 
+  uint8_t goal_width() const {
+    return m_goal_width;
+  }
+
+  uint8_t goal_height() const {
+    return m_goal_height;
+  }
+
   /// @brief  changes the default goal. For example in a practice maze
-  void set_goal(const Location goal) {
+  void set_goal(const Location goal, const uint8_t width = 1, const uint8_t height = 1) {
     m_goal = goal;
+    m_goal_width = width;
+    m_goal_height = height;
+  }
+
+  /// @brief  true if the cell is anywhere in the goal area
+  bool is_goal(const Location cell) const {
+    return cell.x >= m_goal.x && cell.x < m_goal.x + m_goal_width && cell.y >= m_goal.y &&
+           cell.y < m_goal.y + m_goal_height;
+  }
+
+  /// @brief  true if the cell is the target or, for the goal, in the goal area
+  bool in_target(const Location cell, const Location target) const {
+    return target == m_goal ? is_goal(cell) : cell == target;
   }
 
   /// @brief  return the state of the walls in a cell
   WallInfo walls(const Location cell) const {
+#if MAZE_USE_BITBOARDS
+    WallInfo walls_here;
+    walls_here.north = wall_state(cell, NORTH);
+    walls_here.east = wall_state(cell, EAST);
+    walls_here.south = wall_state(cell, SOUTH);
+    walls_here.west = wall_state(cell, WEST);
+    return walls_here;
+#else
     return m_walls[cell.x][cell.y];
+#endif
+  }
+
+  /// @brief  return the state of a single wall in a cell
+  WallState wall_state(const Location cell, const Heading heading) const {
+#if MAZE_USE_BITBOARDS
+    uint8_t x = cell.x;
+    uint8_t y = cell.y;
+    const row_t *wall_rows = m_east_wall;
+    const row_t *known_rows = m_east_known;
+    // south and west walls are held as the north and east walls of the neighbour
+    switch (heading) {
+      case NORTH:
+        wall_rows = m_north_wall;
+        known_rows = m_north_known;
+        break;
+      case EAST:
+        break;
+      case SOUTH:
+        y = (y + MAZE_HEIGHT - 1) % MAZE_HEIGHT;
+        wall_rows = m_north_wall;
+        known_rows = m_north_known;
+        break;
+      case WEST:
+        x = (x + MAZE_WIDTH - 1) % MAZE_WIDTH;
+        break;
+      default:
+        return WALL;
+    }
+    row_t mask = (row_t)1 << x;
+    uint8_t state = (wall_rows[y] & mask) ? WALL : EXIT;
+    if (not(known_rows[y] & mask)) {
+      state |= UNKNOWN;
+    }
+    return static_cast<WallState>(state);
+#else
+    WallInfo walls_here = m_walls[cell.x][cell.y];
+    switch (heading) {
+      case NORTH:
+        return walls_here.north;
+      case EAST:
+        return walls_here.east;
+      case SOUTH:
+        return walls_here.south;
+      case WEST:
+        return walls_here.west;
+      default:
+        return WALL;
+    }
+#endif
   }
 
   /// @brief return true if ANY walls in a cell have NOT been seen
   bool has_unknown_walls(const Location cell) const {
-    WallInfo walls_here = m_walls[cell.x][cell.y];
+    WallInfo walls_here = walls(cell);
     if (walls_here.north == UNKNOWN || walls_here.east == UNKNOWN || walls_here.south == UNKNOWN || walls_here.west == UNKNOWN) {
       return true;
     } else {
@@ -277,6 +498,9 @@ class Maze {
 
   /// @brief  Use the current mask to test if a given wall is an exit
   bool is_exit(const Location cell, const Heading heading) const {
+#if MAZE_USE_BITBOARDS
+    return (wall_state(cell, heading) & m_mask) == EXIT;
+#else
     bool result = false;
     WallInfo walls = m_walls[cell.x][cell.y];
     switch (heading) {
@@ -297,56 +521,61 @@ class Maze {
         break;
     }
     return result;
+#endif
   }
 
   /// @brief only change a wall if it is unknown
   // This is what you use when exploring. Once seen, a wall should not be changed again.
+  // With the OPEN mask, a newly seen wall can only make costs go up so the
+  // cost map is repaired on the spot rather than needing a full flood.
   void update_wall_state(const Location cell, const Heading heading, const WallState state) {
-    switch (heading) {
-      case NORTH:
-        if ((m_walls[cell.x][cell.y].north & UNKNOWN) != UNKNOWN) {
-          return;
-        }
-        break;
-      case EAST:
-        if ((m_walls[cell.x][cell.y].east & UNKNOWN) != UNKNOWN) {
-          return;
-        }
-        break;
-      case WEST:
-        if ((m_walls[cell.x][cell.y].west & UNKNOWN) != UNKNOWN) {
-          return;
-        }
-        break;
-      case SOUTH:
-        if ((m_walls[cell.x][cell.y].south & UNKNOWN) != UNKNOWN) {
-          return;
-        }
-        break;
-      default:
-        // ignore any other heading (blocked)
-        break;
+    if (heading >= HEADING_COUNT) {
+      // ignore any other heading (blocked)
+      return;
+    }
+    if ((wall_state(cell, heading) & UNKNOWN) != UNKNOWN) {
+      return;
     }
     set_wall_state(cell, heading, state);
+    if (state == WALL && m_mask == MASK_OPEN) {
+      update_flood(cell, heading);
+    }
+  }
+
+  /***
+   * Put back a wall from a saved copy of the map. Like initialise(), this is
+   * unconditional and leaves the costs alone. Flood the maze once all the
+   * walls are back.
+   */
+  void restore_wall_state(const Location cell, const Heading heading, const WallState state) {
+    set_wall_state(cell, heading, state);
+  }
+
+  /***
+   * The wall version goes up by one as a wall starts to change and by one
+   * more when it is done, so it is odd while a change is being made. Code in
+   * an interrupt that reads the walls, like Storage, can tell from it that
+   * the map changed while it was looking.
+   */
+  uint8_t wall_version() const {
+    return m_wall_version;
   }
 
   /// @brief set empty maze with border walls and the start cell, zero costs
   void initialise() {
+    // setting the north and east walls of every cell covers them all
     for (int x = 0; x < MAZE_WIDTH; x++) {
       for (int y = 0; y < MAZE_HEIGHT; y++) {
-        m_walls[x][y].north = UNKNOWN;
-        m_walls[x][y].east = UNKNOWN;
-        m_walls[x][y].south = UNKNOWN;
-        m_walls[x][y].west = UNKNOWN;
+        set_wall_state(Location(x, y), NORTH, UNKNOWN);
+        set_wall_state(Location(x, y), EAST, UNKNOWN);
       }
     }
+    // the neighbours wrap so this does the opposite border as well
     for (int x = 0; x < MAZE_WIDTH; x++) {
-      m_walls[x][0].south = WALL;
-      m_walls[x][MAZE_HEIGHT - 1].north = WALL;
+      set_wall_state(Location(x, 0), SOUTH, WALL);
     }
     for (int y = 0; y < MAZE_HEIGHT; y++) {
-      m_walls[0][y].west = WALL;
-      m_walls[MAZE_WIDTH - 1][y].east = WALL;
+      set_wall_state(Location(0, y), WEST, WALL);
     }
     set_wall_state(START, EAST, WALL);
     set_wall_state(START, NORTH, EXIT);
@@ -370,12 +599,16 @@ class Maze {
       return MAX_COST;
     }
     Location next_cell = cell.neighbour(heading);
-    return m_cost[next_cell.x][next_cell.y];
+    return cost(next_cell);
   }
 
   /// @brief  return the cost associated withthe supplied cell location
   uint16_t cost(const Location cell) const {
+#if MAZE_WEIGHTED_FLOOD
+    return m_cost[cell.x][cell.y] & MAX_WEIGHTED_COST;
+#else
     return m_cost[cell.x][cell.y];
+#endif
   }
 
   /***
@@ -388,42 +621,356 @@ class Maze {
    * examines each accessible cell exactly once. Consequently, it runs
    * in fairly constant time, taking 5.3ms when there are no interrupts.
    *
-   * @param target - the cell from which all distances are calculated
+   * With bitboard storage, the flood does not need the queue. Instead it
+   * keeps a bitmask of the frontier cells in each row. All the frontier
+   * cells in a row can then move east, west, north or south together with
+   * a couple of shifts and masks. Only the rows either side of the frontier
+   * need to be looked at for each step.
+   *
+   * Use the CLI command FLOOD to measure the time taken on the robot.
+   *
+   * @param target - the cell from which all distances are calculated. For
+   *                 goal() that is every cell in the goal area.
    */
 
   void flood(const Location target) {
+    MAZE_TIME_CALL(m_call_stats.flood);
     for (int x = 0; x < MAZE_WIDTH; x++) {
       for (int y = 0; y < MAZE_HEIGHT; y++) {
-        m_cost[x][y] = (uint8_t)MAX_COST;
+        m_cost[x][y] = (cost_t)MAX_COST;
       }
     }
+    m_flood_target = target;
+    m_repairable = (m_mask == MASK_OPEN);
+#if MAZE_USE_BITBOARDS
+    row_t east_exits[MAZE_HEIGHT];
+    row_t north_exits[MAZE_HEIGHT];
+    row_t frontier[MAZE_HEIGHT];
+    row_t reached[MAZE_HEIGHT];
+    row_t next[MAZE_HEIGHT];
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      east_exits[y] = exits(m_east_wall[y], m_east_known[y]);
+      north_exits[y] = exits(m_north_wall[y], m_north_known[y]);
+      frontier[y] = 0;
+      reached[y] = 0;
+    }
+    // the frontier only ever occupies rows min_y to max_y
+    int min_y = target.y;
+    int max_y = target.y + target_height(target) - 1;
+    for (int y = min_y; y <= max_y; y++) {
+      for (int x = target.x; x < target.x + target_width(target); x++) {
+        frontier[y] |= (row_t)1 << x;
+        m_cost[x][y] = 0;
+      }
+      reached[y] = frontier[y];
+    }
+    uint16_t newCost = 0;
+    while (min_y <= max_y) {
+      if (newCost < FAR_COST) {
+        newCost++;
+      }
+      int first = (min_y > 0) ? min_y - 1 : 0;
+      int last = (max_y < MAZE_HEIGHT - 1) ? max_y + 1 : MAZE_HEIGHT - 1;
+      min_y = MAZE_HEIGHT;
+      max_y = -1;
+      for (int y = first; y <= last; y++) {
+        row_t here = frontier[y];
+        // east needs an east exit here. west needs an east exit in the cell to the west
+        row_t grown = ((here & east_exits[y]) << 1) | ((here >> 1) & east_exits[y]);
+        if (y > 0) {
+          grown |= frontier[y - 1] & north_exits[y - 1];
+        }
+        if (y < MAZE_HEIGHT - 1) {
+          grown |= frontier[y + 1] & north_exits[y];
+        }
+        grown &= ~reached[y];
+        next[y] = grown;
+        if (grown) {
+          reached[y] |= grown;
+          if (y < min_y) {
+            min_y = y;
+          }
+          max_y = y;
+          for (int x = 0; grown; x++, grown >>= 1) {
+            if (grown & 1) {
+              m_cost[x][y] = newCost;
+            }
+          }
+        }
+      }
+      for (int y = first; y <= last; y++) {
+        frontier[y] = next[y];
+      }
+    }
+#else
     /***
      * When the maze is being flooded, there is a queue of 'frontier'
      * cells. These are the cells that are waiting to be checked for
      * neighbours. I believe the maximum size that this queue can
-     * possibly be for a classic maze is 64 (MAZE_CELL_COUNT/4) cells.
-     * HOWEVER, this is unproven
+     * possibly be for a classic maze is 64 cells. That is the number
+     * of cells around the edge so FLOOD_QUEUE_SIZE scales the same way
+     * for other sizes. tools/flood-stress will test the bound.
      */
-    Queue<Location, MAZE_CELL_COUNT / 4> queue;
-    m_cost[target.x][target.y] = 0;
-    queue.add(target);
+    FloodQueue queue;
+    for (int x = target.x; x < target.x + target_width(target); x++) {
+      for (int y = target.y; y < target.y + target_height(target); y++) {
+        m_cost[x][y] = 0;
+        queue.add(Location(x, y));
+      }
+    }
+    bool complete = propagate_costs(queue);
+    record_queue(queue.high_water(), not complete);
+    while (not complete) {
+      // a cell that was left out still has a neighbour that can improve it
+      complete = true;
+      for (int x = 0; x < MAZE_WIDTH; x++) {
+        for (int y = 0; y < MAZE_HEIGHT; y++) {
+          if (m_cost[x][y] != MAX_COST) {
+            queue.clear();
+            queue.add(Location(x, y));
+            if (not propagate_costs(queue)) {
+              complete = false;
+            }
+          }
+        }
+      }
+    }
+#endif
+  }
+
+#if MAZE_QUEUE_STATS
+  /// @brief the most items held by any flood queue since the last reset
+  int queue_high_water() const {
+    return m_queue_high_water;
+  }
+
+  /// @brief true if any flood queue has filled up since the last reset
+  bool queue_filled() const {
+    return m_queue_filled;
+  }
+
+  void reset_queue_stats() {
+    m_queue_high_water = 0;
+    m_queue_filled = false;
+  }
+#endif
+
+#if MAZE_CALL_STATS
+  const MazeCallStats &call_stats() const {
+    return m_call_stats;
+  }
+
+  void reset_call_stats() {
+    m_call_stats = MazeCallStats();
+  }
+#endif
+
+  /***
+   * @brief repair the cost map after a wall has been added
+   *
+   * During the search, the maze is flooded with the OPEN mask so that
+   * finding a new wall can only ever make costs go up. Rather than
+   * flooding all 256 cells again, this works out which cells have lost
+   * their route to the last flood target and re-floods only those.
+   *
+   * First, cells that no longer have a neighbour one step closer to the
+   * target are cleared. Any cells that relied on them are checked in turn.
+   * These are the orphans. Each orphan then gets the best cost it can find
+   * from its neighbours and that is spread through the orphaned region
+   * just as in the full flood.
+   *
+   * Mostly, the new wall does not change anything and this returns after
+   * looking at a single cell. A long dead end being closed off might
+   * orphan a few dozen cells. If there are more orphans than can be
+   * tracked, it gives up and does a full flood.
+   *
+   * @param cell    - one of the cells either side of the new wall
+   * @param heading - the direction of the wall as seen from cell
+   *
+   * Only costs from a simple flood with the OPEN mask can be repaired.
+   */
+  void update_flood(const Location cell, const Heading heading) {
+    MAZE_TIME_CALL(m_call_stats.repair);
+    Location next_cell = cell.neighbour(heading);
+    if (not m_repairable) {
+      return;
+    }
+    cost_t cell_cost = m_cost[cell.x][cell.y];
+    cost_t next_cost = m_cost[next_cell.x][next_cell.y];
+    if (cell_cost == FAR_COST || next_cost == FAR_COST) {
+      flood(m_flood_target);  // far cells do not count their steps so they cannot be repaired
+      return;
+    }
+    // only the cell on the uphill side can have been relying on the other
+    Location seed = cell;
+    if (next_cost == cell_cost + 1) {
+      seed = next_cell;
+    } else if (cell_cost != next_cost + 1) {
+      return;
+    }
+
+    FloodQueue queue;
+    Queue<Location, MAX_ORPHANS> orphans;
+    queue.add(seed);
     while (queue.size() > 0) {
       Location here = queue.head();
-      uint16_t newCost = m_cost[here.x][here.y] + 1;
-      // the casting of enums is potentially problematic
+      cost_t here_cost = m_cost[here.x][here.y];
+      if (in_target(here, m_flood_target) || here_cost == MAX_COST || has_downhill_exit(here)) {
+        continue;
+      }
+      if (orphans.size() >= MAX_ORPHANS) {
+        // not an error. A full flood is quicker than a big repair
+        record_queue(orphans.high_water(), false);
+        flood(m_flood_target);
+        return;
+      }
+      orphans.add(here);
+      m_cost[here.x][here.y] = (cost_t)MAX_COST;
       for (int h = NORTH; h < HEADING_COUNT; h++) {
         Heading heading = static_cast<Heading>(h);
         if (is_exit(here, heading)) {
           Location nextCell = here.neighbour(heading);
-          if (m_cost[nextCell.x][nextCell.y] > newCost) {
-            m_cost[nextCell.x][nextCell.y] = newCost;
+          if (m_cost[nextCell.x][nextCell.y] == here_cost + 1) {
+            if (queue.size() >= FLOOD_QUEUE_SIZE) {
+              record_queue(queue.high_water(), true);
+              flood(m_flood_target);
+              return;
+            }
             queue.add(nextCell);
           }
         }
       }
     }
+
+    // give each orphan the best cost available from its neighbours
+    while (orphans.size() > 0) {
+      Location here = orphans.head();
+      uint16_t best_cost = MAX_COST;
+      for (int h = NORTH; h < HEADING_COUNT; h++) {
+        Heading heading = static_cast<Heading>(h);
+        if (is_exit(here, heading)) {
+          Location nextCell = here.neighbour(heading);
+          uint16_t newCost = m_cost[nextCell.x][nextCell.y];
+          if (newCost == MAX_COST) {
+            continue;
+          }
+          if (newCost < FAR_COST) {
+            newCost++;
+          }
+          if (newCost < best_cost) {
+            best_cost = newCost;
+          }
+        }
+      }
+      if (best_cost < MAX_COST) {
+        m_cost[here.x][here.y] = best_cost;
+        queue.add(here);
+      }
+    }
+    bool complete = propagate_costs(queue);
+    record_queue(queue.high_water(), not complete);
+    record_queue(orphans.high_water(), false);
+    if (not complete) {
+      flood(m_flood_target);
+    }
   }
 
+#if MAZE_WEIGHTED_FLOOD
+  /***
+   * @brief flood the maze with extra costs for turning
+   *
+   * The simple flood just counts cells so a route with lots of turns looks
+   * as good as one with a few long straights. In a speed run, the turns
+   * take much longer than the straights. The weighted flood charges for each
+   * cell and adds a penalty wherever the robot would have to turn.
+   *
+   * Properly, the cost should be worked out for every cell and heading but
+   * there is not enough RAM for that. Instead, each cell keeps only its best
+   * cost and the heading the robot should leave by in order to get it. That
+   * is an approximation. Following the headings from any cell will always
+   * reach the target but it is not guaranteed to be the very best route.
+   *
+   * It goes wrong where a cell has two ways out that cost nearly the same.
+   * Say the best way out of cell C is north and going east costs a little
+   * more. A robot driving east into C has to pay for a turn to follow the
+   * north route. Going straight on to the east would have been cheaper if
+   * the difference is less than turn_cost but C only remembers north. So
+   * the cost of the cell before C can be too high by up to turn_cost, and
+   * the route can have a turn that a full flood over (cell, heading) states
+   * would have avoided. The error can repeat wherever that happens along a
+   * route. The simple flood can be worse. It ignores turns altogether.
+   *
+   * Cells can have their costs improved more than once so the flood keeps
+   * going until nothing changes. A cell is never in the queue twice. If the
+   * queue fills up, a sweep over the whole maze picks up the cells that were
+   * left out.
+   *
+   * Use flood_direction() rather than heading_to_smallest() to follow the
+   * result. Unreachable cells have the cost MAX_WEIGHTED_COST.
+   *
+   * @param target       - the cell from which all costs are calculated
+   * @param straight_cost - cost of moving to the next cell
+   * @param turn_cost     - extra cost of a 90 degree turn
+   * @param reverse_cost  - extra cost of turning around
+   */
+  void weighted_flood(const Location target, const uint8_t straight_cost, const uint8_t turn_cost, const uint8_t reverse_cost) {
+    MAZE_TIME_CALL(m_call_stats.weighted_flood);
+    for (int x = 0; x < MAZE_WIDTH; x++) {
+      for (int y = 0; y < MAZE_HEIGHT; y++) {
+        m_cost[x][y] = MAX_WEIGHTED_COST;
+      }
+    }
+    m_flood_target = target;
+    m_repairable = false;
+    WeightedFlood flood;
+    flood.straight_cost = straight_cost;
+    flood.turn_cost = turn_cost;
+    flood.reverse_cost = reverse_cost;
+    for (int i = 0; i < MAZE_CELL_COUNT / 8; i++) {
+      flood.queued[i] = 0;
+    }
+    for (int x = target.x; x < target.x + target_width(target); x++) {
+      for (int y = target.y; y < target.y + target_height(target); y++) {
+        m_cost[x][y] = 0;
+        flood.set_queued(Location(x, y), true);
+        flood.queue.add(Location(x, y));
+      }
+    }
+    bool dropped = false;
+    bool filled = false;
+    while (true) {
+      while (flood.queue.size() > 0) {
+        Location here = flood.queue.head();
+        flood.set_queued(here, false);
+        if (not relax_neighbours(here, flood)) {
+          dropped = true;
+        }
+      }
+      if (not dropped) {
+        break;
+      }
+      filled = true;
+      dropped = false;
+      for (int x = 0; x < MAZE_WIDTH; x++) {
+        for (int y = 0; y < MAZE_HEIGHT; y++) {
+          if (not relax_neighbours(Location(x, y), flood)) {
+            dropped = true;
+          }
+        }
+      }
+    }
+    record_queue(flood.queue.high_water(), filled);
+  }
+
+  /// @brief  the heading to leave a cell by after a weighted flood
+  Heading flood_direction(const Location cell) const {
+    if (in_target(cell, m_flood_target) || cost(cell) == MAX_WEIGHTED_COST) {
+      return BLOCKED;
+    }
+    return static_cast<Heading>(m_cost[cell.x][cell.y] >> 14);
+  }
+#endif
+
   /***
    * Algorithm looks around the current cell and records the smallest
    * neighbour and its direction. By starting with the supplied direction,
@@ -438,9 +985,13 @@ class Maze {
    * @return
    */
   Heading heading_to_smallest(const Location cell, const Heading start_heading) const {
+    MAZE_TIME_CALL(m_call_stats.heading_to_smallest);
     Heading next_heading = start_heading;
     Heading best_heading = BLOCKED;
     uint16_t best_cost = cost(cell);
+    if (best_cost == FAR_COST) {
+      best_cost = MAX_COST;  // another far neighbour will do. See FAR_COST
+    }
     uint16_t cost;
     cost = neighbour_cost(cell, next_heading);
     if (cost < best_cost) {
@@ -472,9 +1023,222 @@ class Maze {
   }
 
  private:
+  // See the comment in flood() for the queue size
+  enum {
+    FLOOD_QUEUE_SIZE = MAZE_FLOOD_QUEUE_SIZE,
+    MAX_ORPHANS = MAZE_WIDTH + MAZE_HEIGHT,
+  };
+  typedef Queue<Location, FLOOD_QUEUE_SIZE> FloodQueue;
+  // one bit for each cell in a row of the maze
+#if MAZE_WIDTH > 16
+  typedef uint32_t row_t;
+#else
+  typedef uint16_t row_t;
+#endif
+
+#if MAZE_USE_BITBOARDS
+  /// @brief  use the current mask to turn a row of walls into a row of exits
+  row_t exits(const row_t walls, const row_t known) const {
+    row_t result = ~walls;
+    if (m_mask & UNKNOWN) {
+      result &= known;
+    }
+    return result;
+  }
+#endif
+
+  /// @brief  the size of the area that a flood to the target starts from
+  uint8_t target_width(const Location target) const {
+    return target == m_goal ? m_goal_width : 1;
+  }
+
+  uint8_t target_height(const Location target) const {
+    return target == m_goal ? m_goal_height : 1;
+  }
+
+  /// @brief true if a neighbour of the cell is one step closer to the target
+  bool has_downhill_exit(const Location cell) const {
+    cost_t downhill_cost = m_cost[cell.x][cell.y] - 1;
+    for (int h = NORTH; h < HEADING_COUNT; h++) {
+      Heading heading = static_cast<Heading>(h);
+      if (is_exit(cell, heading)) {
+        Location nextCell = cell.neighbour(heading);
+        if (m_cost[nextCell.x][nextCell.y] == downhill_cost) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  /***
+   * The common part of the full and incremental floods. Every cell in the
+   * queue offers its cost plus one to its neighbours. Any neighbour that
+   * can be improved is updated and queued in turn.
+   *
+   * Returns false if the queue filled up before the flood was complete.
+   * The cell that could not be queued keeps its old cost. The full flood
+   * rarely fills the queue but, if it does, it sweeps the maze until no
+   * cell is left out. The repair in update_flood() can queue a cell more
+   * than once so it falls back to a full flood.
+   */
+  bool propagate_costs(FloodQueue &queue) {
+    while (queue.size() > 0) {
+      Location here = queue.head();
+      uint16_t newCost = m_cost[here.x][here.y] + 1;
+      if (newCost > FAR_COST) {
+        newCost = FAR_COST;
+      }
+      // the casting of enums is potentially problematic
+      for (int h = NORTH; h < HEADING_COUNT; h++) {
+        Heading heading = static_cast<Heading>(h);
+        if (is_exit(here, heading)) {
+          Location nextCell = here.neighbour(heading);
+          if (m_cost[nextCell.x][nextCell.y] > newCost) {
+            if (queue.size() >= FLOOD_QUEUE_SIZE) {
+              return false;
+            }
+            m_cost[nextCell.x][nextCell.y] = newCost;
+            queue.add(nextCell);
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+#if MAZE_WEIGHTED_FLOOD
+  // everything the weighted flood needs to carry around
+  struct WeightedFlood {
+    uint8_t straight_cost;
+    uint8_t turn_cost;
+    uint8_t reverse_cost;
+    uint8_t queued[MAZE_CELL_COUNT / 8];  // one bit per cell
+    FloodQueue queue;
+
+    bool is_queued(const Location cell) const {
+      int index = cell.x * MAZE_HEIGHT + cell.y;
+      return queued[index / 8] & (1 << (index % 8));
+    }
+
+    void set_queued(const Location cell, bool state) {
+      int index = cell.x * MAZE_HEIGHT + cell.y;
+      if (state) {
+        queued[index / 8] |= (1 << (index % 8));
+      } else {
+        queued[index / 8] &= ~(1 << (index % 8));
+      }
+    }
+  };
+
+  /***
+   * Offer a cost to each neighbour of a cell. A neighbour that drives into
+   * this cell has to turn unless it is already heading the way this cell
+   * wants to leave. The target is where the robot stops so there are no
+   * turns to pay for there.
+   *
+   * Returns false if a neighbour was improved but could not be queued.
+   */
+  bool relax_neighbours(const Location cell, WeightedFlood &flood) {
+    uint16_t here_cost = cost(cell);
+    if (here_cost == MAX_WEIGHTED_COST) {
+      return true;
+    }
+    bool all_queued = true;
+    Heading leaving = static_cast<Heading>(m_cost[cell.x][cell.y] >> 14);
+    for (int h = NORTH; h < HEADING_COUNT; h++) {
+      Heading heading = static_cast<Heading>(h);
+      if (not is_exit(cell, heading)) {
+        continue;
+      }
+      Heading arriving = behind_from(heading);
+      uint16_t new_cost = here_cost + flood.straight_cost;
+      if (not in_target(cell, m_flood_target) && arriving != leaving) {
+        new_cost += (arriving == behind_from(leaving)) ? flood.reverse_cost : flood.turn_cost;
+      }
+      if (new_cost >= MAX_WEIGHTED_COST) {
+        new_cost = MAX_WEIGHTED_COST - 1;  // far away but not unreachable
+      }
+      Location next_cell = cell.neighbour(heading);
+      if (new_cost < cost(next_cell)) {
+        m_cost[next_cell.x][next_cell.y] = (cost_t)(new_cost | (arriving << 14));
+        if (not flood.is_queued(next_cell)) {
+          if (flood.queue.size() >= FLOOD_QUEUE_SIZE) {
+            all_queued = false;
+          } else {
+            flood.queue.add(next_cell);
+            flood.set_queued(next_cell, true);
+          }
+        }
+      }
+    }
+    return all_queued;
+  }
+#endif
+
+  /// @brief keep track of the deepest flood queue for the debug report
+  void record_queue(int depth, bool filled) {
+#if MAZE_QUEUE_STATS
+    if (depth > m_queue_high_water) {
+      m_queue_high_water = depth;
+    }
+    if (filled) {
+      m_queue_filled = true;
+    }
+#else
+    (void)depth;
+    (void)filled;
+#endif
+  }
+
   // Unconditionally set a wall state.
   // use update_wall_state() when exploring
   void set_wall_state(const Location loc, const Heading heading, const WallState state) {
+    m_wall_version++;
+    // the barriers stop the compiler moving the change outside the odd version
+    __asm__ __volatile__("" ::: "memory");
+    store_wall_state(loc, heading, state);
+    __asm__ __volatile__("" ::: "memory");
+    m_wall_version++;
+  }
+
+  void store_wall_state(const Location loc, const Heading heading, const WallState state) {
+#if MAZE_USE_BITBOARDS
+    uint8_t x = loc.x;
+    uint8_t y = loc.y;
+    row_t *wall_rows = m_east_wall;
+    row_t *known_rows = m_east_known;
+    switch (heading) {
+      case NORTH:
+        wall_rows = m_north_wall;
+        known_rows = m_north_known;
+        break;
+      case EAST:
+        break;
+      case SOUTH:
+        y = (y + MAZE_HEIGHT - 1) % MAZE_HEIGHT;
+        wall_rows = m_north_wall;
+        known_rows = m_north_known;
+        break;
+      case WEST:
+        x = (x + MAZE_WIDTH - 1) % MAZE_WIDTH;
+        break;
+      default:
+        // ignore any other heading (blocked)
+        return;
+    }
+    row_t mask = (row_t)1 << x;
+    if (state & WALL) {
+      wall_rows[y] |= mask;
+    } else {
+      wall_rows[y] &= ~mask;
+    }
+    if (state & UNKNOWN) {
+      known_rows[y] &= ~mask;
+    } else {
+      known_rows[y] |= mask;
+    }
+#else
     switch (heading) {
       case NORTH:
         m_walls[loc.x][loc.y].north = state;
@@ -496,12 +1260,33 @@ class Maze {
         // ignore any other heading (blocked)
         break;
     }
+#endif
   }
   MazeMask m_mask = MASK_OPEN;
   Location m_goal{7, 7};
-  // on Arduino only use 8 bits for cost to save space
-  uint8_t m_cost[MAZE_WIDTH][MAZE_HEIGHT];
+  uint8_t m_goal_width = 1;
+  uint8_t m_goal_height = 1;
+  Location m_flood_target{7, 7};  // needed to repair the costs after a new wall
+  bool m_repairable = false;  // true if a new wall can be fixed by update_flood()
+  volatile uint8_t m_wall_version = 0;
+#if MAZE_QUEUE_STATS
+  int m_queue_high_water = 0;
+  bool m_queue_filled = false;
+#endif
+#if MAZE_CALL_STATS
+  mutable MazeCallStats m_call_stats = {};
+#endif
+  // on Arduino only use 8 bits for cost to save space unless they need more
+  cost_t m_cost[MAZE_WIDTH][MAZE_HEIGHT];
+#if MAZE_USE_BITBOARDS
+  // bit x of each row holds the wall of the cell at (x,y)
+  row_t m_north_wall[MAZE_HEIGHT];
+  row_t m_north_known[MAZE_HEIGHT];
+  row_t m_east_wall[MAZE_HEIGHT];
+  row_t m_east_known[MAZE_HEIGHT];
+#else
   WallInfo m_walls[MAZE_WIDTH][MAZE_HEIGHT];
+#endif
 };
 
 extern Maze maze;
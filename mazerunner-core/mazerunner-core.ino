@@ -15,14 +15,20 @@
 #include "cli.h"
 #include "config.h"
 #include "encoders.h"
+#include "estimator.h"
 #include "maze.h"
 #include "motion.h"
 #include "motors.h"
 #include "mouse.h"
+#include "receiver.h"
+#include "recorder.h"
 #include "reporting.h"
 #include "sensors.h"
+#include "settings.h"
+#include "storage.h"
 #include "switches.h"
 #include "systick.h"
+#include "telemetry.h"
 
 /******************************************************************************/
 
@@ -33,6 +39,9 @@ AnalogueConverter adc;                    // controls all analogue conversions
 Battery battery(BATTERY_ADC_CHANNEL);     // monitors battery voltage
 Switches switches(SWITCHES_ADC_CHANNEL);  // monitors the button and switches
 Encoders encoders;                        // tracks the wheel encoder counts
+#if USE_ESTIMATOR
+Estimator estimator;                      // filtered speeds and positions
+#endif
 Sensors sensors;                          // make sensor alues from adc vdata
 Motion motion;                            // high level motion operations
 Motors motors;                            // low level control for drive motors
@@ -42,6 +51,11 @@ Maze maze PERSISTENT;                     // holds maze map (even after a reset)
 Mouse mouse;                              // all the main robot logic is here
 CommandLineInterface cli;                 // user interaction on the serial port
 Reporter reporter;                        // formatted reporting of robot state
+Telemetry telemetry;                      // binary reporting during runs
+Recorder recorder;                        // systick samples kept for later
+Storage storage;                          // keeps the maze in EEPROM
+Receiver receiver;                        // serial input collected by systick
+Settings settings;                        // tuning constants that the CLI can change
 
 /******************************************************************************/
 
@@ -71,8 +85,15 @@ void setup() {
   encoders.begin();
   /// do not begin systick until the hardware is setup
   systick.begin();
+  maze.set_goal(GOAL, GOAL_WIDTH, GOAL_HEIGHT);
+#if STORAGE_LOAD_AT_START
+  if (storage.load()) {
+    Serial.println(F("Maze loaded"));
+  }
+#endif
   /// keep the button held down after a reset to clear the maze
   if (switches.button_pressed()) {
+    storage.stop();  // keep the saved maze in case this was a mistake
     maze.initialise();
     mouse.blink(2);
     Serial.println(F("Maze cleared"));
@@ -81,7 +102,6 @@ void setup() {
   /// leave the emitters off unless we are actually using the sensors
   /// less power, less risk
   sensors.disable();
-  maze.set_goal(GOAL);
   reporter.set_printer(Serial);
   Serial.println();
   Serial.println(F(CODE));
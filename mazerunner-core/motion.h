@@ -13,8 +13,89 @@
 #define MOTION_H
 
 #include <Arduino.h>
+#include "config.h"
 #include "motors.h"
 #include "profile.h"
+#include "queue.h"
+#include "sensors.h"
+
+/***
+ * The motion command queue holds a few segments of a path so that they can
+ * be started by systick the moment the segment before them is finished.
+ * Each command is only a few bytes but moves and turns also need a profile
+ * set-up of about 40 bytes. Those go in a second, shorter queue. A speed
+ * run turn needs five commands and two set-ups. Two set-ups are enough
+ * because the one for a move or turn leaves the queue as soon as it starts.
+ * The speed runs in the simulator take just as long as they do with four.
+ */
+#ifndef MOTION_QUEUE_SIZE
+#define MOTION_QUEUE_SIZE 8
+#endif
+
+#ifndef MOTION_PROFILE_QUEUE_SIZE
+#define MOTION_PROFILE_QUEUE_SIZE 2
+#endif
+
+static_assert(MOTION_QUEUE_SIZE >= 5 && MOTION_PROFILE_QUEUE_SIZE >= 2, "The motion queues are too small for a speed run turn");
+
+/***
+ * A wall edge further than this from where an edge could be is taken to be
+ * something else, such as a reflection, and does not change the position.
+ */
+#ifndef MOTION_EDGE_WINDOW
+#define MOTION_EDGE_WINDOW 20  // mm
+#endif
+
+/***
+ * The share of the error at a wall edge that is taken off the position.
+ * Where the edge is seen depends a little on what is beyond the end of the
+ * wall, such as a wall going off to the side from the post, so it is best
+ * not to trust a single edge completely. A steady drift is still taken
+ * out over a few edges.
+ */
+#ifndef MOTION_EDGE_SHARE
+#define MOTION_EDGE_SHARE 0.5f
+#endif
+
+static_assert(MOTION_EDGE_SHARE > 0 && MOTION_EDGE_SHARE <= 1, "MOTION_EDGE_SHARE must be more than 0 and no more than 1");
+
+constexpr real_t MOTION_EDGE_WINDOW_REAL = to_real(MOTION_EDGE_WINDOW);
+constexpr gain_t MOTION_EDGE_SHARE_GAIN = to_gain(MOTION_EDGE_SHARE);
+constexpr real_t LEFT_EDGE_POS_REAL = to_real(LEFT_EDGE_POS);
+constexpr real_t RIGHT_EDGE_POS_REAL = to_real(RIGHT_EDGE_POS);
+constexpr real_t FULL_CELL_REAL = to_real(FULL_CELL);
+constexpr real_t HALF_CELL_REAL = to_real(HALF_CELL);
+
+/***
+ * A single queued motion command
+ *
+ *  - CMD_MOVE            : a forward move with the next profile set-up
+ *  - CMD_TURN            : one of the standard shaped smooth turns with the
+ *                          next profile set-up. Edge correction is turned
+ *                          off as the turn starts
+ *  - CMD_SET_SPEED       : set the forward speed, as for set_target_velocity()
+ *  - CMD_SET_POSITION    : set the forward position, as for set_position()
+ *  - CMD_STEERING        : change the steering mode
+ *  - CMD_EDGE_CORRECTION : turn the wall edge correction on or off
+ *
+ * Moves wait for the forward profile to finish and turns wait for the
+ * rotation profile. The others take effect straight away. The profiles are
+ * planned when the command is queued so that systick, which starts them,
+ * has no floating point arithmetic to do. See ProfileSetup.
+ */
+struct MotionCommand {
+  enum Type : uint8_t {
+    CMD_MOVE,
+    CMD_TURN,
+    CMD_SET_SPEED,
+    CMD_SET_POSITION,
+    CMD_STEERING,
+    CMD_EDGE_CORRECTION,
+  };
+  Type type;
+  uint8_t steering_mode;  // or the edge correction setting
+  real_t value;           // the speed or the position
+};
 
 /***
  *
@@ -55,6 +136,13 @@ class Motion {
     motors.stop();
     motors.disable_controllers();
     encoders.reset();
+#if USE_ESTIMATOR
+    estimator.reset();
+#endif
+    clear_commands();
+    disable_edge_correction();
+    clear_edges();
+    clear_origin();
     forward.reset();
     rotation.reset();
     motors.reset_controllers();
@@ -69,8 +157,18 @@ class Motion {
     motors.disable_controllers();
   }
 
+  /***
+   * The forward position. A move started directly measures from where it
+   * started, just as the profile does. A queued move restarts the profile
+   * from zero so its starting position is kept as the origin and the
+   * position carries on from wherever the path planner had it.
+   */
   float position() {
-    return forward.position();
+    real_t pos;
+    ATOMIC {
+      pos = forward.isr_position() + m_origin;
+    }
+    return real_to_float(pos);
   }
 
   float velocity() {
@@ -93,47 +191,265 @@ class Motion {
     return rotation.speed();
   }
 
+  // unguarded, unconverted speeds for the controllers in systick
+  real_t isr_velocity() {
+    return forward.isr_speed();
+  }
+
+  real_t isr_omega() {
+    return rotation.isr_speed();
+  }
+
+  // unguarded, unconverted positions for reporting from systick
+  real_t isr_position() {
+    return forward.isr_position() + m_origin;
+  }
+
+  real_t isr_angle() {
+    return rotation.isr_position();
+  }
+
   float alpha() {
     return rotation.acceleration();
   }
 
-  void start_move(float distance, float top_speed, float final_speed, float acceleration) {
-    forward.start(distance, top_speed, final_speed, acceleration);
+  void start_move(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    clear_origin();
+    forward.start(distance, top_speed, final_speed, acceleration, jerk);
   }
 
   bool move_finished() {
     return forward.is_finished();
   }
 
-  void move(float distance, float top_speed, float final_speed, float acceleration) {
-    forward.move(distance, top_speed, final_speed, acceleration);
+  void move(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    clear_origin();
+    forward.move(distance, top_speed, final_speed, acceleration, jerk);
   }
 
-  void start_turn(float distance, float top_speed, float final_speed, float acceleration) {
-    rotation.start(distance, top_speed, final_speed, acceleration);
+  void start_turn(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    rotation.start(distance, top_speed, final_speed, acceleration, jerk);
   }
 
   bool turn_finished() {
     return rotation.is_finished();
   }
 
-  void turn(float distance, float top_speed, float final_speed, float acceleration) {
-    rotation.move(distance, top_speed, final_speed, acceleration);
+  void turn(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    rotation.move(distance, top_speed, final_speed, acceleration, jerk);
   }
 
   void update() {
+    check_wall_edges();
+    run_commands();
     forward.update();
     rotation.update();
   }
 
+  /***
+   * The command queue lets the path planner run ahead of the robot. The
+   * queue_xxx() methods add a command and return false if the queue is
+   * full. Commands are started from systick so there is no delay between
+   * one segment finishing and the next starting. Do not use the blocking
+   * move and turn methods while there are commands waiting.
+   *
+   * Each profile is planned here, in the main loop, from the position and
+   * speed that the commands already in the queue will leave the robot at.
+   * When the queue is empty, that is where the robot is now so the first
+   * command should be queued while the robot moves at a steady speed.
+   */
+  bool queue_move(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    start_queue();
+    MotionCommand command = {MotionCommand::CMD_MOVE, 0, 0};
+    ProfileSetup profile = Profile::plan(distance, m_queue_speed, top_speed, final_speed, acceleration, jerk);
+    if (!add_command(command, &profile)) {
+      return false;
+    }
+    if (profile.kind != ProfileSetup::PK_NONE) {
+      m_queue_position += distance;
+      m_queue_speed = real_to_float(profile.final_speed);
+    }
+    return true;
+  }
+
+  /// @brief  a forward move that ends at the given forward position. If the
+  ///         queued commands will already have passed it, the forward speed
+  ///         is just set to the final speed.
+  bool queue_move_to(float position, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    start_queue();
+    if (position - m_queue_position < 1.0) {
+      return queue_set_speed(final_speed);
+    }
+    return queue_move(position - m_queue_position, top_speed, final_speed, acceleration, jerk);
+  }
+
+  /// @brief  the forward speed carries on unchanged through the turn
+  bool queue_turn(const TurnParameters &params) {
+    start_queue();
+    MotionCommand command = {MotionCommand::CMD_TURN, 0, 0};
+    ProfileSetup profile = Profile::plan_shaped(params.angle, params.omega, params.alpha);
+    if (!add_command(command, &profile)) {
+      return false;
+    }
+    m_queue_position += m_queue_speed * Profile::shaped_time(params.angle, params.omega, params.alpha);
+    return true;
+  }
+
+  bool queue_set_speed(float speed) {
+    start_queue();
+    MotionCommand command = {MotionCommand::CMD_SET_SPEED, 0, to_real(speed)};
+    if (!add_command(command)) {
+      return false;
+    }
+    m_queue_speed = speed;
+    return true;
+  }
+
+  bool queue_set_position(float position) {
+    start_queue();
+    MotionCommand command = {MotionCommand::CMD_SET_POSITION, 0, to_real(position)};
+    if (!add_command(command)) {
+      return false;
+    }
+    m_queue_position = position;
+    return true;
+  }
+
+  bool queue_steering(uint8_t mode) {
+    MotionCommand command = {MotionCommand::CMD_STEERING, mode, 0};
+    return add_command(command);
+  }
+
+  bool queue_edge_correction(bool enabled) {
+    MotionCommand command = {MotionCommand::CMD_EDGE_CORRECTION, enabled, 0};
+    return add_command(command);
+  }
+
+  /// @brief  the number of commands that can be added before the queue is full
+  int command_space() {
+    int space;
+    ATOMIC {
+      space = MOTION_QUEUE_SIZE - m_commands.size();
+    }
+    return space;
+  }
+
+  /// @brief  the number of moves and turns that there is room for in the
+  ///         profile set-up queue
+  int profile_space() {
+    int space;
+    ATOMIC {
+      space = MOTION_PROFILE_QUEUE_SIZE - m_profiles.size();
+    }
+    return space;
+  }
+
+  /// @brief  true when every queued command has been started and has finished
+  bool commands_finished() {
+    bool finished;
+    ATOMIC {
+      finished = m_commands.size() == 0 && m_waiting_for == WAIT_NONE;
+    }
+    return finished;
+  }
+
+  void wait_for_commands() {
+    while (!commands_finished()) {
+      delay(2);
+    }
+  }
+
+  /// @brief  throw away any queued commands. Running profiles are not affected.
+  void clear_commands() {
+    ATOMIC {
+      m_commands.clear();
+      m_profiles.clear();
+      m_waiting_for = WAIT_NONE;
+    }
+  }
+
   void set_position(float pos) {
-    forward.set_position(pos);
+    ATOMIC {
+      m_origin = 0;
+      forward.set_position(pos);
+    }
   }
 
   void adjust_forward_position(float delta) {
     forward.adjust_position(delta);
   }
 
+  /***
+   * Wall edge correction. Every side wall ends at a cell boundary. With the
+   * forward position measured from a cell boundary, as it is in the search
+   * and on the straights of a speed run, a falling edge on the left should
+   * always be seen at LEFT_EDGE_POS, or a whole number of cells on from
+   * there. It is the same on the right.
+   *
+   * While the correction is enabled, systick takes the position at each
+   * falling edge and moves it by MOTION_EDGE_SHARE of the difference so
+   * that the robot knows where it is in the cell even after a long
+   * straight. The correction is not made while the robot is turning or not
+   * going forwards, or when the edge is more than MOTION_EDGE_WINDOW from
+   * where it should be. Nor is it made once the forward profile is braking.
+   * Moving the position on then would leave too little room to slow down
+   * and a speed run would go into its next turn too fast. The posts seen
+   * from a diagonal are not at the same places so turn it off there.
+   *
+   * Only falling edges correct the position because those are what
+   * Mouse::conf_edge_detection() calibrates. All the edges are recorded.
+   *
+   * reset_drive_system() disables the correction. Enable it only after the
+   * position has been set to a place in a cell.
+   */
+  void enable_edge_correction() {
+    m_edge_correction = true;
+  }
+
+  void disable_edge_correction() {
+    m_edge_correction = false;
+  }
+
+  bool edge_correction_enabled() {
+    return m_edge_correction;
+  }
+
+  /// @brief  forget the edges seen so far and the count of corrections
+  void clear_edges() {
+    ATOMIC {
+      m_edge_count = sensors.isr_edge_count();
+      m_edges_found = 0;
+      m_edge_corrections = 0;
+    }
+  }
+
+  /// @brief  the EDGE_xxx bits for every kind of edge seen since clear_edges()
+  uint8_t edges_found() {
+    return m_edges_found;
+  }
+
+  /// @brief  the forward position at the latest edge of one kind, such as EDGE_LEFT_FALLING
+  float edge_position(uint8_t edge) {
+    real_t position = 0;
+    ATOMIC {
+      for (int i = 0; i < EDGE_KINDS; i++) {
+        if (edge == (1 << i)) {
+          position = m_edge_positions[i];
+        }
+      }
+    }
+    return real_to_float(position);
+  }
+
+  /// @brief  the number of times the position has been corrected since clear_edges()
+  int edge_corrections() {
+    int count;
+    ATOMIC {
+      count = m_edge_corrections;
+    }
+    return count;
+  }
+
   //***************************************************************************//
 
   /**
@@ -172,6 +488,38 @@ class Motion {
     rotation.move(angle, omega, 0, alpha);
   }
 
+  /**
+   * A smooth turn in a speed run is made at constant forward speed. The
+   * robot first runs up to the start of the turn, arriving at the turn
+   * speed. If there is no room for that, it just changes to the turn speed
+   * and starts turning.
+   *
+   * The run up distance is measured from the current position.
+   *
+   * @brief run up to a smooth turn and perform it at the turn speed
+   */
+  void smooth_turn(float run_up, float top_speed, float acceleration, const TurnParameters &params) {
+    if (run_up > 0) {
+      move(run_up, top_speed, params.speed, acceleration);
+    } else {
+      forward.set_target_speed(params.speed);
+    }
+    turn_shaped(params);
+  }
+
+  /**
+   * The standard smooth turns use a shaped rotation profile. It covers the
+   * same angle as the trapezoid made from the same parameters but the speed
+   * comes from a table so that systick has less to do and every turn of the
+   * same type is identical.
+   *
+   * @brief perform the rotation for one of the standard smooth turns
+   */
+  void turn_shaped(const TurnParameters &params) {
+    rotation.reset();
+    rotation.move_shaped(params.angle, params.omega, params.alpha);
+  }
+
   /**
    *
    * @brief turn in place. Force forward speed to zero
@@ -201,8 +549,8 @@ class Motion {
    * @brief bring the robot to a halt at a specific distance
    */
   void stop_at(float position) {
-    float remaining = position - forward.position();
-    forward.move(remaining, forward.speed(), 0, forward.acceleration());
+    float remaining = position - this->position();
+    move(remaining, forward.speed(), 0, forward.acceleration());
   }
 
   /**
@@ -219,7 +567,7 @@ class Motion {
    * @brief bring the robot to a halt after a specific distance
    */
   void stop_after(float distance) {
-    forward.move(distance, forward.speed(), 0, forward.acceleration());
+    move(distance, forward.speed(), 0, forward.acceleration());
   }
 
   /**
@@ -229,7 +577,7 @@ class Motion {
    * @brief wait until the given position is reached
    */
   void wait_until_position(float position) {
-    while (forward.position() < position) {
+    while (this->position() < position) {
       delay(2);
     }
   }
@@ -241,9 +589,152 @@ class Motion {
    * @brief wait until the given distance has been travelled
    */
   void wait_until_distance(float distance) {
-    float target = forward.position() + distance;
+    float target = position() + distance;
     wait_until_position(target);
   }
+
+ private:
+  enum Waiting : uint8_t {
+    WAIT_NONE,
+    WAIT_FORWARD,
+    WAIT_ROTATION,
+  };
+
+  static const int EDGE_KINDS = 4;
+
+  void clear_origin() {
+    ATOMIC {
+      m_origin = 0;
+    }
+  }
+
+  /***
+   * Called from systick before anything else moves the profiles. The
+   * sensors are updated after motion so any new edges were found at the
+   * end of the last tick and the position is still what it was then.
+   */
+  void check_wall_edges() {
+    uint8_t count = sensors.isr_edge_count();
+    if (count == m_edge_count) {
+      return;
+    }
+    m_edge_count = count;
+    uint8_t edges = sensors.isr_wall_edges();
+    real_t position = forward.isr_position() + m_origin;
+    for (int i = 0; i < EDGE_KINDS; i++) {
+      if (edges & (1 << i)) {
+        m_edge_positions[i] = position;
+      }
+    }
+    m_edges_found |= edges;
+    if (not m_edge_correction || forward.isr_speed() <= 0 || rotation.isr_speed() != 0 || forward.isr_is_braking()) {
+      return;
+    }
+    if (edges & EDGE_LEFT_FALLING) {
+      correct_position(LEFT_EDGE_POS_REAL);
+    }
+    if (edges & EDGE_RIGHT_FALLING) {
+      correct_position(RIGHT_EDGE_POS_REAL);
+    }
+  }
+
+  /// @brief  move the position to the nearest place where the edge should be
+  void correct_position(real_t edge_pos) {
+    real_t error = forward.isr_position() + m_origin - edge_pos;
+    while (error >= HALF_CELL_REAL) {
+      error -= FULL_CELL_REAL;
+    }
+    while (error < -HALF_CELL_REAL) {
+      error += FULL_CELL_REAL;
+    }
+    if (real_abs(error) > MOTION_EDGE_WINDOW_REAL) {
+      return;
+    }
+    forward.isr_adjust_position(-scale(error, MOTION_EDGE_SHARE_GAIN));
+    m_edge_corrections++;
+  }
+
+  /***
+   * If nothing is queued or running, the next command starts from where
+   * the robot is now. Otherwise it starts from where the queued commands
+   * leave the robot. Called in the main loop before a profile is planned.
+   */
+  void start_queue() {
+    if (commands_finished()) {
+      m_queue_position = position();
+      m_queue_speed = velocity();
+    }
+  }
+
+  /// @brief  add a command and, for a move or a turn, its profile set-up
+  bool add_command(const MotionCommand &command, const ProfileSetup *profile = nullptr) {
+    bool added = false;
+    ATOMIC {
+      if (m_commands.size() < MOTION_QUEUE_SIZE && (!profile || m_profiles.size() < MOTION_PROFILE_QUEUE_SIZE)) {
+        m_commands.add(command);
+        if (profile) {
+          m_profiles.add(*profile);
+        }
+        added = true;
+      }
+    }
+    return added;
+  }
+
+  /***
+   * Called from systick before the profiles are updated. When the profile
+   * used by the last command has finished, the next commands are started
+   * until one of them has a profile to wait for.
+   */
+  void run_commands() {
+    if (m_waiting_for == WAIT_FORWARD && !forward.is_finished()) {
+      return;
+    }
+    if (m_waiting_for == WAIT_ROTATION && !rotation.is_finished()) {
+      return;
+    }
+    m_waiting_for = WAIT_NONE;
+    while (m_waiting_for == WAIT_NONE && m_commands.size() > 0) {
+      MotionCommand command = m_commands.head();
+      switch (command.type) {
+        case MotionCommand::CMD_MOVE:
+          m_origin += forward.isr_position();
+          forward.isr_start(m_profiles.head());
+          m_waiting_for = WAIT_FORWARD;
+          break;
+        case MotionCommand::CMD_TURN:
+          m_edge_correction = false;
+          rotation.isr_start(m_profiles.head());
+          m_waiting_for = WAIT_ROTATION;
+          break;
+        case MotionCommand::CMD_SET_SPEED:
+          forward.isr_set_target_speed(command.value);
+          break;
+        case MotionCommand::CMD_SET_POSITION:
+          m_origin = 0;
+          forward.isr_set_position(command.value);
+          break;
+        case MotionCommand::CMD_STEERING:
+          sensors.set_steering_mode(command.steering_mode);
+          break;
+        case MotionCommand::CMD_EDGE_CORRECTION:
+          m_edge_correction = command.steering_mode;
+          break;
+      }
+    }
+  }
+
+  Queue<MotionCommand, MOTION_QUEUE_SIZE> m_commands;
+  Queue<ProfileSetup, MOTION_PROFILE_QUEUE_SIZE> m_profiles;
+  volatile uint8_t m_waiting_for = WAIT_NONE;
+  volatile real_t m_origin = 0;  // where a queued move started. See position()
+  float m_queue_position = 0;     // where the queued commands leave the robot
+  float m_queue_speed = 0;        // and how fast it will be going
+  volatile bool m_edge_correction = false;
+  uint8_t m_edge_count = 0;
+  volatile uint8_t m_edges_found = 0;
+  real_t m_edge_positions[EDGE_KINDS] = {};
+  volatile int m_edge_corrections = 0;
 };
 
 extern Motion motion;
@@ -16,6 +16,8 @@
 #include "battery.h"
 #include "config.h"
 #include "encoders.h"
+#include "estimator.h"
+#include "fixed.h"
 
 /***
  * The Motors class is provided with two main control signals - the forward
@@ -34,6 +36,9 @@
  * for these controllers. greater reliability and precision would be possible if
  * the odometry had better resolution and if an IMU were available. But, you can
  * get remarkably good results with the limited resources available.
+ *
+ * With USE_FIXED_POINT set, the controllers work in fixed point. There is
+ * no floating point arithmetic in update_controllers(). See fixed.h.
  */
 
 class Motors;
@@ -66,6 +71,25 @@ class Motors {
     set_right_motor_volts(0);
   }
 
+  /***
+   * The gains start out as FWD_KP, FWD_KD, ROT_KP and ROT_KD from the
+   * robot config. The settings change them from the CLI so that the
+   * controllers can be tuned without building the code again. Returns
+   * false, and changes nothing, if a gain is out of range.
+   */
+  bool set_controller_gains(float fwd_kp, float fwd_kd, float rot_kp, float rot_kd) {
+    if (not(gain_fits(fwd_kp) && gain_fits(fwd_kd) && gain_fits(rot_kp) && gain_fits(rot_kd))) {
+      return false;
+    }
+    ATOMIC {
+      m_fwd_kp = to_gain(fwd_kp);
+      m_fwd_kd = to_gain(fwd_kd);
+      m_rot_kp = to_gain(rot_kp);
+      m_rot_kd = to_gain(rot_kd);
+    }
+    return true;
+  }
+
   void begin() {
     pinMode(MOTOR_LEFT_DIR, OUTPUT);
     pinMode(MOTOR_RIGHT_DIR, OUTPUT);
@@ -96,13 +120,20 @@ class Motors {
    *
    * NOTE: the D-term constant is premultiplied in the config by the
    * loop frequency to save a little time.
+   *
+   * With USE_ESTIMATOR set, the changes come from the Estimator rather
+   * than directly from the encoders.
    */
-  float position_controller() {
-    float increment = m_velocity * LOOP_INTERVAL;
-    m_fwd_error += increment - encoders.robot_fwd_change();
-    float diff = m_fwd_error - m_previous_fwd_error;
+  real_t position_controller() {
+    real_t increment = scale(m_velocity, LOOP_INTERVAL_GAIN);
+#if USE_ESTIMATOR
+    m_fwd_error += increment - estimator.isr_fwd_change();
+#else
+    m_fwd_error += increment - encoders.isr_fwd_change();
+#endif
+    real_t diff = m_fwd_error - m_previous_fwd_error;
     m_previous_fwd_error = m_fwd_error;
-    float output = FWD_KP * m_fwd_error + FWD_KD * diff;
+    real_t output = scale(m_fwd_error, m_fwd_kp) + scale(diff, m_fwd_kd);
     return output;
   }
 
@@ -119,13 +150,17 @@ class Motors {
    *
    * A separate controller calculates the steering adjustment term.
    */
-  float angle_controller(float steering_adjustment) {
-    float increment = m_omega * LOOP_INTERVAL;
-    m_rot_error += increment - encoders.robot_rot_change();
+  real_t angle_controller(real_t steering_adjustment) {
+    real_t increment = scale(m_omega, LOOP_INTERVAL_GAIN);
+#if USE_ESTIMATOR
+    m_rot_error += increment - estimator.isr_rot_change();
+#else
+    m_rot_error += increment - encoders.isr_rot_change();
+#endif
     m_rot_error += steering_adjustment;
-    float diff = m_rot_error - m_previous_rot_error;
+    real_t diff = m_rot_error - m_previous_rot_error;
     m_previous_rot_error = m_rot_error;
-    float output = ROT_KP * m_rot_error + ROT_KD * diff;
+    real_t output = scale(m_rot_error, m_rot_kp) + scale(diff, m_rot_kd);
     return output;
   }
 
@@ -139,38 +174,38 @@ class Motors {
    * The drive train is not symmetric and there is significant stiction.
    * If used with PID, a simpler, single value will be sufficient.
    *
+   * The acceleration is never needed on its own so the speed change is
+   * multiplied by ACC_FF and LOOP_FREQUENCY in one go.
    */
 
-  float leftFeedForward(float speed) {
-    static float oldSpeed = 0;
-    float leftFF = speed * SPEED_FF;
+  real_t leftFeedForward(real_t speed) {
+    static real_t oldSpeed = 0;
+    real_t leftFF = scale(speed, SPEED_FF_GAIN);
 	if (speed > 0) {
-		leftFF += BIAS_FF ;
+		leftFF += BIAS_FF_REAL ;
 	} else if (speed < 0){
-		leftFF -= BIAS_FF ;
+		leftFF -= BIAS_FF_REAL ;
 	} else {
 		// No bias when the speed is 0
 	}
-    float acc = (speed - oldSpeed) * LOOP_FREQUENCY;
+    real_t accFF = scale(speed - oldSpeed, ACC_FF_GAIN);
     oldSpeed = speed;
-    float accFF = ACC_FF * acc;
     leftFF += accFF;
     return leftFF;
   }
 
-  float rightFeedForward(float speed) {
-    static float oldSpeed = 0;
-    float rightFF = speed * SPEED_FF;
+  real_t rightFeedForward(real_t speed) {
+    static real_t oldSpeed = 0;
+    real_t rightFF = scale(speed, SPEED_FF_GAIN);
 	if (speed > 0) {
-		rightFF += BIAS_FF ;
+		rightFF += BIAS_FF_REAL ;
 	} else if (speed < 0){
-		rightFF -= BIAS_FF ;
+		rightFF -= BIAS_FF_REAL ;
 	} else {
 		// No bias when the speed is 0
 	}
-    float acc = (speed - oldSpeed) * LOOP_FREQUENCY;
+    real_t accFF = scale(speed - oldSpeed, ACC_FF_GAIN);
     oldSpeed = speed;
-    float accFF = ACC_FF * acc;
     rightFF += accFF;
     return rightFF;
   }
@@ -180,28 +215,32 @@ class Motors {
    * for both forward and rotation, and combine them to obtain drive
    * voltages for the left and right motors.
    */
-  void update_controllers(float velocity, float omega, float steering_adjustment) {
+  void update_controllers(real_t velocity, real_t omega, real_t steering_adjustment) {
     m_velocity = velocity;
     m_omega = omega;
-    float pos_output = position_controller();
-    float rot_output = angle_controller(steering_adjustment);
-    float left_output = 0;
-    float right_output = 0;
+    real_t pos_output = position_controller();
+    real_t rot_output = angle_controller(steering_adjustment);
+    real_t left_output = 0;
+    real_t right_output = 0;
     left_output = pos_output - rot_output;
     right_output = pos_output + rot_output;
 
-    float tangent_speed = m_omega * MOUSE_RADIUS * RADIANS_PER_DEGREE;
-    float left_speed = m_velocity - tangent_speed;
-    float right_speed = m_velocity + tangent_speed;
-    float left_ff = leftFeedForward(left_speed);
-    float right_ff = rightFeedForward(right_speed);
+    real_t tangent_speed = scale(m_omega, TANGENT_SPEED_GAIN);
+    real_t left_speed = m_velocity - tangent_speed;
+    real_t right_speed = m_velocity + tangent_speed;
+    real_t left_ff = leftFeedForward(left_speed);
+    real_t right_ff = rightFeedForward(right_speed);
     if (m_feedforward_enabled) {
       left_output += left_ff;
       right_output += right_ff;
     }
     if (m_controller_output_enabled) {
+#if USE_FIXED_POINT
+      drive_motors(left_output, right_output);
+#else
       set_right_motor_volts(right_output);
       set_left_motor_volts(left_output);
+#endif
     }
   }
 
@@ -217,26 +256,44 @@ class Motors {
    *
    * Some people add code to light up an LED whenever the drive output is
    * saturated.
+   *
+   * The battery works out the PWM counts per volt at its own, slower, rate
+   * so this is just a multiply. It goes through scale() because, in the
+   * fixed point build, the gain is a raw Q8.24 integer.
    */
-  int pwm_compensated(float desired_voltage, float battery_voltage) {
-    int pwm = MOTOR_MAX_PWM * desired_voltage / battery_voltage;
+  int pwm_compensated(float desired_voltage) {
+    int pwm = real_to_int(scale(to_real(desired_voltage), battery.pwm_per_volt()));
     return pwm;
   }
 
   void set_left_motor_volts(float volts) {
     volts = constrain(volts, -MAX_MOTOR_VOLTS, MAX_MOTOR_VOLTS);
-    m_left_motor_volts = volts;
-    int motorPWM = pwm_compensated(volts, battery.voltage());
+    m_left_motor_volts = to_real(volts);
+    int motorPWM = pwm_compensated(volts);
     set_left_motor_pwm(motorPWM);
   }
 
   void set_right_motor_volts(float volts) {
     volts = constrain(volts, -MAX_MOTOR_VOLTS, MAX_MOTOR_VOLTS);
-    m_right_motor_volts = volts;
-    int motorPWM = pwm_compensated(volts, battery.voltage());
+    m_right_motor_volts = to_real(volts);
+    int motorPWM = pwm_compensated(volts);
     set_right_motor_pwm(motorPWM);
   }
 
+#if USE_FIXED_POINT
+  /***
+   * The fixed point version of setting both motor voltages from systick.
+   */
+  void drive_motors(real_t left_volts, real_t right_volts) {
+    const real_t limit = MAX_MOTOR_VOLTS_REAL;
+    gain_t pwm_per_volt = battery.pwm_per_volt();
+    m_right_motor_volts = constrain(right_volts, -limit, limit);
+    m_left_motor_volts = constrain(left_volts, -limit, limit);
+    set_right_motor_pwm(real_to_int(scale(m_right_motor_volts, pwm_per_volt)));
+    set_left_motor_pwm(real_to_int(scale(m_left_motor_volts, pwm_per_volt)));
+  }
+#endif
+
   /***
    * PWM values are constrained to +/- 255 since the default for
    * analogueWrite is 8 bits. The sign is only used to determine
@@ -314,40 +371,53 @@ class Motors {
   }
 
   float get_left_motor_volts() {
-    float volts = 0;
+    real_t volts = 0;
     ATOMIC {
       volts = m_left_motor_volts;
     }
-    return volts;
+    return real_to_float(volts);
   }
 
   float get_right_motor_volts() {
-    float volts = 0;
+    real_t volts = 0;
     ATOMIC {
       volts = m_right_motor_volts;
     }
-    return volts;
+    return real_to_float(volts);
+  }
+
+  // the voltages applied in the last tick, for the estimator in systick
+  real_t isr_left_motor_volts() {
+    return m_left_motor_volts;
+  }
+
+  real_t isr_right_motor_volts() {
+    return m_right_motor_volts;
   }
 
   void set_speeds(float velocity, float omega) {
     ATOMIC {
-      m_velocity = velocity;
-      m_omega = omega;
+      m_velocity = to_real(velocity);
+      m_omega = to_real(omega);
     }
   }
 
  private:
   bool m_controller_output_enabled;
   bool m_feedforward_enabled = true;
-  float m_previous_fwd_error;
-  float m_previous_rot_error;
-  float m_fwd_error;
-  float m_rot_error;
-  float m_velocity;
-  float m_omega;
-  // these are maintained only for logging
-  float m_left_motor_volts;
-  float m_right_motor_volts;
+  real_t m_previous_fwd_error;
+  real_t m_previous_rot_error;
+  real_t m_fwd_error;
+  real_t m_rot_error;
+  real_t m_velocity;
+  real_t m_omega;
+  // these are maintained for logging and the estimator
+  real_t m_left_motor_volts;
+  real_t m_right_motor_volts;
+  gain_t m_fwd_kp = to_gain(FWD_KP);
+  gain_t m_fwd_kd = to_gain(FWD_KD);
+  gain_t m_rot_kp = to_gain(ROT_KP);
+  gain_t m_rot_kd = to_gain(ROT_KD);
 };
 
 #endif
@@ -15,9 +15,13 @@
 #include "config.h"
 #include "maze.h"
 #include "motion.h"
+#include "receiver.h"
 #include "reporting.h"
 #include "sensors.h"
+#include "settings.h"
+#include "storage.h"
 #include "switches.h"
+#include "telemetry.h"
 
 /***
  * The Mouse class is really a subclass of a more generic robot. It should
@@ -31,6 +35,24 @@
  * different events, consider creating a Robot class for all the basic
  * functionality and then extending it for the individual contest events.
  */
+/***
+ * Speed runs can cut across staircases on the diagonal. Set this to zero
+ * to use only the orthogonal SS90 turns.
+ */
+#ifndef MOUSE_USE_DIAGONALS
+#define MOUSE_USE_DIAGONALS 1
+#endif
+
+/***
+ * With MOUSE_SEARCH_UNTIL_SOLVED set, the search does not stop at the
+ * goal. It carries on to the unvisited cells that could be on a shorter
+ * route until the best route is proven. Set it to zero to search only
+ * to the goal and back.
+ */
+#ifndef MOUSE_SEARCH_UNTIL_SOLVED
+#define MOUSE_SEARCH_UNTIL_SOLVED 1
+#endif
+
 class Mouse;
 extern Mouse mouse;
 
@@ -38,13 +60,49 @@ class Mouse {
  public:
   enum State { FRESH_START, SEARCHING, INPLACE_RUN, SMOOTH_RUN, FINISHED };
 
+  /***
+   * The turn names follow the usual convention. SD45 goes from a straight
+   * into a diagonal, DS135 from a diagonal to a straight and so on. Left
+   * turns are always even and the matching right turn is the next value.
+   * Each one has an entry in the turn_params table of the robot config.
+   */
   enum TurnType {
     SS90EL = 0,
     SS90ER = 1,
     SS90L = 2,
     SS90R = 3,
+    SD45L = 4,
+    SD45R = 5,
+    SD135L = 6,
+    SD135R = 7,
+    DS45L = 8,
+    DS45R = 9,
+    DS135L = 10,
+    DS135R = 11,
+    DD90L = 12,
+    DD90R = 13,
+  };
+
+  /***
+   * A path for a speed run is compressed into a list of single byte commands.
+   *
+   * Values from 1 to PATH_MAX_STRAIGHT are straights of that many cells.
+   * With the PATH_DIAGONAL bit set, they are diagonals of that many steps.
+   * A diagonal step is the distance between the centres of two cell edges.
+   * Turns have the PATH_TURN bit set and the TurnType in the low bits.
+   * Every path ends with PATH_STOP to come to a halt in the target cell.
+   */
+  enum PathCommand : uint8_t {
+    PATH_STOP = 0x00,
+    PATH_MAX_STRAIGHT = 0x3F,
+    PATH_DIAGONAL = 0x40,
+    PATH_TURN = 0x80,
   };
 
+  // Enough for a path with a turn in every other cell of a classic maze
+  enum { PATH_QUEUE_SIZE = 4 * (MAZE_WIDTH + MAZE_HEIGHT) };
+  typedef Queue<uint8_t, PATH_QUEUE_SIZE> PathQueue;
+
   Mouse() {
     init();
   }
@@ -148,7 +206,7 @@ class Mouse {
    */
   void turn_smooth(int turn_id) {
     sensors.set_steering_mode(STEERING_OFF);
-    motion.set_target_velocity(SEARCH_TURN_SPEED);
+    motion.set_target_velocity(settings.search_turn_speed);
     TurnParameters params = turn_params[turn_id];
 
     float trigger = params.trigger;
@@ -171,23 +229,40 @@ class Mouse {
     char note = triggered_by_sensor ? 's' : 'd';
     char dir = (turn_id & 1) ? 'R' : 'L';
     reporter.log_action_status(dir, note, m_location, m_heading);  // the sensors triggered the turn
-    // finally we get to actually turn
-    motion.turn(params.angle, params.omega, 0, params.alpha);
+    // finally we get to actually turn. The position is not measured from a
+    // cell boundary again until the turn is over
+    bool edge_correction = motion.edge_correction_enabled();
+    motion.disable_edge_correction();
+    recorder.trigger(REC_TRIGGER_TURN);
+    motion.turn_shaped(params);
     // robot should be at output offset - run to the sensing position
     int end_point = HALF_CELL + params.exit_offset;
-    motion.move(SENSING_POSITION - end_point, motion.velocity(), SEARCH_SPEED, SEARCH_ACCELERATION);
+    motion.move(SENSING_POSITION - end_point, motion.velocity(), settings.search_speed, settings.search_acceleration);
     motion.set_position(SENSING_POSITION);
+    if (edge_correction) {
+      motion.enable_edge_correction();
+    }
   }
 
   //***************************************************************************//
   /***
    * bring the mouse to a halt in the center of the current cell. That is,
    * the cell it is entering.
+   *
+   * With a wall ahead, the linearised front sum says how far away the center
+   * is. The front sum is FRONT_REFERENCE in the center so the distance for
+   * that is where the mouse should stop. A distant wall gives a small, noisy
+   * front sum so the mouse slows down for whichever of that and the odometry
+   * puts the center closer. The front sum still says when to stop.
    */
   void stop_at_center() {
     bool has_wall = sensors.see_front_wall;
     sensors.set_steering_mode(STEERING_OFF);
     float remaining = (FULL_CELL + HALF_CELL) - motion.position();
+    if (has_wall) {
+      int wall_distance = sensors.get_front_distance() - linear_distance(FRONT_REFERENCE, FRONT_LINEAR_CONSTANT);
+      remaining = min(remaining, float(wall_distance));
+    }
     // finish at very low speed so we can adjust from the wall ahead if present
     motion.start_move(remaining, motion.velocity(), 30, motion.acceleration());
     if (has_wall) {
@@ -242,10 +317,16 @@ class Mouse {
   void turn_back() {
     reporter.log_action_status('B', ' ', m_location, m_heading);
     stop_at_center();
+    // the front wall may have stopped the robot away from the place it was going
+    bool edge_correction = motion.edge_correction_enabled();
+    motion.disable_edge_correction();
     turn_IP180();
     float distance = SENSING_POSITION - HALF_CELL;
-    motion.move(distance, SEARCH_SPEED, SEARCH_SPEED, SEARCH_ACCELERATION);
+    motion.move(distance, settings.search_speed, settings.search_speed, settings.search_acceleration);
     motion.set_position(SENSING_POSITION);
+    if (edge_correction) {
+      motion.enable_edge_correction();
+    }
     m_heading = behind_from(m_heading);
   }
 
@@ -260,18 +341,20 @@ class Mouse {
     m_handStart = true;
     m_location = START;
     m_heading = NORTH;
+    storage.stop();
     maze.initialise();
     sensors.wait_for_user_start();
     sensors.enable();
     motion.reset_drive_system();
     sensors.set_steering_mode(STEERING_OFF);
-    motion.move(BACK_WALL_TO_CENTER, SEARCH_SPEED, SEARCH_SPEED, SEARCH_ACCELERATION);
+    motion.move(BACK_WALL_TO_CENTER, settings.search_speed, settings.search_speed, settings.search_acceleration);
     motion.set_position(HALF_CELL);
+    motion.enable_edge_correction();
     Serial.println(F("Off we go..."));
     motion.wait_until_position(SENSING_POSITION);
     // at the start of this loop we are always at the sensing point
-    while (m_location != target) {
-      if (switches.button_pressed()) {
+    while (not maze.in_target(m_location, target)) {
+      if (user_abort()) {
         break;
       }
       Serial.println();
@@ -283,7 +366,7 @@ class Mouse {
       Serial.write('|');
       Serial.write(' ');
       char action = '#';
-      if (m_location != target) {
+      if (not maze.in_target(m_location, target)) {
         if (!sensors.see_left_wall) {
           turn_left();
           action = 'L';
@@ -338,13 +421,18 @@ class Mouse {
    * the map since mapping is always done by looking ahead into the
    * cell that is about to be entered.
    *
+   * With until_solved set, the mouse does not stop at the target. It
+   * carries on to each cell that find_search_target() gives it and then
+   * back to the start, where it stops. Not stopping in between saves time
+   * and keeps the robot lined up by the walls as it goes.
+   *
    * On exit, the mouse will be centered in the target cell still
    * facing in the direction it entered that cell. This will
    * always be one of the four cardinal directions NESW
    *
    */
 
-  void search_to(Location target) {
+  void search_to(Location target, bool until_solved = false) {
     maze.flood(target);
     delay(200);
     sensors.enable();
@@ -354,10 +442,11 @@ class Mouse {
       // back up to the wall behind
       // TODO: what if there is not a wall?
       // perhaps the caller should decide so this ALWAYS starts at the cell centre?
-      motion.move(-BACK_WALL_TO_CENTER, SEARCH_SPEED / 4, 0, SEARCH_ACCELERATION / 2);
+      motion.move(-BACK_WALL_TO_CENTER, settings.search_speed / 4, 0, settings.search_acceleration / 2);
     }
-    motion.move(BACK_WALL_TO_CENTER, SEARCH_SPEED, SEARCH_SPEED, SEARCH_ACCELERATION);
+    motion.move(BACK_WALL_TO_CENTER, settings.search_speed, settings.search_speed, settings.search_acceleration);
     motion.set_position(HALF_CELL);
+    motion.enable_edge_correction();
     Serial.print(F("Off we go..."));
     printer.print('[');
     printer.print(target.x);
@@ -365,22 +454,41 @@ class Mouse {
     printer.print(target.y);
     printer.print(']');
     Serial.println();
+    telemetry.start();
 
     motion.wait_until_position(SENSING_POSITION);
     // Each iteration of this loop starts at the sensing point
-    while (m_location != target) {
-      if (switches.button_pressed()) {  // allow user to abort gracefully
+    while (not maze.in_target(m_location, target)) {
+      if (user_abort()) {  // allow user to abort gracefully
         break;
       }
-      Serial.println();
+      if (not telemetry.streaming()) {
+        Serial.println();
+      }
       reporter.log_action_status('-', ' ', m_location, m_heading);
       sensors.set_steering_mode(STEER_NORMAL);
       m_location = m_location.neighbour(m_heading);  // the cell we are about to enter
+      // the maze repairs its costs as new walls are added so there is no
+      // need to flood the whole maze again here. That leaves only the four
+      // neighbour costs in heading_to_smallest() so the decision is not
+      // worth making ahead of the sensing point. See documents/maze.md
       update_map();
-      maze.flood(target);
+      if (until_solved && maze.in_target(m_location, target)) {
+        if (not find_search_target(target)) {
+          target = START;
+          until_solved = false;
+        }
+        maze.flood(target);
+      }
       unsigned char newHeading = maze.heading_to_smallest(m_location, m_heading);
+      bool arriving = maze.in_target(m_location, target);
+      if (newHeading == BLOCKED && not arriving) {
+        telemetry.stop();  // systick may be writing to Serial
+        Serial.println(F("No route"));
+        break;  // the walls seen so far cut off the target
+      }
       unsigned char hdgChange = (newHeading - m_heading) & 0x3;
-      if (m_location != target) {
+      if (not arriving) {
         switch (hdgChange) {
           // each of the following actions will finish with the
           // robot moving and at the sensing point ready for the
@@ -403,9 +511,12 @@ class Mouse {
     // we are entering the target cell so come to an orderly
     // halt in the middle of that cell
     stop_at_center();
+    telemetry.stop();
     sensors.disable();
     Serial.println();
     Serial.println(F("Arrived!  "));
+    Serial.print(F("Edge corrections: "));
+    Serial.println(motion.edge_corrections());
     delay(250);
     motion.reset_drive_system();
     sensors.set_steering_mode(STEERING_OFF);
@@ -434,7 +545,431 @@ class Mouse {
    * always be one of the four cardinal directions NESW
    */
   void run_to(Location target) {
-    (void)target;
+    MazeMask search_mask = maze.get_mask();
+    maze.set_mask(MASK_CLOSED);
+    flood_for_run(target);
+    Heading best_direction = route_direction(m_location, m_heading);
+    PathQueue path;
+    bool have_path = false;
+    Location end = target;
+    Heading end_heading = m_heading;
+    if (best_direction != BLOCKED) {
+      turn_to_face(best_direction);
+      have_path = plan_path(target, path, MOUSE_USE_DIAGONALS, end, end_heading);
+    }
+    maze.set_mask(search_mask);
+    if (not have_path) {
+      Serial.println(F("No route"));
+      return;
+    }
+    m_path_time = estimate_path_time(path, m_path_length);
+
+    delay(200);
+    sensors.enable();
+    motion.reset_drive_system();
+    sensors.set_steering_mode(STEERING_OFF);  // never steer from zero speed
+    if (not m_handStart) {
+      // back up to the wall behind
+      motion.move(-BACK_WALL_TO_CENTER, settings.search_speed / 4, 0, settings.search_acceleration / 2);
+    }
+    motion.move(BACK_WALL_TO_CENTER, settings.search_speed, settings.search_speed, settings.search_acceleration);
+    // positions in the path are measured from the edge of the next cell
+    motion.set_position(HALF_CELL - FULL_CELL);
+    telemetry.start();
+    bool arrived = run_path(path);
+    stop_at_center();
+    telemetry.stop();
+    sensors.disable();
+    Serial.println();
+    if (arrived) {
+      m_location = end;
+      m_heading = end_heading;
+      Serial.println(F("Arrived!  "));
+    } else {
+      // with diagonals there is no telling where the run was stopped
+      Serial.println(F("Aborted"));
+    }
+    Serial.print(F("Edge corrections: "));
+    Serial.println(motion.edge_corrections());
+    delay(250);
+    motion.reset_drive_system();
+    sensors.set_steering_mode(STEERING_OFF);
+  }
+
+  /***
+   * A speed run prefers routes with fewer turns when the weighted
+   * flood is available. Use route_direction() to follow the result.
+   */
+  void flood_for_run(Location target) {
+#if MAZE_WEIGHTED_FLOOD
+    maze.weighted_flood(target, flood_costs.straight, flood_costs.turn, flood_costs.reverse);
+#else
+    maze.flood(target);
+#endif
+  }
+
+  /// @brief the heading to leave a cell by after flood_for_run()
+  Heading route_direction(Location cell, Heading heading) {
+#if MAZE_WEIGHTED_FLOOD
+    (void)heading;
+    return maze.flood_direction(cell);
+#else
+    return maze.heading_to_smallest(cell, heading);
+#endif
+  }
+
+  /***
+   * Walk the cost map from the current location and heading to the target
+   * and record the route as a list of commands. Runs of cells where the
+   * robot goes straight ahead are combined into a single command.
+   *
+   * With diagonals enabled, any staircase, where turns alternate left and
+   * right in consecutive cells, becomes a diagonal entered and left with
+   * 45 or 135 degree turns. Where two turns in the same direction come
+   * together in the middle of a diagonal, a DD90 turn joins the two parts.
+   *
+   * The route is followed a cell at a time with only a few cells of look
+   * ahead so there is no need to store the full route anywhere.
+   *
+   * The mouse must already be facing the first cell of the route and the
+   * maze must have been flooded for the target. The route ends in the
+   * first target cell it gets to. For the goal, that can be any cell in
+   * the goal area so the cell and the heading it is entered with are
+   * passed back in end and end_heading.
+   *
+   * Returns false if there is no route or it will not fit in the queue.
+   */
+  bool plan_path(Location target, PathQueue &path, bool use_diagonals, Location &end, Heading &end_heading) {
+    path.clear();
+    Location here = m_location.neighbour(m_heading);
+    Heading heading = m_heading;
+    char turns[4];
+    for (int i = 0; i < 4; i++) {
+      turns[i] = next_route_turn(here, heading, target);
+    }
+    bool diagonal = false;
+    uint8_t steps = 0;
+    while (turns[0] != 'S') {
+      char turn = turns[0];
+      int used = 1;
+      if (turn == 'X') {
+        return false;
+      }
+      char other = (turn == 'L') ? 'R' : 'L';
+      bool ends_straight = (turns[1] == 'F' || turns[1] == 'S');
+      if (not diagonal) {
+        if (turn == 'F') {
+          steps++;
+          if (steps == PATH_MAX_STRAIGHT) {
+            if (not add_command(path, steps)) {
+              return false;
+            }
+            steps = 0;
+          }
+        } else if (use_diagonals && turns[1] == other) {
+          diagonal = true;
+          if (not add_turn(path, steps, PATH_STOP, turn == 'L' ? SD45L : SD45R)) {
+            return false;
+          }
+        } else if (use_diagonals && turns[1] == turn && turns[2] == other) {
+          diagonal = true;
+          used = 2;
+          if (not add_turn(path, steps, PATH_STOP, turn == 'L' ? SD135L : SD135R)) {
+            return false;
+          }
+        } else {
+          if (not add_turn(path, steps, PATH_STOP, turn == 'L' ? SS90L : SS90R)) {
+            return false;
+          }
+        }
+      } else {
+        // every cell on a diagonal has a turn in the opposite direction
+        // to the one before it. Anything else ends or bends the diagonal
+        if (turns[1] == other) {
+          steps++;
+          if (steps == PATH_MAX_STRAIGHT) {
+            if (not add_command(path, PATH_DIAGONAL | steps)) {
+              return false;
+            }
+            steps = 0;
+          }
+        } else if (ends_straight) {
+          diagonal = false;
+          if (not add_turn(path, steps, PATH_DIAGONAL, turn == 'L' ? DS45L : DS45R)) {
+            return false;
+          }
+        } else if (turns[1] == turn && turns[2] == other) {
+          used = 2;
+          if (not add_turn(path, steps, PATH_DIAGONAL, turn == 'L' ? DD90L : DD90R)) {
+            return false;
+          }
+        } else if (turns[1] == turn && (turns[2] == 'F' || turns[2] == 'S')) {
+          diagonal = false;
+          used = 2;
+          if (not add_turn(path, steps, PATH_DIAGONAL, turn == 'L' ? DS135L : DS135R)) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+      }
+      for (int i = 0; i < 4; i++) {
+        turns[i] = (i + used < 4) ? turns[i + used] : next_route_turn(here, heading, target);
+      }
+    }
+    if (steps > 0 && not add_command(path, steps)) {
+      return false;
+    }
+    path.add(PATH_STOP);
+    end = here;
+    end_heading = heading;
+    return true;
+  }
+
+  /***
+   * Follow the flooded route by one cell for plan_path(). The result is the
+   * turn made in the cell as 'F', 'L' or 'R', 'S' once the target has been
+   * reached or 'X' if the route is blocked.
+   */
+  char next_route_turn(Location &here, Heading &heading, Location target) {
+    if (maze.in_target(here, target)) {
+      return 'S';
+    }
+    Heading next_heading = route_direction(here, heading);
+    if (next_heading == BLOCKED) {
+      return 'X';
+    }
+    unsigned char hdgChange = (next_heading - heading) & 0x3;
+    heading = next_heading;
+    here = here.neighbour(heading);
+    switch (hdgChange) {
+      case AHEAD:
+        return 'F';
+      case LEFT:
+        return 'L';
+      case RIGHT:
+        return 'R';
+      default:
+        // a route on a flooded maze never needs to turn around
+        return 'X';
+    }
+  }
+
+  /// @brief add a path command leaving room for the final PATH_STOP
+  bool add_command(PathQueue &path, uint8_t command) {
+    if (path.size() >= PATH_QUEUE_SIZE - 1) {
+      return false;
+    }
+    path.add(command);
+    return true;
+  }
+
+  /// @brief add any pending straight or diagonal followed by a turn
+  bool add_turn(PathQueue &path, uint8_t &steps, uint8_t kind, uint8_t turn_id) {
+    if (steps > 0 && not add_command(path, kind | steps)) {
+      return false;
+    }
+    steps = 0;
+    return add_command(path, PATH_TURN | turn_id);
+  }
+
+  /***
+   * Every turn has a pivot where the straight lines into and out of it
+   * would meet. These are the distances from the pivot to the points
+   * where the path commands start and finish. That is the edge of a cell
+   * on a straight and the centre of a cell edge on a diagonal.
+   */
+  static float turn_entry_distance(uint8_t turn_id) {
+    switch (turn_id & ~1) {
+      case SD45L:
+        return 0;
+      case SD135L:
+        return FULL_CELL;
+      case DS45L:
+      case DD90L:
+        return DIAGONAL_STEP;
+      case DS135L:
+        return 2 * DIAGONAL_STEP;
+      default:
+        return HALF_CELL;
+    }
+  }
+
+  static float turn_exit_distance(uint8_t turn_id) {
+    switch (turn_id & ~1) {
+      case DS45L:
+        return 0;
+      case DS135L:
+        return FULL_CELL;
+      case SD45L:
+      case DD90L:
+        return DIAGONAL_STEP;
+      case SD135L:
+        return 2 * DIAGONAL_STEP;
+      default:
+        return HALF_CELL;
+    }
+  }
+
+  /// @brief the change of heading for a turn in units of 45 degrees
+  static int turn_octants(uint8_t turn_id) {
+    int octants;
+    switch (turn_id & ~1) {
+      case SD45L:
+      case DS45L:
+        octants = 1;
+        break;
+      case SD135L:
+      case DS135L:
+        octants = 3;
+        break;
+      default:
+        octants = 2;
+        break;
+    }
+    return (turn_id & 1) ? octants : -octants;
+  }
+
+  /***
+   * Execute a path made by plan_path(). The robot must be moving with the
+   * position measured from the edge of the first cell in the path.
+   *
+   * Straights and diagonals are added up until the next turn and then run
+   * as a single move that finishes at the start of the turn. Only the
+   * straights can use the wall sensors for steering. The moves are S-curves
+   * with the acceleration limited by FAST_RUN_JERK.
+   *
+   * The path ends at the sensing position of the cell before the target so
+   * that stop_at_center() can finish the job. The mouse heading is updated.
+   *
+   * The segments are sent to the motion command queue so that each one
+   * starts the moment the one before it ends. Planning only waits if the
+   * queue is full. Each turn needs five commands, two of them with a
+   * profile set-up.
+   *
+   * The wall edges correct the position on the straights, just as they do
+   * in the search. The turn command turns the correction off and it comes
+   * back on once the turn has finished if the robot is on a straight.
+   *
+   * Returns false if the user aborted the run.
+   */
+  bool run_path(PathQueue &path) {
+    float distance = 0;  // from the last turn to the next reference point
+    int octant = m_heading * 2;
+    sensors.set_steering_mode(STEER_NORMAL);
+    motion.enable_edge_correction();
+    while (path.size() > 0) {
+      uint8_t command = path.head();
+      if (command == PATH_STOP) {
+        break;
+      }
+      if (command & PATH_TURN) {
+        uint8_t turn_id = command & ~PATH_TURN;
+        const TurnParameters &params = turn_params[turn_id];
+        float turn_start = distance + turn_entry_distance(turn_id) - params.entry_offset;
+        distance = 0;
+        octant = (octant + 8 + turn_octants(turn_id)) % 8;
+        bool straight = (octant & 1) == 0;
+        if (!wait_for_motion_queue(5, 2)) {
+          return false;
+        }
+        motion.queue_move_to(turn_start, FAST_RUN_SPEED_MAX, params.speed, FAST_RUN_ACCELERATION, FAST_RUN_JERK);
+        motion.queue_turn(params);
+        motion.queue_set_position(params.exit_offset - turn_exit_distance(turn_id));
+        motion.queue_steering(straight ? STEER_NORMAL : STEERING_OFF);
+        motion.queue_edge_correction(straight);
+      } else if (command & PATH_DIAGONAL) {
+        distance += (command & PATH_MAX_STRAIGHT) * DIAGONAL_STEP;
+      } else {
+        distance += command * FULL_CELL;
+      }
+    }
+    if (!wait_for_motion_queue(1, 1)) {
+      return false;
+    }
+    // if a turn has carried the robot past the sensing position, this just sets the speed
+    motion.queue_move_to(distance - FULL_CELL + SENSING_POSITION, FAST_RUN_SPEED_MAX, settings.search_speed, FAST_RUN_ACCELERATION, FAST_RUN_JERK);
+    while (!motion.commands_finished()) {
+      if (user_abort()) {  // allow user to abort gracefully
+        motion.clear_commands();
+        return false;
+      }
+      delay(2);
+    }
+    motion.set_position(motion.position() - distance + FULL_CELL);
+    m_heading = static_cast<Heading>(octant / 2);
+    return true;
+  }
+
+  /***
+   * How long run_path() should take to follow a path and how far the robot
+   * goes, from the fast run speeds and the turn_params table. It is timed
+   * from the start of the first cell to the final sensing position and the
+   * robot is assumed to manage every speed it is asked for. This is only an
+   * estimate for comparing one planner with another. Each command is put
+   * back on the end of the queue once it has been read so the path is left
+   * as it was.
+   *
+   * @param length  set to the distance along the path in mm
+   * @return the estimated time in seconds
+   */
+  float estimate_path_time(PathQueue &path, float &length) {
+    float time = 0;
+    float position = HALF_CELL - FULL_CELL;  // as set by run_to()
+    float speed = settings.search_speed;
+    float distance = 0;
+    bool stopped = false;
+    length = 0;
+    for (int count = path.size(); count > 0; count--) {
+      uint8_t command = path.head();
+      path.add(command);
+      if (stopped || command == PATH_STOP) {
+        stopped = true;
+      } else if (command & PATH_TURN) {
+        uint8_t turn_id = command & ~PATH_TURN;
+        const TurnParameters &params = turn_params[turn_id];
+        float straight = max(distance + turn_entry_distance(turn_id) - params.entry_offset - position, 0.0f);
+        float turn_time = Profile::shaped_time(params.angle, params.omega, params.alpha);
+        time += Profile::trapezoid_time(straight, speed, FAST_RUN_SPEED_MAX, params.speed, FAST_RUN_ACCELERATION);
+        time += turn_time;
+        length += straight + params.speed * turn_time;
+        speed = params.speed;
+        position = params.exit_offset - turn_exit_distance(turn_id);
+        distance = 0;
+      } else if (command & PATH_DIAGONAL) {
+        distance += (command & PATH_MAX_STRAIGHT) * DIAGONAL_STEP;
+      } else {
+        distance += command * FULL_CELL;
+      }
+    }
+    float straight = max(distance - FULL_CELL + SENSING_POSITION - position, 0.0f);
+    time += Profile::trapezoid_time(straight, speed, FAST_RUN_SPEED_MAX, settings.search_speed, FAST_RUN_ACCELERATION);
+    length += straight;
+    return time;
+  }
+
+  /// @brief the estimated time for the last speed run path. See estimate_path_time()
+  float path_time() const {
+    return m_path_time;
+  }
+
+  /// @brief the length in mm of the last speed run path
+  float path_length() const {
+    return m_path_length;
+  }
+
+  /// @brief  wait for room in the motion command queue for some commands
+  ///         and the profile set-ups for the moves and turns among them
+  /// @return false if the user aborted the run
+  bool wait_for_motion_queue(int commands, int profiles) {
+    while (motion.command_space() < commands || motion.profile_space() < profiles) {
+      if (user_abort()) {  // allow user to abort gracefully
+        motion.clear_commands();
+        return false;
+      }
+      delay(2);
+    }
+    return true;
   }
 
   void turn_to_face(Heading newHeading) {
@@ -469,7 +1004,9 @@ class Mouse {
     if (rightWall) {
       w[2] = 'R';
     };
-    Serial.print(w);
+    if (not telemetry.streaming()) {
+      Serial.print(w);
+    }
     switch (m_heading) {
       case NORTH:
         maze.update_wall_state(m_location, NORTH, frontWall ? WALL : EXIT);
@@ -498,43 +1035,156 @@ class Mouse {
   }
 
   /***
-   * The mouse is expected to be in the start cell heading NORTH
-   * The maze may, or may not, have been searched.
-   * There may, or may not, be a solution.
+   * The route for a speed run only uses cells that have been visited.
+   * It is the best route there is once the open flood, which treats every
+   * unseen wall as an exit, is no shorter than the closed flood, which
+   * treats every unseen wall as a wall. Then no unvisited cell can be on
+   * a shorter route and there is nothing more to search for.
    *
-   * This simple searcher will just search to goal, turn around and
-   * search back to the start. At that point there will be a route
-   * but it is unlikely to be optimal.
+   * Otherwise, the best route in the open maze passes through at least
+   * one unvisited cell. The search target is the one of those that is
+   * nearest to the mouse. Unvisited cells in the goal area count as well.
+   * They are close by once the mouse has got to the goal and they show
+   * where the way into the goal is. The corner cell, goal(), is left out
+   * because a search to goal() stops anywhere in the goal area.
    *
-   * the mouse can run this route by creating a path that does not
-   * pass through unvisited cells.
+   * The costs are simple cell counts, so the route is proven to be the
+   * shortest rather than the one with the fewest turns.
    *
-   * A better searcher will continue until a path generated through all
-   * cells, regardless of visited state, does not pass through any
-   * unvisited cells.
+   * Returns false if the maze is solved and true with the target set if
+   * there is more to search.
+   */
+  bool find_search_target(Location &target) {
+    MazeMask search_mask = maze.get_mask();
+    maze.set_mask(MASK_CLOSED);
+    maze.flood(maze.goal());
+    uint16_t closed_cost = maze.cost(START);
+    maze.set_mask(MASK_OPEN);
+    maze.flood(maze.goal());
+    uint16_t open_cost = maze.cost(START);
+    bool more_to_search = false;
+    if (open_cost < closed_cost) {
+      // mark the unvisited cells along the best open route from the start.
+      // The route stops as soon as it enters the goal area so the cells
+      // in there do not need to be visited
+      uint8_t on_route[MAZE_CELL_COUNT / 8 + 1] = {0};
+      Location cell = START;
+      Heading heading = NORTH;
+      while (not maze.is_goal(cell)) {
+        heading = maze.heading_to_smallest(cell, heading);
+        if (heading == BLOCKED) {
+          break;
+        }
+        cell = cell.neighbour(heading);
+        if (not maze.cell_is_visited(cell) && not maze.is_goal(cell)) {
+          int index = cell.x * MAZE_HEIGHT + cell.y;
+          on_route[index / 8] |= 1 << (index % 8);
+        }
+      }
+      // then pick the nearest of them
+      maze.flood(m_location);
+      uint16_t best_cost = MAX_COST;
+      for (int x = 0; x < MAZE_WIDTH; x++) {
+        for (int y = 0; y < MAZE_HEIGHT; y++) {
+          int index = x * MAZE_HEIGHT + y;
+          Location here(x, y);
+          bool wanted = on_route[index / 8] & (1 << (index % 8));
+          if (maze.is_goal(here) && here != maze.goal() && not maze.cell_is_visited(here)) {
+            wanted = true;
+          }
+          if (wanted && maze.cost(here) < best_cost) {
+            best_cost = maze.cost(here);
+            target = here;
+            more_to_search = true;
+          }
+        }
+      }
+    }
+    maze.set_mask(search_mask);
+    return more_to_search;
+  }
+
+  /// @brief  turn round in the current cell to face the way to the target
+  void turn_to_search(Location target) {
+    maze.flood(target);
+    Heading best_direction = maze.heading_to_smallest(m_location, m_heading);
+    if (best_direction != BLOCKED) {
+      turn_to_face(best_direction);
+    }
+  }
+
+  /***
+   * The mouse is expected to be in the start cell heading NORTH
+   * The maze may, or may not, have been searched.
+   * There may, or may not, be a solution.
    *
-   * The return value is not currently used but could indicate whether
-   * the maze is 'solved'. That is, whether there is any need to search
-   * further.
+   * The mouse searches to the goal first. Then, with
+   * MOUSE_SEARCH_UNTIL_SOLVED, it keeps going to the cells that might
+   * be on a shorter route until there are none left. See
+   * find_search_target(). Finally it searches back to the start.
    *
+   * Returns true if the maze is solved. That is, the route that a speed
+   * run will take is the shortest there is and there is no need to search
+   * any further.
    */
-  int search_maze() {
+  bool search_maze() {
     sensors.wait_for_user_start();
     Serial.println(F("Search TO"));
+#if MAZE_QUEUE_STATS
+    maze.reset_queue_stats();
+#endif
     m_handStart = true;
     m_location = START;
     m_heading = NORTH;
-    search_to(maze.goal());
-    maze.flood(START);
-
-    Heading best_direction = maze.heading_to_smallest(m_location, m_heading);
-    turn_to_face(best_direction);
+    search_to(maze.goal(), MOUSE_SEARCH_UNTIL_SOLVED);
     m_handStart = false;
-    search_to(START);
+    // an abort from the CLI stops the whole search, not just this part
+    if (m_location != START && not receiver.abort_requested()) {
+      turn_to_search(START);
+      search_to(START);
+    }
     turn_to_face(NORTH);
     motion.stop();
     motion.disable_drive();
-    return 0;
+    Location unsearched;
+    bool solved = m_location == START && not find_search_target(unsearched);
+    Serial.println(solved ? F("Solved") : F("Not solved"));
+#if MAZE_QUEUE_STATS
+    reporter.print_queue_stats();
+#endif
+    return solved;
+  }
+
+  /***
+   * The mouse is expected to be in the start cell heading NORTH and the
+   * maze should have been searched.
+   *
+   * A single speed run is made to the goal using only cells that have been
+   * visited. The mouse stays there.
+   */
+  void run_maze() {
+    sensors.wait_for_user_start();
+    Serial.println(F("Run TO"));
+#if MAZE_QUEUE_STATS
+    maze.reset_queue_stats();
+#endif
+    m_handStart = true;
+    m_location = START;
+    m_heading = NORTH;
+    run_to(maze.goal());
+    motion.stop();
+    motion.disable_drive();
+#if MAZE_QUEUE_STATS
+    reporter.print_queue_stats();
+#endif
+  }
+
+  /***
+   * The runs stop at the next cell if the button is pressed or if an abort
+   * key arrives on the serial port. See receiver.h.
+   */
+  bool user_abort() {
+    return switches.button_pressed() || receiver.abort_requested();
   }
 
   //***************************************************************************//
@@ -641,62 +1291,25 @@ class Mouse {
    * Note that UKMARSBOT, with its back to a wall, has its wheels 43mm from
    * the cell boundary.
    *
-   * This value can be used to permit forward error correction of the robot
-   * position while exploring.
+   * The edges are found by the same code in Sensors::update() that Motion
+   * uses to correct the forward position during the search. Put the results
+   * in LEFT_EDGE_POS and RIGHT_EDGE_POS in the robot config.
    *
    * @brief find sensor wall edge detection positions
    */
 
   void conf_edge_detection() {
-    bool left_edge_found = false;
-    bool right_edge_found = false;
-    int left_edge_position = 0;
-    int right_edge_position = 0;
-    int left_max = 0;
-    int right_max = 0;
     sensors.wait_for_user_start();  // cover front sensor with hand to start
     sensors.enable();
     delay(100);
     motion.reset_drive_system();
     sensors.set_steering_mode(STEERING_OFF);
     Serial.println(F("Edge positions:"));
-    motion.start_move(FULL_CELL - 30.0, 100, 0, 1000);
-    while (not motion.move_finished()) {
-      if (sensors.lss.value > left_max) {
-        left_max = sensors.lss.value;
-      }
-
-      if (sensors.rss.value > right_max) {
-        right_max = sensors.rss.value;
-      }
-
-      if (not left_edge_found) {
-        if (sensors.lss.value < left_max / 2) {
-          left_edge_position = int(0.5 + motion.position());
-          left_edge_found = true;
-        }
-      }
-      if (not right_edge_found) {
-        if (sensors.rss.value < right_max / 2) {
-          right_edge_position = int(0.5 + motion.position());
-          right_edge_found = true;
-        }
-      }
-      delay(5);
-    }
+    motion.move(FULL_CELL - 30.0, 100, 0, 1000);
     Serial.print(F("Left: "));
-    if (left_edge_found) {
-      Serial.print(BACK_WALL_TO_CENTER + left_edge_position);
-    } else {
-      Serial.print('-');
-    }
-
+    print_edge_position(EDGE_LEFT_FALLING);
     Serial.print(F("  Right: "));
-    if (right_edge_found) {
-      Serial.print(BACK_WALL_TO_CENTER + right_edge_position);
-    } else {
-      Serial.print('-');
-    }
+    print_edge_position(EDGE_RIGHT_FALLING);
     Serial.println();
     motion.reset_drive_system();
     sensors.set_steering_mode(STEERING_OFF);
@@ -704,6 +1317,14 @@ class Mouse {
     delay(100);
   }
 
+  void print_edge_position(uint8_t edge) {
+    if (motion.edges_found() & edge) {
+      Serial.print(BACK_WALL_TO_CENTER + int(0.5 + motion.edge_position(edge)));
+    } else {
+      Serial.print('-');
+    }
+  }
+
   /***
    * A basic function to let you test the configuration of the SS90Ex turns.
    *
@@ -725,7 +1346,7 @@ class Mouse {
     sensors.set_steering_mode(STEERING_OFF);
     // move to the boundary with the next cell
     float distance = BACK_WALL_TO_CENTER + HALF_CELL;
-    motion.move(distance, SEARCH_TURN_SPEED, SEARCH_TURN_SPEED, SEARCH_ACCELERATION);
+    motion.move(distance, settings.search_turn_speed, settings.search_turn_speed, settings.search_acceleration);
     motion.set_position(FULL_CELL);
 
     if (side == RIGHT_START) {
@@ -739,7 +1360,7 @@ class Mouse {
     int sensor_right = sensors.rss.value;
     // move two cells. The resting position of the mouse have the
     // same offset as the turn ending
-    motion.move(2 * FULL_CELL, SEARCH_TURN_SPEED, 0, SEARCH_ACCELERATION);
+    motion.move(2 * FULL_CELL, settings.search_turn_speed, 0, settings.search_acceleration);
     sensor_left -= sensors.lss.value;
     sensor_right -= sensors.rss.value;
     reporter.print_justified(sensor_left, 5);
@@ -772,6 +1393,8 @@ class Mouse {
   Heading m_heading;
   Location m_location;
   bool m_handStart = false;
+  float m_path_time = 0;
+  float m_path_length = 0;
 };
 
 #endif  // MOUSE_H
\ No newline at end of file
@@ -10,15 +10,67 @@
  ******************************************************************************/
 
 #ifndef PROFILE_H
+#define PROFILE_H
 
 #include <Arduino.h>
 #include "config.h"
+#include "fixed.h"
+#include "ramps.h"
 //***************************************************************************//
 class Profile;
 
 extern Profile forward;
 extern Profile rotation;
 
+/***
+ * The S-curve part of a ProfileSetup. Each ramp is planned as a whole number
+ * of ticks with the acceleration ramped up and down at the jerk limit. The
+ * jerk is the speed change per tick per tick. The first entry of each pair
+ * is for the change to the peak speed and the second is for the braking.
+ */
+struct SCurveSetup {
+  uint16_t jerk_ticks[2];
+  uint16_t constant_ticks[2];
+  real_t jerk[2];
+  real_t braking_distance;  // including the tick at the final speed
+};
+
+/***
+ * The shaped part of a ProfileSetup. The step is the ramp table phase
+ * for each tick.
+ */
+struct ShapedSetup {
+  uint16_t ramp_ticks;
+  uint16_t hold_ticks;
+  uint32_t step;
+};
+
+/***
+ * Everything a profile needs to start, as made by Profile::plan() or
+ * Profile::plan_shaped(). All the floating point sums are done then so
+ * that the profile can be started from systick later, with nothing more
+ * than a copy. The speeds are signed for the direction of the move.
+ */
+struct ProfileSetup {
+  enum Kind : uint8_t {
+    PK_NONE,  // too short to move at all
+    PK_TRAPEZOID,
+    PK_S_CURVE,
+    PK_SHAPED,
+  };
+  Kind kind;
+  int8_t sign;
+  real_t final_position;  // always positive
+  real_t target_speed;    // the top speed, or the peak speed when there is one
+  real_t final_speed;
+  real_t delta_v;
+  real_t braking_scale;  // twice the acceleration
+  union {
+    SCurveSetup s_curve;
+    ShapedSetup shaped;
+  };
+};
+
 /***
  * The Profile class manages speed as a function of time or distance. A profile
  * is trapezoidal in shape and consists of up to three phases.
@@ -45,6 +97,33 @@ extern Profile rotation;
  * Although the units in the comments are shown as mm, the class is unit
  * agnostic and you can interpret the units as mm, cm, deg, bananas or anything
  * else. Just be consistent when using speed and acceleration.
+ *
+ * With USE_FIXED_POINT set, the speed and position are held in fixed point
+ * so that update() needs no floating point arithmetic. See fixed.h.
+ *
+ * If start() is given a jerk, the profile is an S-curve instead. Each change
+ * of speed ramps the acceleration up and down at the given jerk so that
+ * there are no sudden steps in acceleration to make the wheels slip. The
+ * whole profile is planned before it starts, as a list of segments lasting
+ * a whole number of ticks. The only exception is the coasting segment. It
+ * ends when the remaining distance is the same as the distance needed to
+ * brake so that small errors in the earlier segments do not build up. That
+ * leaves update() with very little work to do.
+ *
+ * Either way, a profile ends as soon as braking reaches the final speed and
+ * the position is set to the exact distance. There is no need for a creep
+ * speed to carry it on to the end.
+ *
+ * A shaped profile, from start_shaped(), always starts and ends at rest. It
+ * is used for the smooth turns. The speed in the ramps is looked up in a
+ * table in flash - see ramps.h - and the number of ticks in each part is
+ * fixed when it starts. The same turn is then exactly the same every time.
+ *
+ * All the sums needed to start a profile are done by plan() or plan_shaped().
+ * They make a ProfileSetup that holds the results in the profile's own
+ * number format. start() does both at once. The motion command queue plans
+ * each profile when it is queued, in the main loop, and systick starts it
+ * later with isr_start(), which only has to copy the set-up.
  */
 class Profile {
  public:
@@ -68,6 +147,11 @@ class Profile {
     return m_state == PS_FINISHED;
   }
 
+  /// @brief  true once the profile has started to slow down for its end
+  bool isr_is_braking() {
+    return m_state == PS_BRAKING;
+  }
+
   /// @brief  Begin a profile. Once started, it will automatically run to completion
   ///         Subsequent calls before completion supercede all the parameters.
   ///         Called may monitor progress using is_finished() method
@@ -75,36 +159,195 @@ class Profile {
   /// @param top_speed    (mm/s)   negative values move the robot in reverse
   /// @param final_speed  (mm/s)
   /// @param acceleration (mm/s/s)
+  /// @param jerk         (mm/s/s/s) zero for a trapezoidal profile
+
+  void start(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    start(plan(distance, speed(), top_speed, final_speed, acceleration, jerk));
+  }
 
-  void start(float distance, float top_speed, float final_speed, float acceleration) {
-    m_sign = (distance < 0) ? -1 : +1;
+  /// @brief  Begin a profile from a set-up made earlier by plan() or plan_shaped()
+  void start(const ProfileSetup &setup) {
+    ATOMIC {
+      isr_start(setup);
+    }
+  }
+
+  /// @brief  the same as start() for use in systick. Nothing is worked out
+  ///         here, the set-up is just copied into the profile.
+  void isr_start(const ProfileSetup &setup) {
+    if (setup.kind == ProfileSetup::PK_NONE) {
+      m_state = PS_FINISHED;
+      return;
+    }
+    m_sign = setup.sign;
+    m_position = 0;
+    m_final_position = setup.final_position;
+    m_target_speed = setup.target_speed;
+    m_final_speed = setup.final_speed;
+    m_delta_v = setup.delta_v;
+    m_braking_scale = setup.braking_scale;
+    m_peak_speed = setup.target_speed;
+    m_s_curve = setup.kind == ProfileSetup::PK_S_CURVE;
+    m_shaped = setup.kind == ProfileSetup::PK_SHAPED;
+    if (m_s_curve) {
+      const SCurveSetup &curve = setup.s_curve;
+      m_segment_ticks[SEG_JERK_UP] = curve.jerk_ticks[0];
+      m_segment_ticks[SEG_CONSTANT_ACC] = curve.constant_ticks[0];
+      m_segment_ticks[SEG_JERK_DOWN] = curve.jerk_ticks[0];
+      m_segment_ticks[SEG_COAST] = 0;
+      m_segment_ticks[SEG_BRAKE_JERK_UP] = curve.jerk_ticks[1];
+      m_segment_ticks[SEG_BRAKE_CONSTANT] = curve.constant_ticks[1];
+      m_segment_ticks[SEG_BRAKE_JERK_DOWN] = curve.jerk_ticks[1];
+      m_segment_jerk[SEG_JERK_UP] = curve.jerk[0];
+      m_segment_jerk[SEG_CONSTANT_ACC] = 0;
+      m_segment_jerk[SEG_JERK_DOWN] = -curve.jerk[0];
+      m_segment_jerk[SEG_COAST] = 0;
+      m_segment_jerk[SEG_BRAKE_JERK_UP] = curve.jerk[1];
+      m_segment_jerk[SEG_BRAKE_CONSTANT] = 0;
+      m_segment_jerk[SEG_BRAKE_JERK_DOWN] = -curve.jerk[1];
+      m_s_curve_braking_distance = curve.braking_distance;
+      m_segment = SEG_JERK_UP;
+      m_ticks_left = curve.jerk_ticks[0];
+      m_delta_speed = 0;
+    }
+    if (m_shaped) {
+      m_speed = 0;
+      m_target_speed = 0;
+      m_shape_ramp_ticks = setup.shaped.ramp_ticks;
+      m_shape_hold_ticks = setup.shaped.hold_ticks;
+      m_shape_step = setup.shaped.step;
+      m_shape_tick = 0;
+    }
+    m_state = PS_ACCELERATING;
+  }
+
+  /***
+   * Work out the set-up for a trapezoidal profile, or an S-curve if there
+   * is a jerk, that starts at the given speed. Only an S-curve needs to
+   * know the start speed. A trapezoid carries on from whatever the speed
+   * is when it starts. This does all the floating point arithmetic so it
+   * should not be called from systick.
+   * @param distance     (mm)     negative values move the robot in reverse
+   * @param start_speed  (mm/s)
+   * @param top_speed    (mm/s)
+   * @param final_speed  (mm/s)
+   * @param acceleration (mm/s/s)
+   * @param jerk         (mm/s/s/s) zero for a trapezoidal profile
+   */
+  static ProfileSetup plan(float distance, float start_speed, float top_speed, float final_speed, float acceleration,
+                           float jerk = 0) {
+    ProfileSetup setup = {};
+    setup.sign = (distance < 0) ? -1 : +1;
     if (distance < 0) {
       distance = -distance;
     }
     if (distance < 1.0) {
-      m_state = PS_FINISHED;
-      return;
+      setup.kind = ProfileSetup::PK_NONE;
+      return setup;
     }
     if (final_speed > top_speed) {
       final_speed = top_speed;
     }
-
-    m_position = 0;
-    m_final_position = distance;
-    m_target_speed = m_sign * fabsf(top_speed);
-    m_final_speed = m_sign * fabsf(final_speed);
-    m_acceleration = fabsf(acceleration);
-    if (m_acceleration >= 1) {
-      m_one_over_acc = 1.0f / m_acceleration;
-    } else {
-      m_one_over_acc = 1.0;
+    acceleration = fabsf(acceleration);
+    setup.kind = ProfileSetup::PK_TRAPEZOID;
+    setup.final_position = to_real(distance);
+    setup.target_speed = setup.sign * to_real(fabsf(top_speed));
+    setup.final_speed = setup.sign * to_real(fabsf(final_speed));
+    setup.delta_v = to_real(acceleration * LOOP_INTERVAL);
+    setup.braking_scale = to_real(2 * max(acceleration, 1.0f));
+    if (jerk > 0 && acceleration > 0) {
+      plan_s_curve(setup, distance, setup.sign * start_speed, fabsf(top_speed), fabsf(final_speed), acceleration, jerk);
     }
-    m_state = PS_ACCELERATING;
+    return setup;
   }
 
   // Start a profile and wait for it to finish. This is a blocking call.
-  void move(float distance, float top_speed, float final_speed, float acceleration) {
-    start(distance, top_speed, final_speed, acceleration);
+  void move(float distance, float top_speed, float final_speed, float acceleration, float jerk = 0) {
+    start(distance, top_speed, final_speed, acceleration, jerk);
+    wait_until_finished();
+  }
+
+  /// @brief  Begin a shaped profile that starts and finishes at rest. The ramps
+  ///         last as long as a trapezoid would take to reach the top speed at
+  ///         the given acceleration. The top speed is then adjusted a little
+  ///         so that the whole profile lasts a whole number of ticks.
+  /// @param distance     (mm)
+  /// @param top_speed    (mm/s)
+  /// @param acceleration (mm/s/s)
+  void start_shaped(float distance, float top_speed, float acceleration) {
+    start(plan_shaped(distance, top_speed, acceleration));
+  }
+
+  /// @brief  Work out the set-up for start_shaped() so that it can be started
+  ///         later with start() or isr_start()
+  static ProfileSetup plan_shaped(float distance, float top_speed, float acceleration) {
+    ProfileSetup setup = {};
+    setup.sign = (distance < 0) ? -1 : +1;
+    distance = fabsf(distance);
+    top_speed = fabsf(top_speed);
+    acceleration = fabsf(acceleration);
+    if (distance < 1.0 || top_speed < 1 || acceleration < 1) {
+      setup.kind = ProfileSetup::PK_NONE;
+      return setup;
+    }
+    long ramp_ticks;
+    long hold_ticks;
+    shaped_ticks(distance, top_speed, acceleration, ramp_ticks, hold_ticks);
+    float peak_speed = distance / ((ramp_ticks + hold_ticks) * LOOP_INTERVAL);
+    setup.kind = ProfileSetup::PK_SHAPED;
+    setup.final_position = to_real(distance);
+    setup.target_speed = setup.sign * to_real(peak_speed);
+    setup.final_speed = 0;
+    setup.delta_v = to_real(acceleration * LOOP_INTERVAL);
+    setup.braking_scale = to_real(2 * acceleration);
+    setup.shaped.ramp_ticks = ramp_ticks;
+    setup.shaped.hold_ticks = hold_ticks;
+    setup.shaped.step = (TURN_RAMP_POINTS * 65536L) / ramp_ticks;
+    return setup;
+  }
+
+  /// @brief  the time in seconds that start_shaped() would take
+  static float shaped_time(float distance, float top_speed, float acceleration) {
+    distance = fabsf(distance);
+    top_speed = fabsf(top_speed);
+    acceleration = fabsf(acceleration);
+    if (distance < 1.0 || top_speed < 1 || acceleration < 1) {
+      return 0;
+    }
+    long ramp_ticks;
+    long hold_ticks;
+    shaped_ticks(distance, top_speed, acceleration, ramp_ticks, hold_ticks);
+    return (2 * ramp_ticks + hold_ticks) * LOOP_INTERVAL;
+  }
+
+  /***
+   * The time in seconds for a trapezoidal profile that starts at one speed
+   * and finishes at another. Moves too short to make the whole speed change
+   * are taken to go at the average of the two speeds.
+   */
+  static float trapezoid_time(float distance, float start_speed, float top_speed, float final_speed,
+                              float acceleration) {
+    distance = fabsf(distance);
+    start_speed = fabsf(start_speed);
+    top_speed = fabsf(top_speed);
+    final_speed = fabsf(final_speed);
+    acceleration = fabsf(acceleration);
+    if (distance < 1.0 || acceleration < 1) {
+      return 0;
+    }
+    float v0 = start_speed * start_speed;
+    float v1 = final_speed * final_speed;
+    if (fabsf(v1 - v0) >= 2 * acceleration * distance) {
+      return 2 * distance / max(start_speed + final_speed, 1.0f);
+    }
+    float peak = min(sqrtf(acceleration * distance + (v0 + v1) / 2), max(top_speed, max(start_speed, final_speed)));
+    float ramp_distance = (2 * peak * peak - v0 - v1) / (2 * acceleration);
+    return (2 * peak - start_speed - final_speed) / acceleration + (distance - ramp_distance) / peak;
+  }
+
+  // Start a shaped profile and wait for it to finish. This is a blocking call.
+  void move_shaped(float distance, float top_speed, float acceleration) {
+    start_shaped(distance, top_speed, acceleration);
     wait_until_finished();
   }
 
@@ -140,117 +383,360 @@ class Profile {
   ///         current speed using the current acceleration.
   /// @return distance (mm)
   float get_braking_distance() {
-    return fabsf(m_speed * m_speed - m_final_speed * m_final_speed) * 0.5 * m_one_over_acc;
+    float speed = real_to_float(m_speed);
+    float final_speed = real_to_float(m_final_speed);
+    return fabsf(speed * speed - final_speed * final_speed) / real_to_float(m_braking_scale);
   }
 
   /// @brief  gets the distance travelled (mm) since the last call to start(). If there
   ///         was a prior call to set_position() distance is incremented from there.
   /// @return distance travelled (mm)
   float position() {
-    float pos;
+    real_t pos;
     ATOMIC {
       pos = m_position;
     }
-    return pos;
+    return real_to_float(pos);
   }
 
   /// @brief Get the current speed
   /// @return
   float speed() {
-    float speed;
+    real_t speed;
     ATOMIC {
       speed = m_speed;
     }
-    return speed;
+    return real_to_float(speed);
+  }
+
+  /// @brief  The current speed without a guard or conversion. Only for use
+  ///         by the controllers in systick which cannot be interrupted by update()
+  real_t isr_speed() {
+    return m_speed;
+  }
+
+  real_t isr_position() {
+    return m_position;
+  }
+
+  /// @brief  the same as adjust_position() for use in systick
+  void isr_adjust_position(real_t adjustment) {
+    m_position += adjustment;
   }
 
   float acceleration() {
-    float acc;
+    real_t braking_scale;
     ATOMIC {
-      acc = m_acceleration;
+      braking_scale = m_braking_scale;
     }
-    return acc;
+    return real_to_float(braking_scale) / 2;
   }
 
   void set_speed(float speed) {
     ATOMIC {
-      m_speed = speed;
+      m_speed = to_real(speed);
     }
   }
+  /// @brief  change speed and stay there. If a profile is still running it
+  ///         will now end at this speed rather than its own final speed
   void set_target_speed(float speed) {
     ATOMIC {
-      m_target_speed = speed;
+      isr_set_target_speed(to_real(speed));
     }
   }
 
+  /// @brief  the same as set_target_speed() for use in systick
+  void isr_set_target_speed(real_t speed) {
+    m_target_speed = speed;
+    m_final_speed = speed;
+  }
+
   // normally only used to alter position for forward error correction
   void adjust_position(float adjustment) {
     ATOMIC {
-      m_position += adjustment;
+      m_position += to_real(adjustment);
     }
   }
 
   void set_position(float position) {
     ATOMIC {
-      m_position = position;
+      m_position = to_real(position);
     }
   }
 
+  /// @brief  the same as set_position() for use in systick
+  void isr_set_position(real_t position) {
+    m_position = position;
+  }
+
   // update is called from within systick and should be safe from interrupts
   void update() {
     if (m_state == PS_IDLE) {
       return;
     }
-    float delta_v = m_acceleration * LOOP_INTERVAL;
-    float remaining = fabsf(m_final_position) - fabsf(m_position);
+    if (m_s_curve && m_state != PS_FINISHED) {
+      update_s_curve();
+      return;
+    }
+    if (m_shaped && m_state != PS_FINISHED) {
+      update_shaped();
+      return;
+    }
+    real_t remaining = real_abs(m_final_position) - real_abs(m_position);
     if (m_state == PS_ACCELERATING) {
-      if (remaining < get_braking_distance()) {
+      if (must_brake(remaining)) {
         m_state = PS_BRAKING;
-        if (m_final_speed == 0) {
-          // The magic number I normally set to be the same, numerically, as the current
-          // acceleration. It is just a small velicity that ensures that the motion continues 
-          // past the finish point in case floating point rounding prevents that happening.
-          // It is a nasty hack I keep meaning to find a more tidy solution for.
-          m_target_speed = m_sign * 5.0f;  // magic number to make sure we reach zero
-        } else {
-          m_target_speed = m_final_speed;
-        };
+        m_target_speed = m_final_speed;
       }
     }
     // try to reach the target speed
     if (m_speed < m_target_speed) {
-      m_speed += delta_v;
+      m_speed += m_delta_v;
       if (m_speed > m_target_speed) {
         m_speed = m_target_speed;
       }
     }
     if (m_speed > m_target_speed) {
-      m_speed -= delta_v;
+      m_speed -= m_delta_v;
       if (m_speed < m_target_speed) {
         m_speed = m_target_speed;
       }
     }
     // increment the position
-    m_position += m_speed * LOOP_INTERVAL;
-	// The number is a hack to ensure floating point rounding errors do not prevent the
+    m_position += scale(m_speed, LOOP_INTERVAL_GAIN);
+    // Braking started at the point worked out from the braking distance so,
+    // once the final speed is reached, the move is over. Any small error in
+    // where it stopped is taken out of the position.
+    if (m_state == PS_BRAKING && m_speed == m_final_speed) {
+      m_position = m_sign * m_final_position;
+      m_state = PS_FINISHED;
+      return;
+    }
+    // The number is a hack to ensure floating point rounding errors do not prevent the
     // loop termination. The units are mm and independent of the encoder resolution.
     // I figure that being within 1/8 of a mm will be close enough.
-    if (m_state != PS_FINISHED && remaining < 0.125) {
+    if (m_state != PS_FINISHED && remaining < to_real(0.125f)) {
       m_state = PS_FINISHED;
       m_target_speed = m_final_speed;
     }
   }
 
  private:
+  enum Segment : uint8_t {
+    SEG_JERK_UP = 0,
+    SEG_CONSTANT_ACC = 1,
+    SEG_JERK_DOWN = 2,
+    SEG_COAST = 3,
+    SEG_BRAKE_JERK_UP = 4,
+    SEG_BRAKE_CONSTANT = 5,
+    SEG_BRAKE_JERK_DOWN = 6,
+    SEG_COUNT = 7,
+  };
+
+  /***
+   * A change of speed with the acceleration ramped up at the jerk limit,
+   * held, then ramped back down. The jerk is worked out again from the
+   * whole numbers of ticks so that the ramp ends exactly at the new speed.
+   * Its units are speed change per tick per tick. Because the acceleration
+   * is symmetrical, the mean speed is exactly half way between the two.
+   */
+  struct Ramp {
+    uint16_t jerk_ticks;
+    uint16_t constant_ticks;
+    float jerk;
+    float distance;
+  };
+
+  static Ramp plan_ramp(float v_start, float v_end, float acceleration, float jerk) {
+    Ramp ramp = {0, 0, 0, 0};
+    float change = fabsf(v_end - v_start);
+    if (change < 0.001f) {
+      return ramp;
+    }
+    float jerk_time = acceleration / jerk;
+    float constant_time = 0;
+    if (change < acceleration * jerk_time) {
+      jerk_time = sqrtf(change / jerk);  // not enough time to reach full acceleration
+    } else {
+      constant_time = change / acceleration - jerk_time;
+    }
+    ramp.jerk_ticks = max(1L, lroundf(jerk_time * LOOP_FREQUENCY));
+    ramp.constant_ticks = lroundf(constant_time * LOOP_FREQUENCY);
+    ramp.jerk = (v_end - v_start) / (float(ramp.jerk_ticks) * (ramp.jerk_ticks + ramp.constant_ticks));
+    ramp.distance = 0.5f * (v_start + v_end) * (2 * ramp.jerk_ticks + ramp.constant_ticks) * LOOP_INTERVAL;
+    return ramp;
+  }
+
+  /***
+   * Find the segments for an S-curve. If there is not enough distance to
+   * reach the top speed, the highest peak speed that will fit is found by
+   * bisection. This is all done in plan() so it does not matter that it
+   * takes a little while. The speeds here are all in the direction of the
+   * move.
+   */
+  static void plan_s_curve(ProfileSetup &setup, float distance, float start_speed, float top_speed, float final_speed,
+                           float acceleration, float jerk) {
+    float peak_speed = top_speed;
+    Ramp up = plan_ramp(start_speed, peak_speed, acceleration, jerk);
+    Ramp down = plan_ramp(peak_speed, final_speed, acceleration, jerk);
+    if (up.distance + down.distance > distance) {
+      float low = final_speed;
+      float high = top_speed;
+      for (int i = 0; i < 12; i++) {
+        peak_speed = 0.5f * (low + high);
+        up = plan_ramp(start_speed, peak_speed, acceleration, jerk);
+        down = plan_ramp(peak_speed, final_speed, acceleration, jerk);
+        if (up.distance + down.distance > distance) {
+          high = peak_speed;
+        } else {
+          low = peak_speed;
+        }
+      }
+      peak_speed = low;
+      up = plan_ramp(start_speed, peak_speed, acceleration, jerk);
+      down = plan_ramp(peak_speed, final_speed, acceleration, jerk);
+    }
+    SCurveSetup &curve = setup.s_curve;
+    curve.jerk_ticks[0] = up.jerk_ticks;
+    curve.constant_ticks[0] = up.constant_ticks;
+    curve.jerk[0] = to_real(setup.sign * up.jerk);
+    curve.jerk_ticks[1] = down.jerk_ticks;
+    curve.constant_ticks[1] = down.constant_ticks;
+    curve.jerk[1] = to_real(setup.sign * down.jerk);
+    // the tick that finishes the profile moves at the final speed
+    curve.braking_distance = to_real(down.distance + final_speed * LOOP_INTERVAL);
+    setup.target_speed = setup.sign * to_real(peak_speed);
+    setup.kind = ProfileSetup::PK_S_CURVE;
+  }
+
+  /***
+   * Called from update() while an S-curve is running. The speed is
+   * integrated with the trapezoidal rule, which is exact for a speed
+   * change that varies linearly from one tick to the next.
+   */
+  void update_s_curve() {
+    while (m_ticks_left == 0) {
+      if (m_segment == SEG_COAST) {
+        real_t step = scale(m_speed, LOOP_INTERVAL_GAIN);
+        real_t remaining = real_abs(m_final_position) - real_abs(m_position);
+        if (remaining - real_abs(step) / 2 > m_s_curve_braking_distance) {
+          m_position += step;
+          return;
+        }
+        m_state = PS_BRAKING;
+      }
+      m_segment++;
+      if (m_segment == SEG_COAST) {
+        // remove any rounding errors from the acceleration
+        m_speed = m_peak_speed;
+        m_delta_speed = 0;
+      }
+      if (m_segment == SEG_COUNT) {
+        m_speed = m_final_speed;
+        m_target_speed = m_final_speed;
+        m_state = PS_FINISHED;
+        m_position = m_sign * m_final_position;
+        return;
+      }
+      m_ticks_left = m_segment_ticks[m_segment];
+    }
+    real_t delta_speed = m_delta_speed + m_segment_jerk[m_segment];
+    real_t speed = m_speed + (m_delta_speed + delta_speed) / 2;
+    m_position += scale(m_speed + speed, HALF_LOOP_INTERVAL_GAIN);
+    m_speed = speed;
+    m_delta_speed = delta_speed;
+    m_ticks_left--;
+    if (m_segment < SEG_COAST && real_abs(m_position) >= real_abs(m_final_position)) {
+      // too short to finish changing speed so behave like a trapezoid
+      m_target_speed = m_final_speed;
+      m_state = PS_FINISHED;
+    }
+  }
+
+  /***
+   * Called from update() while a shaped profile is running. The ramp table
+   * is sampled in the middle of each tick. That keeps the ramp down an exact
+   * mirror of the ramp up. At the end, the position is set to the exact
+   * distance to remove any rounding errors.
+   */
+  void update_shaped() {
+    uint16_t tick = m_shape_tick++;
+    uint16_t ramp_down = m_shape_ramp_ticks + m_shape_hold_ticks;
+    uint16_t fraction = TURN_RAMP_FULL;
+    if (tick < m_shape_ramp_ticks) {
+      fraction = turn_ramp_value((2 * tick + 1) * (m_shape_step / 2));
+    } else if (tick >= ramp_down) {
+      uint16_t ticks_left = ramp_down + m_shape_ramp_ticks - tick;
+      if (ticks_left == 0) {
+        m_speed = 0;
+        m_position = m_sign * m_final_position;
+        m_state = PS_FINISHED;
+        return;
+      }
+      fraction = turn_ramp_value((2 * ticks_left - 1) * (m_shape_step / 2));
+      m_state = PS_BRAKING;
+    }
+    m_speed = scale(m_peak_speed, fraction_to_gain(fraction));
+    m_position += scale(m_speed, LOOP_INTERVAL_GAIN);
+  }
+
+  /***
+   * The ramps of a shaped profile last as long as a trapezoid would take to
+   * reach the top speed. The mean speed in each ramp is half the peak so the
+   * two ramps together cover the same distance as one ramp's worth of ticks
+   * at full speed
+   */
+  static void shaped_ticks(float distance, float top_speed, float acceleration, long &ramp_ticks, long &hold_ticks) {
+    float full_speed_ticks = distance / (top_speed * LOOP_INTERVAL);
+    ramp_ticks = lroundf(top_speed / acceleration * LOOP_FREQUENCY);
+    hold_ticks = 0;
+    if (ramp_ticks < full_speed_ticks) {
+      hold_ticks = lroundf(full_speed_ticks - ramp_ticks);
+    } else {
+      ramp_ticks = lroundf(sqrtf(distance / acceleration) * LOOP_FREQUENCY);
+    }
+    ramp_ticks = constrain(ramp_ticks, 1L, 4095L);
+  }
+
+  /// @brief  Compare the remaining distance with the braking distance.
+  ///         In fixed point, the squared speeds need 64 bits so the test is
+  ///         rearranged to avoid a division: remaining * 2a < |v^2 - vf^2|
+  bool must_brake(real_t remaining) {
+#if USE_FIXED_POINT
+    int64_t delta_v2 = (int64_t)m_speed * m_speed - (int64_t)m_final_speed * m_final_speed;
+    if (delta_v2 < 0) {
+      delta_v2 = -delta_v2;
+    }
+    return (int64_t)remaining * m_braking_scale < delta_v2;
+#else
+    return remaining * m_braking_scale < fabsf(m_speed * m_speed - m_final_speed * m_final_speed);
+#endif
+  }
+
   volatile uint8_t m_state = PS_IDLE;
-  volatile float m_speed = 0;
-  volatile float m_position = 0;
+  volatile real_t m_speed = 0;
+  volatile real_t m_position = 0;
   int8_t m_sign = 1;
-  float m_acceleration = 0;
-  float m_one_over_acc = 1;
-  float m_target_speed = 0;
-  float m_final_speed = 0;
-  float m_final_position = 0;
+  real_t m_delta_v = 0;
+  real_t m_braking_scale = to_real(2.0f);  // twice the acceleration
+  real_t m_target_speed = 0;
+  real_t m_final_speed = 0;
+  real_t m_final_position = 0;
+  // S-curve segments
+  bool m_s_curve = false;
+  uint8_t m_segment = SEG_JERK_UP;
+  uint16_t m_ticks_left = 0;
+  uint16_t m_segment_ticks[SEG_COUNT];
+  real_t m_segment_jerk[SEG_COUNT];
+  real_t m_delta_speed = 0;  // the speed change in the last tick
+  real_t m_peak_speed = 0;
+  real_t m_s_curve_braking_distance = 0;
+  // shaped profile
+  bool m_shaped = false;
+  uint16_t m_shape_tick = 0;
+  uint16_t m_shape_ramp_ticks = 0;
+  uint16_t m_shape_hold_ticks = 0;
+  uint32_t m_shape_step = 0;  // ramp table phase per tick
 };
 
 #endif
\ No newline at end of file
@@ -28,6 +28,11 @@
  * By only using queues as local variables in this way, there can be no memory
  * leaks or heap fragmentation.
  *
+ * A queue will never write past the end of its storage. An item added to a
+ * full queue is thrown away and the overflow flag is set. The high water mark
+ * records the most items the queue has held since it was created so that you
+ * can find out how big it really needs to be.
+ *
  * To define a Queue of 64 bytes use something like:
  *    Queue<uint8_t> q_bytes;
  *
@@ -52,12 +57,19 @@ class Queue {
   }
 
   void add(item_t item) {
+    if (mItemCount >= num_items) {
+      mOverflow = true;
+      return;
+    }
     mData[mTail] = item;
     ++mTail;
     ++mItemCount;
     if (mTail > num_items) {
       mTail -= num_items;
     }
+    if (mItemCount > mHighWater) {
+      mHighWater = mItemCount;
+    }
   }
 
   item_t head() {
@@ -70,11 +82,23 @@ class Queue {
     return result;
   }
 
+  // the most items held at one time
+  int high_water() {
+    return mHighWater;
+  }
+
+  // true if an item has ever been thrown away
+  bool overflowed() {
+    return mOverflow;
+  }
+
  protected:
   item_t mData[num_items + 1];
   int mHead = 0;
   int mTail = 0;
   int mItemCount = 0;
+  int mHighWater = 0;
+  bool mOverflow = false;
 
  private:
   // while this is probably correct, prevent use of the copy constructor
@@ -0,0 +1,85 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef RAMPS_H
+#define RAMPS_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/***
+ * A shaped profile, as used for the smooth turns, is made from a ramp up to
+ * the peak speed, a period at that speed and a mirror image ramp back down
+ * to zero. The shape of the ramps comes from a table in flash so systick
+ * only has to look up the speed for each tick.
+ *
+ * Each table holds the fraction of the peak speed, with 32768 being the
+ * full speed, at TURN_RAMP_POINTS+1 evenly spaced times through the ramp.
+ * Every table must be symmetrical so that value(u) + value(1-u) = 1. Then
+ * the mean speed in the ramp is exactly half the peak speed whatever its
+ * shape and the same turn parameters always give the same turn angle.
+ *
+ *  - TURN_RAMP_LINEAR : constant angular acceleration. This is the same as
+ *                       the trapezoidal profile so the turn geometry in the
+ *                       robot config does not change. At constant forward
+ *                       speed, the path in the ramps is a clothoid.
+ *  - TURN_RAMP_SINE   : the acceleration rises and falls smoothly so the
+ *                       peak acceleration is PI/2 times higher but there
+ *                       are no steps. Expect to adjust the turn offsets.
+ *
+ * The robot config may choose the ramp by defining TURN_RAMP.
+ */
+#define TURN_RAMP_LINEAR 0
+#define TURN_RAMP_SINE 1
+
+#ifndef TURN_RAMP
+#define TURN_RAMP TURN_RAMP_LINEAR
+#endif
+
+const uint8_t TURN_RAMP_POINTS = 32;
+const uint16_t TURN_RAMP_FULL = 32768;
+
+// clang-format off
+#if TURN_RAMP == TURN_RAMP_SINE
+const uint16_t turn_ramp[TURN_RAMP_POINTS + 1] PROGMEM = {
+        0,    79,   315,   705,  1247,  1935,  2761,  3719,
+     4799,  5990,  7282,  8661, 10114, 11628, 13188, 14778,
+    16384, 17990, 19580, 21140, 22654, 24107, 25486, 26778,
+    27969, 29049, 30007, 30833, 31521, 32063, 32453, 32689,
+    32768,
+};
+#else
+const uint16_t turn_ramp[TURN_RAMP_POINTS + 1] PROGMEM = {
+        0,  1024,  2048,  3072,  4096,  5120,  6144,  7168,
+     8192,  9216, 10240, 11264, 12288, 13312, 14336, 15360,
+    16384, 17408, 18432, 19456, 20480, 21504, 22528, 23552,
+    24576, 25600, 26624, 27648, 28672, 29696, 30720, 31744,
+    32768,
+};
+#endif
+// clang-format on
+
+/// @brief  Interpolate the ramp table.
+/// @param  phase position through the ramp with 16 fractional bits so that
+///         TURN_RAMP_POINTS * 65536 is the end of the ramp.
+/// @return fraction of full speed where TURN_RAMP_FULL is 1.0
+inline uint16_t turn_ramp_value(uint32_t phase) {
+  uint8_t index = phase >> 16;
+  if (index >= TURN_RAMP_POINTS) {
+    return TURN_RAMP_FULL;
+  }
+  uint16_t fraction = phase & 0xFFFF;
+  uint16_t low = pgm_read_word_near(turn_ramp + index);
+  uint16_t high = pgm_read_word_near(turn_ramp + index + 1);
+  return low + (uint16_t)(((uint32_t)(high - low) * fraction) >> 16);
+}
+
+#endif
@@ -0,0 +1,93 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/***
+ * The receiver is the input side of the serial port. Systick takes every
+ * character that has arrived and puts it in a ring buffer until the CLI
+ * asks for it. That keeps working while the robot is busy with a search
+ * or a test, so commands typed then are waiting when it is done rather
+ * than being lost.
+ *
+ * The abort keys, Ctrl-C and ESC, are not buffered. Either one sets a
+ * flag at once and the mouse checks it wherever it checks the button. A
+ * search stops at the centre of the next cell and does not go home. The
+ * flag stays set until the CLI starts the next command.
+ *
+ * Nothing else may read from Serial because systick is reading from it.
+ */
+
+#ifndef RECEIVER_BUFFER_SIZE
+#define RECEIVER_BUFFER_SIZE 32  // must be a power of two, 128 or less
+#endif
+
+static_assert((RECEIVER_BUFFER_SIZE & (RECEIVER_BUFFER_SIZE - 1)) == 0, "RECEIVER_BUFFER_SIZE must be a power of two");
+static_assert(RECEIVER_BUFFER_SIZE <= 128, "RECEIVER_BUFFER_SIZE must be 128 or less");
+
+const char RECEIVER_CTRL_C = 0x03;
+const char RECEIVER_ESCAPE = 0x1B;
+
+class Receiver;
+extern Receiver receiver;
+
+class Receiver {
+ public:
+  /// @brief  the number of characters waiting
+  uint8_t available() const {
+    return m_head - m_tail;
+  }
+
+  /// @brief  the next character. Check available() first
+  char read() {
+    char c = m_buffer[m_tail & MASK];
+    m_tail++;
+    return c;
+  }
+
+  bool abort_requested() const {
+    return m_abort;
+  }
+
+  void clear_abort() {
+    m_abort = false;
+  }
+
+  /***
+   * Called by systick to collect what has arrived. When the buffer is
+   * full, the rest is left in the serial port buffer for next time.
+   */
+  void update() {
+    while (uint8_t(m_head - m_tail) < RECEIVER_BUFFER_SIZE && Serial.available()) {
+      char c = Serial.read();
+      if (c == RECEIVER_CTRL_C || c == RECEIVER_ESCAPE) {
+        m_abort = true;
+      } else {
+        m_buffer[m_head & MASK] = c;
+        m_head++;
+      }
+    }
+  }
+
+ private:
+  enum { MASK = RECEIVER_BUFFER_SIZE - 1 };
+
+  char m_buffer[RECEIVER_BUFFER_SIZE];
+  volatile uint8_t m_head = 0;  // written only by systick
+  volatile uint8_t m_tail = 0;  // written only by read()
+  volatile bool m_abort = false;
+};
+
+#endif
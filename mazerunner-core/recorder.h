@@ -0,0 +1,251 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "encoders.h"
+#include "motion.h"
+#include "motors.h"
+#include "sensors.h"
+
+/***
+ * The flight recorder keeps the last few hundred milliseconds of what the
+ * controllers were doing so that they can be looked at after the robot
+ * has stopped. Systick stores a small sample in a circular buffer and
+ * nothing is sent anywhere during the run.
+ *
+ * Once armed, the recorder runs all the time, overwriting the oldest
+ * samples, until it is triggered. It then keeps going until the buffer
+ * holds RECORDER_PRETRIGGER samples from before the trigger and the rest
+ * from after it. Then it stops and the samples stay there until they are
+ * dumped with the DUMP command or the recorder is armed again.
+ *
+ * The triggers are:
+ *
+ *   - REC_TRIGGER_NOW      : start recording as soon as it is armed
+ *   - REC_TRIGGER_TURN     : the start of a smooth turn in the search
+ *   - REC_TRIGGER_STEERING : any change of steering mode
+ *
+ * The divisor gives one sample every so many systick ticks so that the
+ * same buffer can cover a longer time.
+ *
+ * Each sample is 16 bytes so there is not room for very many in the RAM
+ * of an ATmega328. The default of 8 samples is what fits beside everything
+ * else. The budget is in documents/reporting.md. Use the divisor to make
+ * them cover a longer time. For more samples, make room by reducing
+ * TELEMETRY_BUFFER_SIZE or leaving out something else. Set RECORDER_SAMPLES
+ * to zero to leave the recorder out and then the RECORD and DUMP commands
+ * only say so.
+ */
+
+#ifndef RECORDER_SAMPLES
+#define RECORDER_SAMPLES 8  // set to zero to remove the recorder
+#endif
+
+#ifndef RECORDER_PRETRIGGER
+#define RECORDER_PRETRIGGER (RECORDER_SAMPLES / 4)
+#endif
+
+#ifndef RECORDER_DIVISOR
+#define RECORDER_DIVISOR 1  // systick ticks per sample
+#endif
+
+static_assert(RECORDER_SAMPLES <= 255, "RECORDER_SAMPLES must be 255 or less");
+static_assert(RECORDER_PRETRIGGER <= RECORDER_SAMPLES, "RECORDER_PRETRIGGER must not be more than RECORDER_SAMPLES");
+
+enum RecorderTrigger : uint8_t {
+  REC_TRIGGER_NOW = 0,
+  REC_TRIGGER_TURN = 1,
+  REC_TRIGGER_STEERING = 2,
+};
+
+// the motor voltages are stored as multiples of 1/VOLTS_SCALE volts
+const uint8_t RECORDER_VOLTS_SCALE = 20;
+constexpr gain_t RECORDER_VOLTS_GAIN = to_gain(RECORDER_VOLTS_SCALE);
+
+/***
+ * Positions are stored as 16 bit values that will wrap around on a long run.
+ * Only the difference from the first sample means anything.
+ */
+struct RecorderSample {
+  int16_t velocity;  // profile speed in mm/s
+  int16_t omega;     // profile angular speed in deg/s
+  int16_t distance;  // encoder distance in mm
+  int16_t angle;     // encoder angle in tenths of a degree
+  uint8_t lfs;       // the sensor values, limited to 255
+  uint8_t lss;
+  uint8_t rss;
+  uint8_t rfs;
+  int8_t cte;  // cross track error, limited to +/- 127
+  int8_t left_volts;
+  int8_t right_volts;
+  uint8_t steering_mode;
+};
+
+class Recorder;
+extern Recorder recorder;
+
+class Recorder {
+ public:
+  enum State : uint8_t { IDLE, ARMED, TRIGGERED, DONE };
+
+  /***
+   * Start recording and wait for the trigger. Any samples already in the
+   * buffer are lost.
+   */
+  void arm(RecorderTrigger trigger, uint8_t divisor = RECORDER_DIVISOR) {
+    ATOMIC {
+      m_state = IDLE;
+      m_trigger = trigger;
+      m_divisor = max(divisor, 1);
+      m_tick = 0;
+      m_head = 0;
+      m_count = 0;
+      m_pretrigger = 0;
+      m_last_steering_mode = sensors.g_steering_mode;
+      m_state = ARMED;
+      if (trigger == REC_TRIGGER_NOW) {
+        fire();
+      }
+    }
+  }
+
+  /// @brief  called by the code that causes a trigger event
+  void trigger(RecorderTrigger trigger) {
+    ATOMIC {
+      if (m_state == ARMED && m_trigger == trigger) {
+        fire();
+      }
+    }
+  }
+
+  State state() const {
+    return m_state;
+  }
+
+  uint8_t divisor() const {
+    return m_divisor;
+  }
+
+  /// @brief  the number of samples in the buffer
+  uint8_t count() const {
+    return m_count;
+  }
+
+  /// @brief  how many of the samples were recorded before the trigger
+  uint8_t pretrigger() const {
+    return m_pretrigger;
+  }
+
+  /***
+   * Get a sample for the dump. The oldest sample is number 0. Stop the
+   * recorder first or they will change under you.
+   */
+  RecorderSample sample(uint8_t index) {
+    RecorderSample sample = {};
+#if RECORDER_SAMPLES > 0
+    uint8_t i = (m_head + RECORDER_SAMPLES - m_count + index) % RECORDER_SAMPLES;
+    ATOMIC {
+      sample = m_samples[i];
+    }
+#else
+    (void)index;
+#endif
+    return sample;
+  }
+
+  /// @brief  stop recording and keep whatever is in the buffer
+  void stop() {
+    ATOMIC {
+      if (m_state != IDLE) {
+        m_state = DONE;
+      }
+    }
+  }
+
+  /***
+   * Note: Runs from the systick interrupt. DO NOT call this directly.
+   */
+  void update() {
+#if RECORDER_SAMPLES > 0
+    if (m_state != ARMED && m_state != TRIGGERED) {
+      return;
+    }
+    if (m_trigger == REC_TRIGGER_STEERING && sensors.g_steering_mode != m_last_steering_mode) {
+      m_last_steering_mode = sensors.g_steering_mode;
+      trigger(REC_TRIGGER_STEERING);
+    }
+    if (m_tick) {
+      m_tick--;
+      return;
+    }
+    m_tick = m_divisor - 1;
+    capture(m_samples[m_head]);
+    m_head = (m_head + 1) % RECORDER_SAMPLES;
+    if (m_count < RECORDER_SAMPLES) {
+      m_count++;
+    }
+    if (m_state == TRIGGERED && --m_remaining == 0) {
+      m_state = DONE;
+    }
+#endif
+  }
+
+ private:
+  /// @brief  keep what has been recorded so far and fill the rest of the buffer
+  void fire() {
+    m_pretrigger = min(m_count, RECORDER_PRETRIGGER);
+    m_count = m_pretrigger;
+    m_remaining = RECORDER_SAMPLES - m_pretrigger;
+    m_state = m_remaining ? TRIGGERED : DONE;
+  }
+
+  static int8_t clip8(int value) {
+    return constrain(value, -127, 127);
+  }
+
+  static uint8_t clip_sensor(int value) {
+    return constrain(value, 0, 255);
+  }
+
+  void capture(RecorderSample &sample) {
+    sample.velocity = real_to_int(motion.isr_velocity());
+    sample.omega = real_to_int(motion.isr_omega());
+    sample.distance = encoders.isr_robot_distance();
+    sample.angle = encoders.isr_robot_angle(10);
+    sample.lfs = clip_sensor(sensors.lfs.value);
+    sample.lss = clip_sensor(sensors.lss.value);
+    sample.rss = clip_sensor(sensors.rss.value);
+    sample.rfs = clip_sensor(sensors.rfs.value);
+    sample.cte = clip8(real_to_int(sensors.isr_cross_track_error()));
+    sample.left_volts = clip8(real_to_int(scale(motors.isr_left_motor_volts(), RECORDER_VOLTS_GAIN)));
+    sample.right_volts = clip8(real_to_int(scale(motors.isr_right_motor_volts(), RECORDER_VOLTS_GAIN)));
+    sample.steering_mode = sensors.g_steering_mode;
+  }
+
+#if RECORDER_SAMPLES > 0
+  RecorderSample m_samples[RECORDER_SAMPLES];
+#endif
+  volatile State m_state = IDLE;
+  RecorderTrigger m_trigger = REC_TRIGGER_NOW;
+  uint8_t m_divisor = RECORDER_DIVISOR;
+  uint8_t m_tick = 0;
+  uint8_t m_head = 0;
+  uint8_t m_count = 0;
+  uint8_t m_pretrigger = 0;
+  uint8_t m_remaining = 0;
+  uint8_t m_last_steering_mode = 0;
+};
+
+#endif
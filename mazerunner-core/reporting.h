@@ -18,7 +18,9 @@
 #include "motion.h"
 #include "motors.h"
 #include "profile.h"
+#include "recorder.h"
 #include "sensors.h"
+#include "telemetry.h"
 
 /***
  * While there is no absolute requirement for reporting in a micromouse or
@@ -275,7 +277,46 @@ class Reporter {
       print_justified(position, 7);
       print_justified(sensors.get_front_sum(), 7);
       print_justified(sensors.get_front_diff(), 7);
-      print_justified((int)sensors.get_distance(sensors.get_front_sum(), FRONT_LINEAR_CONSTANT), 7);
+      print_justified(sensors.get_front_distance(), 7);
+      printer.println();
+    }
+  }
+
+  //***************************************************************************//
+
+  /***
+   * Print the contents of the flight recorder as a table. The time is in ms
+   * from the trigger so the samples before it have negative times. The
+   * distance and angle are from the first sample. The angle is in tenths
+   * of a degree and the motor voltages are in millivolts.
+   *
+   * The recorder is stopped first so make sure the robot has finished.
+   */
+  void print_recorder() {
+    recorder.stop();
+    uint8_t count = recorder.count();
+    if (count == 0) {
+      printer.println(F("Nothing recorded"));
+      return;
+    }
+    printer.println(F("time  speed omega   pos angle   lfs   lss   rss   rfs   cte lvolts rvolts steer"));
+    int32_t interval = (1000L * recorder.divisor()) / SYSTICK_FREQUENCY;
+    RecorderSample first = recorder.sample(0);
+    for (uint8_t i = 0; i < count; i++) {
+      RecorderSample sample = recorder.sample(i);
+      print_justified(interval * (i - recorder.pretrigger()), 5);
+      print_justified(sample.velocity, 6);
+      print_justified(sample.omega, 6);
+      print_justified(int16_t(sample.distance - first.distance), 6);
+      print_justified(int16_t(sample.angle - first.angle), 6);
+      print_justified(sample.lfs, 6);
+      print_justified(sample.lss, 6);
+      print_justified(sample.rss, 6);
+      print_justified(sample.rfs, 6);
+      print_justified(sample.cte, 6);
+      print_justified((1000 / RECORDER_VOLTS_SCALE) * sample.left_volts, 7);
+      print_justified((1000 / RECORDER_VOLTS_SCALE) * sample.right_volts, 7);
+      print_justified(sample.steering_mode, 6);
       printer.println();
     }
   }
@@ -314,7 +355,7 @@ class Reporter {
     print_justified(sensors.get_front_sum(), 5);
     print_justified(sensors.get_front_diff(), 5);
     printer.print(F("  | "));
-    print_justified((int)sensors.get_distance(sensors.get_front_sum(), FRONT_LINEAR_CONSTANT), 6);
+    print_justified(sensors.get_front_distance(), 6);
     printer.print(F("     | "));
     printer.println();
   }
@@ -363,6 +404,10 @@ class Reporter {
   /// @private  don't  show this in doxygen output
   //
   void log_action_status(char action, char note, Location location, Heading heading) {
+    if (telemetry.streaming()) {
+      telemetry.log_action(action, note, location.x, location.y, heading, sensors.get_front_sum(), motion.position());
+      return;
+    }
     printer.print('{');
     printer.print(action);
     printer.print(note);
@@ -450,6 +495,21 @@ class Reporter {
     printer.println(POST);
   }
 
+#if MAZE_QUEUE_STATS
+  /***
+   * After a run, show how close the flood queues came to filling up.
+   * Use this with the stress test in tools/flood-stress to check that
+   * the queue sizes in maze.h are big enough.
+   */
+  void print_queue_stats() {
+    printer.print(F("Flood queue high water: "));
+    printer.println(maze.queue_high_water());
+    if (maze.queue_filled()) {
+      printer.println(F("A flood queue filled up"));
+    }
+  }
+#endif
+
   void print_maze(int style = PLAIN) {
     const char dirChars[] = "^>v<* ";
     maze.flood(maze.goal());
@@ -473,7 +533,7 @@ class Reporter {
           print_justified((int)maze.cost(location), 3);
         } else if (style == DIRS) {
           unsigned char direction = maze.heading_to_smallest(location, NORTH);
-          if (location == maze.goal()) {
+          if (maze.is_goal(location)) {
             direction = DIRECTION_COUNT;
           }
           char arrow = ' ';
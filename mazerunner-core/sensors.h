@@ -16,6 +16,8 @@
 #include <wiring_private.h>
 #include "adc.h"
 #include "config.h"
+#include "fixed.h"
+#include "linearise.h"
 
 /**
  *
@@ -56,6 +58,11 @@
  * the sensor value. You can, for example, use it to linearise the fron
  * sum.
  *
+ * Sensors::update() also linearises the front sum using a table in flash.
+ * See linearise.h. That gives a distance in mm that is cheap enough to work
+ * out in systick. Mouse::stop_at_center() uses it to find the middle of the
+ * cell from the wall ahead.
+ *
  * The linearised value is limited to 200mm because the signal to noise of
  * small sensor readings is poor and you are unlikely to be able to reliably
  * measure distance out that far with the standard sensors.
@@ -79,6 +86,25 @@ const uint8_t NO_START = 0;
 const uint8_t LEFT_START = 1;
 const uint8_t RIGHT_START = 2;
 
+/***
+ * A wall edge is where a side wall stops or starts. Sensors::update() looks
+ * for them on every update and flags the ones it finds with these bits. A
+ * falling edge is a wall that has just ended and a rising edge is one that
+ * has just started. Motion uses the flags to correct the forward position.
+ *
+ * A side reading has to go SENSOR_EDGE_HYSTERESIS past the wall threshold
+ * before it counts as a change. Otherwise a noisy reading close to the
+ * threshold would give a string of edges.
+ */
+#ifndef SENSOR_EDGE_HYSTERESIS
+#define SENSOR_EDGE_HYSTERESIS 5
+#endif
+
+const uint8_t EDGE_LEFT_FALLING = 0x01;
+const uint8_t EDGE_LEFT_RISING = 0x02;
+const uint8_t EDGE_RIGHT_FALLING = 0x04;
+const uint8_t EDGE_RIGHT_RISING = 0x08;
+
 //***************************************************************************//
 struct SensorChannel {
   int raw;    // whatever the ADC gives us
@@ -112,12 +138,37 @@ class Sensors {
   int get_front_diff() {
     return int(m_front_diff);
   };
+  int get_front_distance() {
+    return int(m_front_distance);
+  };
   float get_steering_feedback() {
-    return m_steering_adjustment;
+    return real_to_float(m_steering_adjustment);
   }
   float get_cross_track_error() {
-    return m_cross_track_error;
+    return real_to_float(m_cross_track_error);
   };
+  // the unconverted adjustment for the controllers in systick
+  real_t isr_steering_adjustment() {
+    return m_steering_adjustment;
+  }
+
+  real_t isr_cross_track_error() {
+    return m_cross_track_error;
+  }
+
+  /***
+   * The EDGE_xxx bits for the wall edges found by the last update and a
+   * count that goes up by one for each update that finds any. The sensors
+   * may not be updated on every tick so use the count to see if there are
+   * new edges. Only for use in systick.
+   */
+  uint8_t isr_wall_edges() {
+    return m_wall_edges;
+  }
+
+  uint8_t isr_edge_count() {
+    return m_edge_count;
+  }
 
   //***************************************************************************//
 
@@ -140,17 +191,33 @@ class Sensors {
    * TODO: It is not clear that this belongs here rather tham for example,
    *       in a Robot class.
    */
-  float calculate_steering_adjustment() {
+  real_t calculate_steering_adjustment() {
     // always calculate the adjustment for testing. It may not get used.
-    float pTerm = STEERING_KP * m_cross_track_error;
-    float dTerm = STEERING_KD * (m_cross_track_error - m_last_steering_error);
-    float adjustment = pTerm + dTerm * LOOP_FREQUENCY;
-    adjustment = constrain(adjustment, -STEERING_ADJUST_LIMIT, STEERING_ADJUST_LIMIT);
+    real_t pTerm = scale(m_cross_track_error, m_steering_kp);
+    real_t dTerm = scale(m_cross_track_error - m_last_steering_error, m_steering_kd);
+    real_t adjustment = pTerm + dTerm;
+    adjustment = constrain(adjustment, -STEERING_ADJUST_LIMIT_REAL, STEERING_ADJUST_LIMIT_REAL);
     m_last_steering_error = m_cross_track_error;
     m_steering_adjustment = adjustment;
     return adjustment;
   }
 
+  /***
+   * The gains start out as STEERING_KP and STEERING_KD from the robot
+   * config. The settings change them from the CLI. Returns false, and
+   * changes nothing, if a gain is out of range.
+   */
+  bool set_steering_gains(float kp, float kd) {
+    if (not(gain_fits(kp) && gain_fits(kd * SENSOR_FREQUENCY))) {
+      return false;
+    }
+    ATOMIC {
+      m_steering_kp = to_gain(kp);
+      m_steering_kd = to_gain(kd * SENSOR_FREQUENCY);
+    }
+    return true;
+  }
+
   void set_steering_mode(uint8_t mode) {
     m_last_steering_error = m_cross_track_error;
     m_steering_adjustment = 0;
@@ -166,6 +233,7 @@ class Sensors {
 
   void enable() {
     adc.enable_emitters();
+    m_edges_ready = false;
     m_active = true;
   }
 
@@ -176,9 +244,8 @@ class Sensors {
 
   /***************************************************************************
    * square roots and divisions are pretty slow. Don't call this from systick()
-   * If you really want to use this in the control loop, consider pre-calculating
-   * a table of k/sqrt(i) for some suitable range of i. The table would need to be
-   * stored in flash.
+   * In the control loop, use linear_distance() which gets the same result from
+   * a table of k/sqrt(i) stored in flash.
    */
   float get_distance(float sensor_value, float k) {
     float distance = k / sqrtf(sensor_value);
@@ -227,6 +294,10 @@ class Sensors {
     m_front_sum = lfs.value + rfs.value;
     m_front_diff = lfs.value - rfs.value;
     see_front_wall = m_front_sum > FRONT_THRESHOLD;
+    find_wall_edges();
+
+    // the linearised front sum from the table in flash
+    m_front_distance = linear_distance(m_front_sum, FRONT_LINEAR_CONSTANT);
 
     // calculate the alignment errors - too far left is negative
     int error = 0;
@@ -249,7 +320,7 @@ class Sensors {
     if (m_front_sum > FRONT_WALL_RELIABILITY_LIMIT) {
       error = 0;
     }
-    m_cross_track_error = error;
+    m_cross_track_error = int_to_real(error);
     calculate_steering_adjustment();
   }
 
@@ -313,12 +384,51 @@ class Sensors {
   }
 
  private:
-  float m_last_steering_error = 0;
+  /***
+   * The first update after the sensors are enabled only records which
+   * walls are there. Edges are not flagged while the front sum is over
+   * FRONT_WALL_RELIABILITY_LIMIT because the side readings are upset by
+   * the wall ahead then. The state of each wall is still kept up to date.
+   */
+  void find_wall_edges() {
+    uint8_t edges = side_wall_edge(m_edge_left_wall, lss.value, LEFT_THRESHOLD, EDGE_LEFT_FALLING, EDGE_LEFT_RISING);
+    edges |= side_wall_edge(m_edge_right_wall, rss.value, RIGHT_THRESHOLD, EDGE_RIGHT_FALLING, EDGE_RIGHT_RISING);
+    if (not m_edges_ready || m_front_sum > FRONT_WALL_RELIABILITY_LIMIT) {
+      edges = 0;
+    }
+    m_edges_ready = true;
+    m_wall_edges = edges;
+    if (edges) {
+      m_edge_count++;
+    }
+  }
+
+  static uint8_t side_wall_edge(bool &wall, int value, int threshold, uint8_t falling, uint8_t rising) {
+    if (wall && value < threshold - SENSOR_EDGE_HYSTERESIS) {
+      wall = false;
+      return falling;
+    }
+    if (not wall && value > threshold + SENSOR_EDGE_HYSTERESIS) {
+      wall = true;
+      return rising;
+    }
+    return 0;
+  }
+
+  real_t m_last_steering_error = 0;
+  gain_t m_steering_kp = to_gain(STEERING_KP);
+  gain_t m_steering_kd = to_gain(STEERING_KD * SENSOR_FREQUENCY);  // per sensor update
   volatile bool m_active = false;
-  volatile float m_cross_track_error;
-  volatile float m_steering_adjustment;
+  volatile real_t m_cross_track_error;
+  volatile real_t m_steering_adjustment;
   volatile int m_front_sum;
   volatile int m_front_diff;
+  volatile int m_front_distance;
+  bool m_edge_left_wall = false;
+  bool m_edge_right_wall = false;
+  bool m_edges_ready = false;
+  volatile uint8_t m_wall_edges = 0;
+  volatile uint8_t m_edge_count = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,155 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include "config.h"
+#include "motors.h"
+#include "sensors.h"
+
+/***
+ * The settings are the tuning constants from the robot config that are
+ * kept in RAM so that they can be changed from the CLI while the robot is
+ * running. Each one starts out with the value from the robot config and
+ * goes back to it after a reset.
+ *
+ * Each setting has an index number. The CLI uses that to show and change
+ * them with the $ commands described in documents/cli.md. For example,
+ * '$0=1.5' sets FWD_KP to 1.5. '$$' prints them all as declarations that
+ * can be pasted back into the robot config once they are right.
+ *
+ * The controller gains are copied into the motors and the sensors, and
+ * converted for them, when they change. The mouse reads the speeds from
+ * here when it needs them.
+ *
+ * To add a setting, put it in the struct and in setting_info with the same
+ * name in setting_names.
+ */
+
+enum SettingType : uint8_t {
+  SETTING_FLOAT,
+  SETTING_INT,
+};
+
+struct Settings;
+extern Settings settings;
+
+struct SettingInfo {
+  uint8_t offset;  // in the Settings struct
+  SettingType type;
+};
+
+struct Settings {
+  float fwd_kp = FWD_KP;
+  float fwd_kd = FWD_KD;
+  float rot_kp = ROT_KP;
+  float rot_kd = ROT_KD;
+  float steering_kp = STEERING_KP;
+  float steering_kd = STEERING_KD;
+  int search_speed = SEARCH_SPEED;
+  int search_turn_speed = SEARCH_TURN_SPEED;
+  int search_acceleration = SEARCH_ACCELERATION;
+
+  /// @brief  the value of a setting as a float, whatever its type
+  float get(int index) const;
+
+  /***
+   * Change a setting. Returns false, and changes nothing, if the value
+   * will not work. Gains must fit in the fixed point type and speeds
+   * must be more than zero.
+   */
+  bool set(int index, float value);
+
+  /// @brief  back to the values in the robot config
+  void reset() {
+    *this = Settings();
+    apply();
+  }
+
+  SettingType type(int index) const;
+
+  /// @brief  print the name of a setting as it is in the robot config
+  void print_name(Print &printer, int index) const;
+
+  /// @brief  copy the gains to the code that uses them
+  bool apply() {
+    bool ok = motors.set_controller_gains(fwd_kp, fwd_kd, rot_kp, rot_kd);
+    ok = sensors.set_steering_gains(steering_kp, steering_kd) && ok;
+    return ok;
+  }
+};
+
+const SettingInfo setting_info[] PROGMEM = {
+    {offsetof(Settings, fwd_kp), SETTING_FLOAT},             // 0
+    {offsetof(Settings, fwd_kd), SETTING_FLOAT},             // 1
+    {offsetof(Settings, rot_kp), SETTING_FLOAT},             // 2
+    {offsetof(Settings, rot_kd), SETTING_FLOAT},             // 3
+    {offsetof(Settings, steering_kp), SETTING_FLOAT},        // 4
+    {offsetof(Settings, steering_kd), SETTING_FLOAT},        // 5
+    {offsetof(Settings, search_speed), SETTING_INT},         // 6
+    {offsetof(Settings, search_turn_speed), SETTING_INT},    // 7
+    {offsetof(Settings, search_acceleration), SETTING_INT},  // 8
+};
+
+// in the same order, separated by spaces
+const char setting_names[] PROGMEM =
+    "FWD_KP FWD_KD ROT_KP ROT_KD STEERING_KP STEERING_KD SEARCH_SPEED SEARCH_TURN_SPEED SEARCH_ACCELERATION";
+
+const int SETTING_COUNT = sizeof(setting_info) / sizeof(setting_info[0]);
+
+inline SettingType Settings::type(int index) const {
+  return SettingType(pgm_read_byte_near(&setting_info[index].type));
+}
+
+inline float Settings::get(int index) const {
+  const uint8_t *field = (const uint8_t *)this + pgm_read_byte_near(&setting_info[index].offset);
+  if (type(index) == SETTING_FLOAT) {
+    return *(const float *)field;
+  }
+  return *(const int *)field;
+}
+
+inline bool Settings::set(int index, float value) {
+  uint8_t *field = (uint8_t *)this + pgm_read_byte_near(&setting_info[index].offset);
+  if (type(index) == SETTING_INT) {
+    if (value < 1 || value > 32767) {
+      return false;
+    }
+    *(int *)field = int(value);
+    return true;
+  }
+  float old_value = *(float *)field;
+  *(float *)field = value;
+  if (not apply()) {
+    *(float *)field = old_value;
+    apply();
+    return false;
+  }
+  return true;
+}
+
+inline void Settings::print_name(Print &printer, int index) const {
+  const char *p = setting_names;
+  for (int i = 0; i < index; i++) {
+    while (pgm_read_byte_near(p++) != ' ') {
+      // skip a name
+    }
+  }
+  char c;
+  while ((c = pgm_read_byte_near(p++)) != ' ' && c != 0) {
+    printer.print(c);
+  }
+}
+
+#endif
@@ -0,0 +1,360 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "maze.h"
+
+/***
+ * Storage keeps a copy of the maze walls in the EEPROM so that the map
+ * survives a power cycle as well as a reset.
+ *
+ * Only the walls are saved. Each cell needs its north and east wall, two
+ * bits each, so a 16x16 maze packs into 128 bytes. The costs come from a
+ * fresh flood when the maze is loaded. A record is:
+ *
+ *   version | sequence | crc (2 bytes) | walls ...
+ *
+ * The crc is CRC-16/CCITT of the sequence, the maze size and the walls.
+ * A record with the wrong version or a bad crc is ignored so a record that
+ * was half written when the power went, or one for a different maze size,
+ * cannot be loaded.
+ *
+ * The EEPROM is good for about 100,000 writes to each byte. To spread the
+ * wear, there are STORAGE_SLOTS places for a record. Each save, and the
+ * first change to the walls after a load, goes into the next slot with a
+ * sequence number one more than the last, and a load takes the newest good
+ * record. Only bytes that differ from what is already
+ * there are written.
+ *
+ * Once the maze has been saved or loaded, systick keeps the record up to
+ * date. Whenever the walls change it makes a pass through the record,
+ * comparing STORAGE_BYTES_PER_TICK bytes each tick with the map and
+ * starting a write for the first one that is different. An EEPROM write
+ * takes 3.4ms and runs by itself so systick never waits for one. It just
+ * does nothing until the write is done. When a pass gets to the end without
+ * writing anything and without the maze changing, the header is written
+ * with the new crc. A search changes at most three walls in each cell so
+ * the record is up to date a few ticks after the robot enters the cell.
+ *
+ * Use the SAVE, LOAD and REFLOOD commands from the CLI. With the default
+ * STORAGE_LOAD_AT_START, the newest record is loaded at power up.
+ *
+ * Anything that clears the maze must call stop() first or the empty maze
+ * would be saved over the last record. Use SAVE to start saving again.
+ */
+
+#ifndef STORAGE_ADDRESS
+#define STORAGE_ADDRESS 0  // where the first slot starts
+#endif
+
+#ifndef STORAGE_BYTES_PER_TICK
+#define STORAGE_BYTES_PER_TICK 8  // most bytes compared in one systick
+#endif
+
+#ifndef STORAGE_LOAD_AT_START
+#define STORAGE_LOAD_AT_START 1
+#endif
+
+#ifndef E2END
+#define E2END 0x3FF  // the last EEPROM address on an ATmega328
+#endif
+
+const uint8_t STORAGE_VERSION = 1;  // change this if the record changes
+const int STORAGE_HEADER_SIZE = 4;
+const int STORAGE_DATA_SIZE = (MAZE_CELL_COUNT + 1) / 2;
+const int STORAGE_SLOT_SIZE = STORAGE_HEADER_SIZE + STORAGE_DATA_SIZE;
+
+// as many slots as will fit, up to four
+#ifndef STORAGE_SLOTS
+#define STORAGE_SLOTS ((E2END + 1 - STORAGE_ADDRESS) / STORAGE_SLOT_SIZE < 4 ? (E2END + 1 - STORAGE_ADDRESS) / STORAGE_SLOT_SIZE : 4)
+#endif
+
+static_assert(STORAGE_SLOTS >= 1, "There is not room in the EEPROM for the maze");
+static_assert(STORAGE_ADDRESS + STORAGE_SLOTS * STORAGE_SLOT_SIZE <= E2END + 1, "STORAGE_SLOTS will not fit in the EEPROM");
+
+// CRC-16/CCITT with polynomial 0x1021, one nibble at a time
+// clang-format off
+const uint16_t storage_crc_table[16] PROGMEM = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+// clang-format on
+
+inline uint16_t storage_crc_update(uint16_t crc, uint8_t data) {
+  crc ^= (uint16_t)data << 8;
+  crc = (crc << 4) ^ pgm_read_word_near(storage_crc_table + (crc >> 12));
+  crc = (crc << 4) ^ pgm_read_word_near(storage_crc_table + (crc >> 12));
+  return crc;
+}
+
+class Storage;
+extern Storage storage;
+
+class Storage {
+ public:
+  /***
+   * Load the newest good record into the maze and flood it for the goal.
+   * From then on, systick keeps the maze saved. The first change to the
+   * walls starts a new record in the next slot so that the one just loaded
+   * is not worn out by every power up. Returns false, and leaves the maze
+   * alone, if there is no good record.
+   */
+  bool load() {
+    stop();
+    uint8_t sequence = 0;
+    int slot = find_newest(sequence);
+    if (slot < 0) {
+      return false;
+    }
+    uint16_t address = data_address(slot);
+    for (int i = 0; i < STORAGE_DATA_SIZE; i++) {
+      uint8_t value = eeprom_read(address + i);
+      restore_cell(2 * i, value & 0x0F);
+      restore_cell(2 * i + 1, value >> 4);
+    }
+    maze.flood(maze.goal());
+    // nothing is written until the walls change
+    start_tracking((slot + 1) % STORAGE_SLOTS, sequence + 1, maze.wall_version());
+    return true;
+  }
+
+  /***
+   * Start a new record of the maze in the next slot. Systick writes it in
+   * the background and keeps it up to date after that. Use busy() to see
+   * when it is done.
+   */
+  void save() {
+    stop();
+    uint8_t sequence = 0;
+    int slot = find_newest(sequence);
+    // the walls are never at an odd version here so this is not saved yet
+    start_tracking((slot + 1) % STORAGE_SLOTS, sequence + 1, maze.wall_version() + 2);
+  }
+
+  /// @brief  stop keeping the record up to date. Any write already started will finish
+  void stop() {
+    m_tracking = false;
+    while (eeprom_busy()) {
+      // wait
+    }
+  }
+
+  /// @brief  true while the record does not yet match the maze
+  bool busy() const {
+    bool result;
+    ATOMIC {
+      result = m_tracking && (m_index != IDLE || maze.wall_version() != m_saved_version);
+    }
+    return result;
+  }
+
+  /// @brief  the slot in use, or -1 if the maze is not being saved
+  int slot() const {
+    return m_tracking ? m_slot : -1;
+  }
+
+  /***
+   * Called by systick. Does nothing unless a write could be started and
+   * the walls are not part way through changing.
+   */
+  void update() {
+    if (not m_tracking || eeprom_busy()) {
+      return;
+    }
+    uint8_t version = maze.wall_version();
+    if (version & 1) {
+      return;
+    }
+    if (m_index == IDLE) {
+      if (version == m_saved_version) {
+        return;
+      }
+      start_pass(version);
+    }
+    for (int n = 0; n < STORAGE_BYTES_PER_TICK; n++) {
+      if (m_index == STORAGE_DATA_SIZE) {
+        finish_pass(version);
+        return;
+      }
+      uint8_t value = packed_cells(m_index);
+      m_crc = storage_crc_update(m_crc, value);
+      uint16_t address = data_address(m_slot) + m_index;
+      m_index++;
+      if (eeprom_read(address) != value) {
+        eeprom_start_write(address, value);
+        m_pass_wrote = true;
+        return;
+      }
+    }
+  }
+
+ private:
+  static const int IDLE = -1;
+
+  void start_tracking(int slot, uint8_t sequence, uint8_t saved_version) {
+    ATOMIC {
+      m_slot = slot;
+      m_sequence = sequence;
+      m_saved_version = saved_version;
+      m_index = IDLE;
+      m_tracking = true;
+    }
+  }
+
+  void start_pass(uint8_t version) {
+    m_index = 0;
+    m_pass_version = version;
+    m_pass_wrote = false;
+    m_crc = record_crc_start(m_sequence);
+  }
+
+  /***
+   * The data only matches the crc if nothing was written and nothing
+   * changed during the pass. Then the header bytes are checked, and one is
+   * written, on each tick until they are all right.
+   */
+  void finish_pass(uint8_t version) {
+    if (m_pass_wrote || version != m_pass_version) {
+      start_pass(version);
+      return;
+    }
+    uint8_t header[STORAGE_HEADER_SIZE] = {STORAGE_VERSION, m_sequence, uint8_t(m_crc), uint8_t(m_crc >> 8)};
+    uint16_t address = slot_address(m_slot);
+    for (int i = 0; i < STORAGE_HEADER_SIZE; i++) {
+      if (eeprom_read(address + i) != header[i]) {
+        eeprom_start_write(address + i, header[i]);
+        return;
+      }
+    }
+    m_saved_version = m_pass_version;
+    m_index = IDLE;
+  }
+
+  /***
+   * The slot with a good record and the highest sequence number. The
+   * sequence number wraps around so it is the difference that counts.
+   * Returns -1 if there is no good record.
+   */
+  int find_newest(uint8_t &sequence) {
+    int newest = -1;
+    for (int slot = 0; slot < STORAGE_SLOTS; slot++) {
+      uint8_t this_sequence;
+      if (not slot_is_good(slot, this_sequence)) {
+        continue;
+      }
+      if (newest < 0 || int8_t(this_sequence - sequence) > 0) {
+        newest = slot;
+        sequence = this_sequence;
+      }
+    }
+    return newest;
+  }
+
+  bool slot_is_good(int slot, uint8_t &sequence) {
+    uint16_t address = slot_address(slot);
+    if (eeprom_read(address) != STORAGE_VERSION) {
+      return false;
+    }
+    sequence = eeprom_read(address + 1);
+    uint16_t crc = eeprom_read(address + 2) | (uint16_t)eeprom_read(address + 3) << 8;
+    uint16_t check = record_crc_start(sequence);
+    address = data_address(slot);
+    for (int i = 0; i < STORAGE_DATA_SIZE; i++) {
+      check = storage_crc_update(check, eeprom_read(address + i));
+    }
+    return check == crc;
+  }
+
+  static uint16_t record_crc_start(uint8_t sequence) {
+    uint16_t crc = storage_crc_update(0xFFFF, sequence);
+    crc = storage_crc_update(crc, MAZE_WIDTH);
+    return storage_crc_update(crc, MAZE_HEIGHT);
+  }
+
+  static uint16_t slot_address(int slot) {
+    return STORAGE_ADDRESS + slot * STORAGE_SLOT_SIZE;
+  }
+
+  static uint16_t data_address(int slot) {
+    return slot_address(slot) + STORAGE_HEADER_SIZE;
+  }
+
+  // cells are in the same order as the maze index, x * MAZE_HEIGHT + y
+  static Location cell_at(int index) {
+    return Location(index / MAZE_HEIGHT, index % MAZE_HEIGHT);
+  }
+
+  /// @brief  two cells to a byte, four bits each: north | east << 2
+  static uint8_t packed_cells(int i) {
+    uint8_t value = cell_bits(cell_at(2 * i));
+    if (2 * i + 1 < MAZE_CELL_COUNT) {
+      value |= cell_bits(cell_at(2 * i + 1)) << 4;
+    }
+    return value;
+  }
+
+  static uint8_t cell_bits(const Location cell) {
+    return maze.wall_state(cell, NORTH) | maze.wall_state(cell, EAST) << 2;
+  }
+
+  static void restore_cell(int index, uint8_t bits) {
+    if (index >= MAZE_CELL_COUNT) {
+      return;
+    }
+    Location cell = cell_at(index);
+    maze.restore_wall_state(cell, NORTH, WallState(bits & 0x03));
+    maze.restore_wall_state(cell, EAST, WallState((bits >> 2) & 0x03));
+  }
+
+  /*** The EEPROM registers. See the ATmega328 datasheet ***/
+
+  static bool eeprom_busy() {
+    return (EECR & _BV(EEPE)) != 0;
+  }
+
+  static uint8_t eeprom_read(uint16_t address) {
+    while (eeprom_busy()) {
+      // wait for a write to finish
+    }
+    EEAR = address;
+    EECR |= _BV(EERE);
+    return EEDR;
+  }
+
+  /***
+   * Start an erase and write of one byte. Check that the EEPROM is not busy
+   * first. EEPE must be set within four cycles of EEMPE so nothing can be
+   * allowed to interrupt.
+   */
+  static void eeprom_start_write(uint16_t address, uint8_t value) {
+    EEAR = address;
+    EEDR = value;
+    ATOMIC {
+      EECR |= _BV(EEMPE);
+      EECR |= _BV(EEPE);
+    }
+  }
+
+  volatile bool m_tracking = false;
+  int m_slot = 0;
+  uint8_t m_sequence = 0;
+  int m_index = IDLE;  // the next data byte in the pass
+  uint16_t m_crc = 0;
+  bool m_pass_wrote = false;
+  uint8_t m_pass_version = 0;
+  uint8_t m_saved_version = 0;  // the wall version that is in the EEPROM
+};
+
+#endif
@@ -16,10 +16,103 @@
 #include "config.h"
 #include "motion.h"
 #include "motors.h"
+#include "receiver.h"
+#include "recorder.h"
 #include "sensors.h"
+#include "storage.h"
 #include "switches.h"
+#include "telemetry.h"
+
+/***
+ * The systick can time each stage of its work using the timer 2 counter.
+ * That adds only a few microseconds to each tick. Use the TIMING command
+ * in the CLI to see the results. Set this to zero to remove the code.
+ */
+#ifndef SYSTICK_TIMING
+#define SYSTICK_TIMING 1
+#endif
+
+/***
+ * Timing statistics for one stage of the systick. Times are in timer 2
+ * counts of Systick::US_PER_COUNT microseconds each. The mean is the total
+ * divided by the number of ticks.
+ */
+struct StageTime {
+  uint8_t min_time;
+  uint8_t max_time;
+  uint32_t total;
+
+  void reset() {
+    min_time = 255;
+    max_time = 0;
+    total = 0;
+  }
+
+  void add(uint8_t time) {
+    if (time < min_time) {
+      min_time = time;
+    }
+    if (time > max_time) {
+      max_time = time;
+    }
+    total += time;
+  }
+};
+
+/***
+ * A task that runs only once every few calls to due(). The divisors come
+ * from the robot config file.
+ */
+class TaskRate {
+ public:
+  explicit TaskRate(uint8_t divisor) : m_divisor(divisor), m_count(0){};
+
+  bool due() {
+    if (m_count == 0) {
+      m_count = m_divisor - 1;
+      return true;
+    }
+    m_count--;
+    return false;
+  }
+
+  void reset() {
+    m_count = 0;
+  }
+
+ private:
+  uint8_t m_divisor;
+  uint8_t m_count;
+};
+
 class Systick {
  public:
+  // 2kHz needs the faster clock to get a whole number of counts per tick
+  enum {
+    TIMER_PRESCALE = (SYSTICK_FREQUENCY > 1000) ? 64 : 128,
+    TIMER_COUNTS = 16000000L / TIMER_PRESCALE / SYSTICK_FREQUENCY,  // timer 2 counts in each tick
+    US_PER_COUNT = TIMER_PRESCALE / 16,                              // 8us at 128, 4us at 64
+  };
+  static_assert(TIMER_COUNTS <= 256 && 16000000L % (long(TIMER_PRESCALE) * SYSTICK_FREQUENCY) == 0,
+                "SYSTICK_FREQUENCY must be 500, 1000 or 2000");
+  static_assert(SYSTICK_FREQUENCY / SENSOR_DIVISOR <= 1000, "the sensors cannot run faster than 1kHz");
+  static_assert(BATTERY_DIVISOR % SENSOR_DIVISOR == 0, "BATTERY_DIVISOR must be a multiple of SENSOR_DIVISOR");
+
+  // the battery is only read on sensor ticks so it counts those
+  Systick() : m_sensor_task(SENSOR_DIVISOR), m_battery_task(BATTERY_DIVISOR / SENSOR_DIVISOR){};
+
+  // The jitter is the delay from the timer firing to the start of update()
+  enum Stage {
+    STAGE_ENCODERS,
+    STAGE_MOTION,
+    STAGE_SENSORS,
+    STAGE_BATTERY,
+    STAGE_CONTROLLERS,
+    STAGE_TOTAL,
+    STAGE_JITTER,
+    STAGE_COUNT,
+  };
+
   // don't let this start firing up before we are ready.
   // call the begin method explicitly.
   void begin() {
@@ -27,11 +120,18 @@ class Systick {
     bitClear(TCCR2B, WGM22);
     bitClear(TCCR2A, WGM20);
     bitSet(TCCR2A, WGM21);
-    // set divisor to 128 => 125kHz
+    // set divisor to 128 => 125kHz or 64 => 250kHz
     bitSet(TCCR2B, CS22);
     bitClear(TCCR2B, CS21);
-    bitSet(TCCR2B, CS20);
-    OCR2A = 249;  // (16000000/128/500)-1 => 500Hz
+    if (TIMER_PRESCALE == 128) {
+      bitSet(TCCR2B, CS20);
+    } else {
+      bitClear(TCCR2B, CS20);
+    }
+    OCR2A = TIMER_COUNTS - 1;  // (16000000/128/500)-1 => 500Hz
+    m_sensor_task.reset();
+    m_battery_task.reset();
+    reset_timing();
     bitSet(TIMSK2, OCIE2A);
     delay(40);  // make sure it runs for a few cycles before we continue
   }
@@ -41,6 +141,13 @@ class Systick {
    *
    * All the time-critical control functions happen in here.
    *
+   * The encoders, profiles and controllers run on every tick. The sensors
+   * and battery only run once every SENSOR_DIVISOR and BATTERY_DIVISOR
+   * ticks. Then the ADC cycle can take longer than a tick and the faster
+   * control loop is not held back by it. The steering adjustment is only
+   * passed to the controllers on the tick when it is calculated so that the
+   * steering response does not change with the systick frequency.
+   *
    * interrupts are enabled at the start of the ISR so that encoder
    * counts are not lost.
    *
@@ -59,21 +166,108 @@ class Systick {
    * Most of the load is due to that overhead. While the profile generates actual
    * motion, there is an additional load.
    *
-   *
+   * Those figures were measured by hand. With SYSTICK_TIMING enabled, the
+   * time taken by each stage is recorded on every tick.
    */
   void update() {
-    // digitalWriteFast(LED_BUILTIN, 1);
     // NOTE - the code here seems to get inlined and so the function is 2800 bytes!
+    uint8_t start = start_timing();
+    uint8_t mark = start;
     // grab the encoder values first because they will continue to change
     encoders.update();
+#if USE_ESTIMATOR
+    estimator.update(motors.isr_left_motor_volts(), motors.isr_right_motor_volts());
+#endif
+    mark = lap(STAGE_ENCODERS, mark);
     motion.update();
-    sensors.update();
-    battery.update();
+    mark = lap(STAGE_MOTION, mark);
+    real_t steering_adjustment = 0;
+    bool sensors_due = m_sensor_task.due();
+    if (sensors_due) {
+      sensors.update();
+      steering_adjustment = sensors.isr_steering_adjustment();
+      mark = lap(STAGE_SENSORS, mark);
+      if (m_battery_task.due()) {
+        battery.update();
+        mark = lap(STAGE_BATTERY, mark);
+      }
+    }
 
-    motors.update_controllers(motion.velocity(), motion.omega(), sensors.get_steering_feedback());
-    adc.start_conversion_cycle();
+    motors.update_controllers(motion.isr_velocity(), motion.isr_omega(), steering_adjustment);
+    lap(STAGE_CONTROLLERS, mark);
+    receiver.update();
+    telemetry.update();
+    recorder.update();
+    storage.update();
+    lap(STAGE_TOTAL, start);
+    if (sensors_due) {
+      adc.start_conversion_cycle();
+    }
     // NOTE: no code should follow this line;
   }
+
+  void reset_timing() {
+#if SYSTICK_TIMING
+    ATOMIC {
+      for (int i = 0; i < STAGE_COUNT; i++) {
+        m_timing[i].reset();
+      }
+      m_timed_ticks = 0;
+    }
+#endif
+  }
+
+  /***
+   * Take a consistent copy of the stage timing. The stats array must have
+   * STAGE_COUNT entries. Returns the number of ticks that were timed.
+   */
+  uint32_t get_timing(StageTime *stats) {
+    uint32_t ticks = 0;
+#if SYSTICK_TIMING
+    ATOMIC {
+      for (int i = 0; i < STAGE_COUNT; i++) {
+        stats[i] = m_timing[i];
+      }
+      ticks = m_timed_ticks;
+    }
+#else
+    (void)stats;
+#endif
+    return ticks;
+  }
+
+ private:
+  // the counter is reset to zero when the timer fires so it is the jitter
+  uint8_t start_timing() {
+#if SYSTICK_TIMING
+    uint8_t now = TCNT2;
+    m_timing[STAGE_JITTER].add(now);
+    m_timed_ticks++;
+    return now;
+#else
+    return 0;
+#endif
+  }
+
+  // record the time since the last mark and return a new mark
+  uint8_t lap(Stage stage, uint8_t since) {
+#if SYSTICK_TIMING
+    uint8_t now = TCNT2;
+    uint8_t time = (now >= since) ? now - since : now + TIMER_COUNTS - since;
+    m_timing[stage].add(time);
+    return now;
+#else
+    (void)stage;
+    return since;
+#endif
+  }
+
+  TaskRate m_sensor_task;
+  TaskRate m_battery_task;
+#if SYSTICK_TIMING
+  StageTime m_timing[STAGE_COUNT];
+  uint32_t m_timed_ticks = 0;
+#endif
 };
 
 extern Systick systick;
@@ -0,0 +1,275 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "encoders.h"
+#include "motion.h"
+#include "motors.h"
+#include "sensors.h"
+
+/***
+ * The text reports are easy to read but every field is formatted in the main
+ * loop and, once the 64 byte Serial buffer is full, each print waits for the
+ * UART. During a run that upsets the timing of everything else.
+ *
+ * Telemetry sends the same data as small binary records instead. Each record
+ * is captured in systick, or when the mouse logs an action, and goes into a
+ * ring buffer. Systick then passes on only as many bytes as the Serial
+ * buffer has room for. The HardwareSerial transmit interrupt does the rest
+ * so nothing ever waits for the UART. If the ring buffer is full, the whole
+ * record is dropped and the gap in the sequence numbers shows where.
+ *
+ * Each record is:
+ *
+ *   0xA5 | type | sequence | payload ... | crc
+ *
+ * The payload is a fixed size for each type and is made of little-endian
+ * 16 bit values. The crc is CRC-8 (polynomial 0x07) of everything after the
+ * 0xA5. The program in tools/telemetry turns a capture back into the same
+ * columns as the text reports.
+ *
+ * While telemetry is streaming, nothing else may write to Serial because
+ * systick is writing to it as well. The mouse does not print per-cell
+ * text while it is streaming and log_action_status() sends an action
+ * record instead.
+ *
+ * At 115200 baud, the UART can carry about 11500 bytes per second. A
+ * profile record is 22 bytes so a profile every tick at 500Hz just fits.
+ * Use TELEMETRY_DIVISOR to send one every few ticks if the link is slower.
+ *
+ * The ring buffer only has to smooth things out in front of the 64 byte
+ * Serial buffer so the default of 64 bytes is enough for a couple of records.
+ */
+
+#ifndef TELEMETRY_BUFFER_SIZE
+#define TELEMETRY_BUFFER_SIZE 64  // must be a power of two, 256 or less
+#endif
+
+#ifndef TELEMETRY_DIVISOR
+#define TELEMETRY_DIVISOR 1  // systick ticks per record
+#endif
+
+static_assert((TELEMETRY_BUFFER_SIZE & (TELEMETRY_BUFFER_SIZE - 1)) == 0, "TELEMETRY_BUFFER_SIZE must be a power of two");
+static_assert(TELEMETRY_BUFFER_SIZE <= 256, "TELEMETRY_BUFFER_SIZE must be 256 or less");
+
+enum TelemetryType : uint8_t {
+  TLM_NONE = 0,
+  TLM_PROFILE = 1,       // time robotPos robotAngle fwdPos fwdSpeed rotPos rotSpeed fwdmVolts rotmVolts
+  TLM_SENSOR_TRACK = 2,  // time pos angle lfs lss rss rfs cte*100 steer*100
+  TLM_ACTION = 3,        // action note x y heading frontSum position
+};
+
+const uint8_t TELEMETRY_SYNC = 0xA5;
+const uint8_t TELEMETRY_MAX_RECORD = 24;
+
+// CRC-8 with polynomial 0x07, one nibble at a time
+// clang-format off
+const uint8_t telemetry_crc_table[16] PROGMEM = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+};
+// clang-format on
+
+inline uint8_t telemetry_crc_update(uint8_t crc, uint8_t data) {
+  crc ^= data;
+  crc = (crc << 4) ^ pgm_read_byte_near(telemetry_crc_table + (crc >> 4));
+  crc = (crc << 4) ^ pgm_read_byte_near(telemetry_crc_table + (crc >> 4));
+  return crc;
+}
+
+class Telemetry;
+extern Telemetry telemetry;
+
+class Telemetry {
+ public:
+  /***
+   * Choose the record that systick will send during a run. TLM_NONE
+   * leaves all the reporting as text. Set from the CLI.
+   */
+  void set_mode(TelemetryType mode) {
+    m_mode = mode;
+  }
+
+  TelemetryType mode() const {
+    return m_mode;
+  }
+
+  bool streaming() const {
+    return m_streaming;
+  }
+
+  /// @brief  start streaming if a mode has been chosen
+  void start() {
+    if (m_mode == TLM_NONE) {
+      return;
+    }
+    Serial.flush();  // make sure no text is still going out
+    ATOMIC {
+      m_head = 0;
+      m_tail = 0;
+      m_sequence = 0;
+      m_dropped = 0;
+      m_tick = 0;
+      m_start_time = millis();
+      m_streaming = true;
+    }
+  }
+
+  /// @brief  stop making records and wait for the buffer to empty
+  void stop() {
+    if (not m_streaming) {
+      return;
+    }
+    m_capturing = false;
+    while (m_head != m_tail) {
+      delay(1);
+    }
+    m_streaming = false;
+    m_capturing = true;
+    Serial.flush();
+  }
+
+  uint16_t dropped() const {
+    return m_dropped;
+  }
+
+  /***
+   * Note: Runs from the systick interrupt. DO NOT call this directly.
+   */
+  void update() {
+    if (not m_streaming) {
+      return;
+    }
+    if (m_capturing && ++m_tick >= TELEMETRY_DIVISOR) {
+      m_tick = 0;
+      if (m_mode == TLM_PROFILE) {
+        capture_profile();
+      } else if (m_mode == TLM_SENSOR_TRACK) {
+        capture_sensor_track();
+      }
+    }
+    int room = Serial.availableForWrite();
+    while (room > 0 && m_tail != m_head) {
+      Serial.write(m_buffer[m_tail++ & MASK]);
+      room--;
+    }
+  }
+
+  /// the binary version of Reporter::log_action_status()
+  void log_action(char action, char note, uint8_t x, uint8_t y, uint8_t heading, int front_sum, int position) {
+    Record record(TLM_ACTION);
+    record.add_byte(action);
+    record.add_byte(note);
+    record.add_byte(x);
+    record.add_byte(y);
+    record.add_byte(heading);
+    record.add_int(front_sum);
+    record.add_int(position);
+    ATOMIC {
+      push(record);
+    }
+  }
+
+ private:
+  enum { MASK = TELEMETRY_BUFFER_SIZE - 1 };
+
+  /***
+   * Records are put together on the stack and only copied into the ring
+   * buffer when they are complete.
+   */
+  struct Record {
+    uint8_t length = 0;
+    uint8_t data[TELEMETRY_MAX_RECORD];
+
+    explicit Record(uint8_t type) {
+      add_byte(TELEMETRY_SYNC);
+      add_byte(type);
+      add_byte(0);  // the sequence number is filled in by push()
+    }
+
+    void add_byte(uint8_t value) {
+      data[length++] = value;
+    }
+
+    void add_int(int16_t value) {
+      add_byte(value & 0xFF);
+      add_byte((value >> 8) & 0xFF);
+    }
+  };
+
+  /***
+   * The captures run in systick so they use the unguarded isr_xxx() values
+   * and convert them straight to integers, just as the recorder does.
+   */
+  void capture_profile() {
+    real_t left_volts = motors.isr_left_motor_volts();
+    real_t right_volts = motors.isr_right_motor_volts();
+    Record record(TLM_PROFILE);
+    record.add_int(millis() - m_start_time);
+    record.add_int(encoders.isr_robot_distance());
+    record.add_int(encoders.isr_robot_angle());
+    record.add_int(real_to_int(motion.isr_position()));
+    record.add_int(real_to_int(motion.isr_velocity()));
+    record.add_int(real_to_int(motion.isr_angle()));
+    record.add_int(real_to_int(motion.isr_omega()));
+    record.add_int(real_to_int(1000 * (right_volts + left_volts)));
+    record.add_int(real_to_int(1000 * (right_volts - left_volts)));
+    push(record);
+  }
+
+  void capture_sensor_track() {
+    Record record(TLM_SENSOR_TRACK);
+    record.add_int(millis() - m_start_time);
+    record.add_int(encoders.isr_robot_distance());
+    record.add_int(encoders.isr_robot_angle());
+    record.add_int(sensors.lfs.value);
+    record.add_int(sensors.lss.value);
+    record.add_int(sensors.rss.value);
+    record.add_int(sensors.rfs.value);
+    record.add_int(real_to_int(100 * sensors.isr_cross_track_error()));
+    record.add_int(real_to_int(100 * sensors.isr_steering_adjustment()));
+    push(record);
+  }
+
+  /// copy a record and its crc into the ring buffer if there is room
+  void push(Record &record) {
+    uint8_t used = m_head - m_tail;
+    record.data[2] = m_sequence++;
+    if (record.length + 1 > TELEMETRY_BUFFER_SIZE - used) {
+      m_dropped++;
+      return;
+    }
+    uint8_t crc = 0;
+    m_buffer[m_head++ & MASK] = record.data[0];
+    for (uint8_t i = 1; i < record.length; i++) {
+      crc = telemetry_crc_update(crc, record.data[i]);
+      m_buffer[m_head++ & MASK] = record.data[i];
+    }
+    m_buffer[m_head++ & MASK] = crc;
+  }
+
+  volatile uint8_t m_buffer[TELEMETRY_BUFFER_SIZE];
+  volatile uint8_t m_head = 0;
+  volatile uint8_t m_tail = 0;
+  uint8_t m_sequence = 0;
+  uint16_t m_dropped = 0;
+  uint8_t m_tick = 0;
+  uint32_t m_start_time = 0;
+  TelemetryType m_mode = TLM_NONE;
+  volatile bool m_streaming = false;
+  volatile bool m_capturing = true;
+};
+
+#endif
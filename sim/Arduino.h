@@ -0,0 +1,309 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+/***
+ * Just enough of the Arduino API, and of the ATmega328 registers, for the
+ * robot code to build and run on a PC.
+ *
+ * Nothing here knows anything about the robot. The functions and registers
+ * are only declared here. They are defined in board.h where the simulated
+ * hardware behind them lives.
+ *
+ * Time in the simulator is virtual. It only moves on when the robot code
+ * calls delay(), millis() or micros(), or enters an ATOMIC block. Every
+ * busy-wait loop in the robot code does one of those so the systick and
+ * the rest of the hardware get to run just as they would on the robot.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PI 3.1415926535897932384626433832795
+#define HEX 16
+#define DEC 10
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define DEFAULT 1
+
+#define LED_BUILTIN 13
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define bit(b) (1UL << (b))
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define _BV(bit) (1 << (bit))
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+/*** Flash memory is just memory ***/
+#define PROGMEM
+#define PSTR(s) (s)
+inline uint8_t pgm_read_byte(const void *a) {
+  return *(const uint8_t *)a;
+}
+inline uint16_t pgm_read_word(const void *a) {
+  uint16_t w;
+  memcpy(&w, a, sizeof(w));  // the low half of an int on a little endian PC
+  return w;
+}
+#define pgm_read_byte_near(a) pgm_read_byte(a)
+#define pgm_read_word_near(a) pgm_read_word(a)
+
+/*** Interrupts ***/
+#define ISR_NOBLOCK
+#define ISR(vector, ...) void vector(void)
+#define ADC_vect sim_adc_vect
+#define TIMER2_COMPA_vect sim_timer2_compa_vect
+void ADC_vect(void);
+void TIMER2_COMPA_vect(void);
+#define cli() ((void)0)
+#define sei() ((void)0)
+#define noInterrupts() ((void)0)
+#define interrupts() ((void)0)
+#define digitalPinToInterrupt(p) (p)
+
+/***
+ * An ATOMIC block gives the simulated hardware a chance to run. The robot
+ * config only defines ATOMIC for the AVR and leaves it alone if it is
+ * already defined.
+ */
+void sim_poll();
+
+/// @brief  the host clock in nanoseconds, for timing the robot code itself
+uint32_t sim_host_ns();
+
+struct SimAtomic {
+  bool done = false;
+  SimAtomic() {
+    sim_poll();
+  }
+  bool once() {
+    bool first = not done;
+    done = true;
+    return first;
+  }
+};
+#define ATOMIC for (SimAtomic sim_atomic; sim_atomic.once();)
+
+/***
+ * Most registers are just memory. The ADC control register tells the
+ * board when a conversion is started and the EEPROM control register
+ * tells it when to read or write a byte.
+ */
+struct SimRegister {
+  uint8_t value = 0;
+  void (*on_write)(uint8_t old_value, uint8_t new_value) = nullptr;
+
+  operator uint8_t() const {
+    return value;
+  }
+  SimRegister &operator=(unsigned long x) {
+    uint8_t old_value = value;
+    value = uint8_t(x);
+    if (on_write) {
+      on_write(old_value, value);
+    }
+    return *this;
+  }
+  SimRegister &operator|=(unsigned long x) {
+    return *this = value | x;
+  }
+  SimRegister &operator&=(unsigned long x) {
+    return *this = value & x;
+  }
+};
+
+extern volatile uint8_t TCCR1B, TCCR2A, TCCR2B, OCR2A, TIMSK2, TCNT2, TIFR2;
+extern volatile uint8_t ADMUX;
+extern SimRegister ADCSRA;
+extern volatile uint16_t ADC;
+extern volatile uint8_t UCSR0B, UDR0, EEDR;
+extern SimRegister EECR;
+extern volatile uint16_t EEAR;
+#define E2END 0x3FF
+
+enum {
+  WGM20 = 0,
+  WGM21 = 1,
+  WGM22 = 3,
+  CS20 = 0,
+  CS21 = 1,
+  CS22 = 2,
+  CS10 = 0,
+  CS11 = 1,
+  OCIE2A = 1,
+  OCF2A = 1,
+  ADPS0 = 0,
+  ADPS1 = 1,
+  ADPS2 = 2,
+  ADIE = 3,
+  ADIF = 4,
+  ADATE = 5,
+  ADSC = 6,
+  ADEN = 7,
+  UDRIE0 = 5,
+  EERE = 0,
+  EEPE = 1,
+  EEMPE = 2,
+};
+
+/*** Pins and time ***/
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+uint32_t millis();
+uint32_t micros();
+
+inline bool isPrintable(int c) {
+  return isprint(c);
+}
+
+/*** printf() already goes to stdout so there is nothing to redirect ***/
+#define _FDEV_SETUP_WRITE 0
+#define fdev_setup_stream(stream, put, get, rwflag) ((void)(stream), (void)(put))
+
+/*** Serial output goes to stdout ***/
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+class Print {
+ public:
+  virtual ~Print() {
+  }
+  virtual size_t write(uint8_t c) = 0;
+
+  size_t write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      write(buffer[i]);
+    }
+    return size;
+  }
+  size_t write(const char *s) {
+    return write((const uint8_t *)s, strlen(s));
+  }
+
+  size_t print(const __FlashStringHelper *s) {
+    return write(reinterpret_cast<const char *>(s));
+  }
+  size_t print(const char *s) {
+    return write(s);
+  }
+  size_t print(char c) {
+    return write(uint8_t(c));
+  }
+  size_t print(unsigned char n, int base = DEC) {
+    return print((unsigned long)n, base);
+  }
+  size_t print(int n, int base = DEC) {
+    return print((long)n, base);
+  }
+  size_t print(unsigned int n, int base = DEC) {
+    return print((unsigned long)n, base);
+  }
+  size_t print(long n, int base = DEC) {
+    if (base == DEC) {
+      return format("%ld", n);
+    }
+    return print((unsigned long)n, base);
+  }
+  size_t print(unsigned long n, int base = DEC) {
+    return format(base == HEX ? "%lX" : "%lu", n);
+  }
+  size_t print(double n, int digits = 2) {
+    return format("%.*f", digits, n);
+  }
+
+  template <typename T>
+  size_t println(T value) {
+    return print(value) + println();
+  }
+  template <typename T>
+  size_t println(T value, int format) {
+    return print(value, format) + println();
+  }
+  size_t println() {
+    return write("\r\n");
+  }
+
+ private:
+  template <typename... Args>
+  size_t format(const char *fmt, Args... args) {
+    char text[40];
+    snprintf(text, sizeof(text), fmt, args...);
+    return write(text);
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() {
+    return 0;
+  }
+  virtual int read() {
+    return -1;
+  }
+  virtual int peek() {
+    return -1;
+  }
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(uint32_t baud) {
+    (void)baud;
+  }
+  void flush() {
+    fflush(stdout);
+  }
+  int availableForWrite() {
+    return 63;
+  }
+  size_t write(uint8_t c) override {
+    if (enabled && c != '\r') {
+      fputc(c, stdout);
+    }
+    return 1;
+  }
+  using Print::write;
+
+  bool enabled = true;  // the simulator may turn off the robot output
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,331 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef SIM_BOARD_H
+#define SIM_BOARD_H
+
+#include <time.h>
+#include "Arduino.h"
+#include "robot.h"
+
+/***
+ * The simulated processor board. This is where the registers and Arduino
+ * functions declared in Arduino.h are defined.
+ *
+ * The board keeps a virtual clock in microseconds. Whenever the robot code
+ * gives it the chance, the clock moves on a little. Each time it passes a
+ * systick period the robot is moved on, the encoder interrupts are run for
+ * any edges, the systick interrupt is run, and then the ADC interrupt is
+ * run for each conversion that systick started until the ADC sequence is
+ * finished.
+ *
+ * The EEPROM starts out erased, as it would on a new processor. A write
+ * keeps EEPE set for SIM_EEPROM_WRITE_US.
+ *
+ * Nothing runs while an interrupt is being serviced so the interrupts
+ * always see a consistent state, just as they would on the robot.
+ */
+
+const uint32_t SIM_SYSTICK_US = uint32_t(1000000 / SYSTICK_FREQUENCY);
+const uint32_t SIM_POLL_US = 20;      // time taken by a bit of busy-wait code
+const int SIM_PHYSICS_STEPS = 4;      // robot updates for each systick
+const int SIM_PINS = 32;
+const int SIM_MAX_CONVERSIONS = 32;   // more than this in one go is a bug
+const uint32_t SIM_EEPROM_WRITE_US = 3400;
+
+volatile uint8_t TCCR1B, TCCR2A, TCCR2B, OCR2A, TIMSK2, TCNT2, TIFR2;
+volatile uint8_t ADMUX;
+SimRegister ADCSRA;
+volatile uint16_t ADC;
+volatile uint8_t UCSR0B, UDR0, EEDR;
+SimRegister EECR;
+volatile uint16_t EEAR;
+
+HardwareSerial Serial;
+
+class SimBoard {
+ public:
+  explicit SimBoard(SimRobot &robot) : m_robot(robot) {
+    ADCSRA.on_write = adc_control_written;
+    EECR.on_write = eeprom_control_written;
+    memset(m_eeprom, 0xFF, sizeof(m_eeprom));
+  }
+
+  uint64_t now() const {
+    return m_now;
+  }
+
+  /// @brief  call the handler if the robot code runs for longer than this
+  void set_time_limit(uint64_t limit_us, void (*handler)()) {
+    m_time_limit = limit_us;
+    m_timeout_handler = handler;
+  }
+
+  /***
+   * Let some time pass. Called whenever the robot code waits for anything.
+   * Time stands still inside an interrupt in the same way that nothing
+   * else can run while one is being serviced on the robot.
+   */
+  void poll(uint32_t us = SIM_POLL_US) {
+    if (m_isr_depth) {
+      return;
+    }
+    advance_to(m_now + us);
+  }
+
+  void advance_to(uint64_t target) {
+    while (m_next_tick <= target) {
+      move_robot(m_next_tick);
+      update_eeprom();
+      if (TIMSK2 & _BV(OCIE2A)) {
+        run_systick();
+      }
+      m_next_tick += SIM_SYSTICK_US;
+    }
+    m_now = target;
+    update_eeprom();
+    if (m_time_limit && m_now > m_time_limit && m_timeout_handler) {
+      m_timeout_handler();
+    }
+  }
+
+  /// @brief  use the motor model rather than following the motion profiles
+  void set_dynamic(bool dynamic) {
+    m_dynamic = dynamic;
+  }
+
+  void set_pin(uint8_t pin, uint8_t level) {
+    if (pin < SIM_PINS) {
+      m_pin_level[pin] = level != 0;
+    }
+  }
+
+  uint8_t pin(uint8_t pin) const {
+    return pin < SIM_PINS ? m_pin_level[pin] : 0;
+  }
+
+  void set_pwm(uint8_t pin, int value) {
+    if (pin < SIM_PINS) {
+      m_pwm[pin] = constrain(value, 0, 255);
+    }
+  }
+
+  void attach(uint8_t pin, void (*isr)(void)) {
+    if (pin < SIM_PINS) {
+      m_isr[pin] = isr;
+    }
+  }
+
+ private:
+  /***
+   * The motor voltage from the PWM and direction pins. The H-bridge drives
+   * the motor with the full battery voltage for the PWM on time. The motor
+   * polarity says which way round the motor is wired so a positive voltage
+   * here always drives the wheel forwards.
+   */
+  float motor_volts(uint8_t pwm_pin, uint8_t dir_pin, int polarity) const {
+    float duty = m_pwm[pwm_pin] / 255.0f;
+    return polarity * (m_pin_level[dir_pin] ? -duty : duty) * SIM_BATTERY_VOLTS;
+  }
+
+  /***
+   * The kinematic model takes the speeds straight from the motion profiles
+   * so the robot goes exactly where the code wants it to. The motor model
+   * turns the motor drive into movement and it is up to the controllers
+   * to get it right.
+   */
+  void move_robot(uint64_t until) {
+    float left_volts = motor_volts(MOTOR_LEFT_PWM, MOTOR_LEFT_DIR, MOTOR_LEFT_POLARITY);
+    float right_volts = motor_volts(MOTOR_RIGHT_PWM, MOTOR_RIGHT_DIR, MOTOR_RIGHT_POLARITY);
+    float speed = real_to_float(motion.isr_velocity());
+    float omega = real_to_float(motion.isr_omega());
+    auto edge = [this](int wheel, int direction) { encoder_edge(wheel, direction); };
+    uint64_t start = m_robot_time;
+    float dt = (until - start) / 1e6f / SIM_PHYSICS_STEPS;
+    for (int i = 1; i <= SIM_PHYSICS_STEPS; i++) {
+      m_now = start + (until - start) * i / SIM_PHYSICS_STEPS;
+      if (m_dynamic) {
+        m_robot.step(dt, left_volts, right_volts, edge);
+      } else {
+        m_robot.follow(dt, speed, omega, edge);
+      }
+    }
+    m_robot_time = until;
+    m_now = until;
+  }
+
+  /***
+   * The sequence of encoder states, (A << 1) | B, for forward rotation.
+   * The encoder board drives the interrupt pin with A XOR B.
+   */
+  void encoder_edge(int wheel, int direction) {
+    static const uint8_t states[4] = {0, 1, 3, 2};
+    bool left = wheel == 0;
+    int step = direction * (left ? ENCODER_LEFT_POLARITY : ENCODER_RIGHT_POLARITY);
+    uint8_t &phase = m_encoder_phase[wheel];
+    phase = (phase + 4 + step) % 4;
+    uint8_t a = states[phase] >> 1;
+    uint8_t b = states[phase] & 1;
+    uint8_t clk_pin = left ? ENCODER_LEFT_CLK : ENCODER_RIGHT_CLK;
+    set_pin(clk_pin, a ^ b);
+    set_pin(left ? ENCODER_LEFT_B : ENCODER_RIGHT_B, b);
+    interrupt(m_isr[clk_pin]);
+  }
+
+  void run_systick() {
+    interrupt(TIMER2_COMPA_vect);
+    // the ADC interrupt starts each conversion from the end of the last one
+    for (int i = 0; i < SIM_MAX_CONVERSIONS && m_conversion_pending && (ADCSRA & _BV(ADIE)); i++) {
+      m_conversion_pending = false;
+      complete_conversion();
+      interrupt(ADC_vect);
+    }
+  }
+
+  void interrupt(void (*isr)(void)) {
+    if (isr) {
+      m_isr_depth++;
+      isr();
+      m_isr_depth--;
+    }
+  }
+
+  void complete_conversion() {
+    uint8_t channel = ADMUX & 0x0F;
+    ADC = m_robot.adc_reading(channel, pin(EMITTER_FRONT), pin(EMITTER_DIAGONAL), m_now);
+    ADCSRA.value &= ~_BV(ADSC);
+  }
+
+  /***
+   * Writing ADSC starts a conversion. If the interrupt is on, the result
+   * arrives with the ADC interrupt after the current code returns.
+   * Otherwise the code is waiting for it and it can finish straight away.
+   */
+  static void adc_control_written(uint8_t old_value, uint8_t new_value);
+
+  /// @brief  the write in progress is finished once its time is up
+  void update_eeprom() {
+    if ((EECR & _BV(EEPE)) && m_now >= m_eeprom_ready) {
+      EECR.value &= ~_BV(EEPE);
+    }
+  }
+
+  /***
+   * Setting EERE reads a byte straight away. Setting EEPE with EEMPE
+   * already set erases and writes one. A write with the EEPROM busy is
+   * ignored, as it is on the processor.
+   */
+  static void eeprom_control_written(uint8_t old_value, uint8_t new_value);
+
+  SimRobot &m_robot;
+  uint64_t m_now = 0;
+  uint64_t m_next_tick = SIM_SYSTICK_US;
+  uint64_t m_robot_time = 0;
+  uint64_t m_time_limit = 0;
+  void (*m_timeout_handler)() = nullptr;
+  int m_isr_depth = 0;
+  bool m_dynamic = false;
+  bool m_conversion_pending = false;
+  uint64_t m_eeprom_ready = 0;
+  uint8_t m_eeprom[E2END + 1];
+  uint8_t m_pin_level[SIM_PINS] = {};
+  uint8_t m_pwm[SIM_PINS] = {};
+  uint8_t m_encoder_phase[2] = {};
+  void (*m_isr[SIM_PINS])(void) = {};
+};
+
+World world;
+SimRobot robot(world);
+SimBoard board(robot);
+
+void SimBoard::adc_control_written(uint8_t old_value, uint8_t new_value) {
+  (void)old_value;
+  if ((new_value & _BV(ADSC)) == 0) {
+    return;
+  }
+  if (new_value & _BV(ADIE)) {
+    board.m_conversion_pending = true;
+  } else {
+    board.complete_conversion();
+  }
+}
+
+void SimBoard::eeprom_control_written(uint8_t old_value, uint8_t new_value) {
+  uint16_t address = EEAR & E2END;
+  if (new_value & _BV(EERE)) {
+    EEDR = board.m_eeprom[address];
+    EECR.value &= ~_BV(EERE);
+  }
+  bool start_write = (new_value & _BV(EEPE)) && not(old_value & _BV(EEPE));
+  if (start_write) {
+    if (old_value & _BV(EEMPE)) {
+      board.m_eeprom[address] = EEDR;
+      board.m_eeprom_ready = board.m_now + SIM_EEPROM_WRITE_US;
+      EECR.value &= ~_BV(EEMPE);
+    } else {
+      EECR.value &= ~_BV(EEPE);
+    }
+  }
+}
+
+/*** The Arduino API ***/
+
+void sim_poll() {
+  board.poll();
+}
+
+uint32_t sim_host_ns() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint32_t(now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  board.set_pin(pin, value);
+}
+
+int digitalRead(uint8_t pin) {
+  return board.pin(pin);
+}
+
+void analogWrite(uint8_t pin, int value) {
+  board.set_pwm(pin, value);
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode) {
+  (void)mode;
+  board.attach(interrupt, isr);
+}
+
+void delay(uint32_t ms) {
+  board.poll(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+  board.poll(us);
+}
+
+uint32_t millis() {
+  board.poll();
+  return uint32_t(board.now() / 1000);
+}
+
+uint32_t micros() {
+  board.poll();
+  return uint32_t(board.now());
+}
+
+#endif
@@ -0,0 +1,250 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+/***
+ * mazesim runs the robot code on a PC with a simulated robot in a maze
+ * loaded from a file. It does a search, puts the robot back at the start
+ * and does a speed run, just as you would at a contest.
+ *
+ *   mazesim [-q] [-s] [-d] [-n noise] [-t seconds] mazefile
+ *
+ *   -q          do not show the robot's serial output
+ *   -d          drive the robot with the motor model. See below
+ *   -s          search only, no speed run
+ *   -n noise    add random noise to the sensors. 0.05 is +/- 5%
+ *   -t seconds  give up after this much simulated time. Default 1200
+ *
+ * The last line of output is a summary that is easy for scripts to read.
+ * tools/maze-bench runs the simulator over a set of mazes and collects
+ * them:
+ *
+ *   maze=mazes/x.txt search=95.32 run=9.13 explored=131 floods=2
+ *   flood_us=9.1 repairs=383 repair_us=0.4 path=23.7 estimate=8.75
+ *   crashes=0 end=7,7 result=PASS
+ *
+ * all on one line. The search and run times are in simulated seconds from
+ * the hand start to the end of the run. The search counts the cells
+ * explored and the calls to flood() and update_flood(), with the average
+ * time for each on this computer. The path is the length of the speed run
+ * in cells and the estimate is the time that Mouse::estimate_path_time()
+ * expected it to take. The result is PASS if the search ended back in the
+ * start cell and the speed run ended in a goal cell. The robot cannot drive
+ * through walls so the simulation stops with a result of CRASH as soon as
+ * it hits one, and with TIMEOUT if the time limit is reached.
+ *
+ * Normally the robot moves exactly as the motion profiles say, so the
+ * results show what the search and the path planning do rather than how
+ * well the controllers are tuned. With -d the motors drive the robot
+ * through a first order model of the drive train made from the robot
+ * config and the controllers have to do their job. The gains that suit
+ * the real robot do not suit the model so -d sets its own with
+ * use_model_gains(). The position controllers are made faster and the
+ * steering is turned off. Without steering, a long route can still drift
+ * into a wall so -d is an aid for tuning the controllers rather than a
+ * regression test. Check the search and the planner without it.
+ *
+ * The exit status is 0 for a PASS, 1 for bad arguments, 2 for a FAIL or
+ * a CRASH and 3 for a TIMEOUT.
+ */
+
+// count the maze calls and time them with the host clock
+#define MAZE_CALL_STATS 1
+#define MAZE_STATS_CLOCK() sim_host_ns()
+
+#include "../mazerunner-core/mazerunner-core.ino"
+
+#include "board.h"
+#include "robot.h"
+#include "world.h"
+
+const uint64_t HAND_DELAY_US = 200000;  // the hand arrives after this
+const uint64_t HAND_TIME_US = 400000;   // and stays this long
+
+static const char *g_maze_name = "";
+static float g_search_time = 0;
+static float g_run_time = 0;
+static uint64_t g_start_time = 0;
+static MazeCallStats g_search_stats = {};
+static int g_explored = 0;
+
+/// @brief  wave a hand in front of the left sensor to start a run
+static void hand_start() {
+  uint64_t from = board.now() + HAND_DELAY_US;
+  robot.show_hand(from, from + HAND_TIME_US);
+  g_start_time = from + HAND_TIME_US;
+}
+
+static float elapsed() {
+  return (board.now() - g_start_time) / 1e6f;
+}
+
+/// @brief  the average time per call in microseconds
+static float call_us(const MazeCallCount &count) {
+  return count.calls ? count.time / 1000.0f / count.calls : 0;
+}
+
+/// @brief  print the summary line and stop
+static void finish(const char *result) {
+  Serial.flush();
+  int x = int(floorf(robot.x() / WORLD_CELL));
+  int y = int(floorf(robot.y() / WORLD_CELL));
+  printf("\nmaze=%s search=%.2f run=%.2f", g_maze_name, g_search_time, g_run_time);
+  printf(" explored=%d floods=%u flood_us=%.1f repairs=%u repair_us=%.1f", g_explored,
+         unsigned(g_search_stats.flood.calls), call_us(g_search_stats.flood), unsigned(g_search_stats.repair.calls),
+         call_us(g_search_stats.repair));
+  printf(" path=%.1f estimate=%.2f", mouse.path_length() / FULL_CELL, mouse.path_time());
+  printf(" crashes=%d end=%d,%d result=%s\n", robot.crashes(), x, y, result);
+  exit(strcmp(result, "PASS") == 0 ? 0 : strcmp(result, "TIMEOUT") == 0 ? 3 : 2);
+}
+
+static void timed_out() {
+  finish("TIMEOUT");
+}
+
+static void crashed() {
+  Serial.flush();
+  fprintf(stderr, "\ncrashed at x=%.0f y=%.0f heading %.0f after %.2f s\n", robot.x(), robot.y(), robot.heading(),
+          elapsed());
+  finish("CRASH");
+}
+
+static bool in_start_cell() {
+  return int(robot.x() / WORLD_CELL) == START.x && int(robot.y() / WORLD_CELL) == START.y;
+}
+
+static bool in_goal() {
+  return world.is_goal(int(robot.x() / WORLD_CELL), int(robot.y() / WORLD_CELL));
+}
+
+/// @brief  give the robot the goal area marked in the maze file
+static void set_goal() {
+  int min_x = MAZE_WIDTH, min_y = MAZE_HEIGHT, max_x = -1, max_y = -1;
+  for (int x = 0; x < world.width(); x++) {
+    for (int y = 0; y < world.height(); y++) {
+      if (world.is_goal(x, y)) {
+        min_x = min(min_x, x);
+        min_y = min(min_y, y);
+        max_x = max(max_x, x);
+        max_y = max(max_y, y);
+      }
+    }
+  }
+  maze.set_goal(Location(min_x, min_y), max_x - min_x + 1, max_y - min_y + 1);
+}
+
+static int explored_cells() {
+  int count = 0;
+  for (int x = 0; x < MAZE_WIDTH; x++) {
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      count += maze.cell_is_visited(Location(x, y)) ? 1 : 0;
+    }
+  }
+  return count;
+}
+
+/***
+ * The simulated side sensors are perfect and instant but they are far more
+ * sensitive to the position of the robot than real ones. With the steering
+ * gains from the robot config, the steering swings from one limit to the
+ * other as soon as it starts and the robot crashes in the first few cells.
+ * Gains that are small enough to be stable leave the robot off line and at
+ * an angle after a turn so it maps the walls wrongly. For now, -d turns the
+ * steering off and uses faster forward and rotation controllers, designed
+ * in the same way as those in the robot config but with TD at 0.6 * TM.
+ * That is enough for the robot to find its own way through the maze.
+ */
+static void use_model_gains() {
+  const float fwd_td = 0.6f * FWD_TM;
+  const float rot_td = 0.6f * ROT_TM;
+  settings.fwd_kp = 16 * FWD_TM / (FWD_KM * FWD_ZETA * FWD_ZETA * fwd_td * fwd_td);
+  settings.fwd_kd = LOOP_FREQUENCY * (8 * FWD_TM - fwd_td) / (FWD_KM * fwd_td);
+  settings.rot_kp = 16 * ROT_TM / (ROT_KM * ROT_ZETA * ROT_ZETA * rot_td * rot_td);
+  settings.rot_kd = LOOP_FREQUENCY * (8 * ROT_TM - rot_td) / (ROT_KM * rot_td);
+  settings.steering_kp = 0;
+  settings.steering_kd = 0;
+  settings.apply();
+}
+
+static int usage() {
+  fprintf(stderr, "usage: mazesim [-q] [-s] [-d] [-n noise] [-t seconds] mazefile\n");
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  bool search_only = false;
+  bool dynamic = false;
+  float noise = 0;
+  float time_limit = 1200;
+  const char *filename = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-q") == 0) {
+      Serial.enabled = false;
+    } else if (strcmp(argv[i], "-s") == 0) {
+      search_only = true;
+    } else if (strcmp(argv[i], "-d") == 0) {
+      board.set_dynamic(true);
+      dynamic = true;
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      noise = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      time_limit = atof(argv[++i]);
+    } else if (argv[i][0] == '-' || filename) {
+      return usage();
+    } else {
+      filename = argv[i];
+    }
+  }
+  if (filename == nullptr) {
+    return usage();
+  }
+  if (not world.load(filename)) {
+    return 1;
+  }
+  if (world.width() != MAZE_WIDTH || world.height() != MAZE_HEIGHT) {
+    fprintf(stderr, "%s is %d x %d but the robot is set up for %d x %d\n", filename, world.width(), world.height(),
+            MAZE_WIDTH, MAZE_HEIGHT);
+    return 1;
+  }
+  g_maze_name = filename;
+  srand(1);
+  robot.set_noise(noise);
+  robot.set_crash_handler(crashed);
+  robot.place_at_start();
+  board.set_time_limit(uint64_t(time_limit * 1e6), timed_out);
+
+  setup();
+  if (dynamic) {
+    use_model_gains();
+  }
+  maze.initialise();
+  set_goal();
+
+  hand_start();
+  maze.reset_call_stats();
+  mouse.search_maze();
+  g_search_time = elapsed();
+  g_search_stats = maze.call_stats();
+  g_explored = explored_cells();
+  if (not in_start_cell()) {
+    finish("FAIL");
+  }
+  if (not search_only) {
+    // pick the robot up and put it back against the wall behind the start
+    robot.place_at_start();
+    hand_start();
+    mouse.run_maze();
+    g_run_time = elapsed();
+    if (not in_goal()) {
+      finish("FAIL");
+    }
+  }
+  finish("PASS");
+}
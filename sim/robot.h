@@ -0,0 +1,284 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef SIM_ROBOT_H
+#define SIM_ROBOT_H
+
+#include "world.h"
+
+/***
+ * The physical robot in the simulator. It moves through the world and
+ * gives back encoder edges and sensor readings.
+ *
+ * Everything comes from the robot config so the simulated robot is the one
+ * that the config describes:
+ *
+ *  - With the motor model, the drive uses the same first order model that
+ *    the controllers are designed from. FWD_KM and FWD_TM for forward
+ *    motion, ROT_KM and ROT_TM for rotation, with BIAS_FF volts lost to
+ *    friction. Otherwise the robot just moves at the speeds it is given.
+ *  - The wheels move MM_PER_COUNT_LEFT and MM_PER_COUNT_RIGHT for each
+ *    encoder count and are MOUSE_RADIUS from the middle of the robot.
+ *  - A sensor reading is (k/d)^2 for a wall at distance d where k is the
+ *    linearisation constant for that sensor. The side sensors look out
+ *    at 45 degrees and, like the real ones, see the heading as well as
+ *    the offset. They are placed so that they read SIDE_NOMINAL with the
+ *    robot in the middle of a cell and the front pair add up to about
+ *    FRONT_REFERENCE when the robot is in the middle of a cell with a
+ *    wall ahead. The side sensors are far enough forward that the end of a
+ *    side wall is seen with the robot about LEFT_EDGE_POS through the
+ *    cell. The calibration values turn those into raw ADC readings.
+ *
+ * Each sensor beam is a narrow cone made from a few rays. There is no
+ * noise unless it is asked for.
+ */
+
+const float SIM_DARK_READING = 20;      // ADC reading with the emitters off
+const float SIM_BATTERY_VOLTS = 8.0f;   // fully charged 2S LiPo
+const float SIM_CRASH_CLEARANCE = 30;   // closer than this to a wall is a crash
+const float SIM_EDGE_LAG = 7.5;         // mm past a post before a side reading falls
+const float SIM_SIDE_SENSOR_ANGLE = 45; // degrees out from straight ahead
+const float SIM_FRONT_SENSOR_Y = 25;    // mm either side of the centre line
+const float SIM_SIDE_LINEAR_CONSTANT = 500;  // about 50mm to the wall at SIDE_NOMINAL
+const float SIM_FRONT_LINEAR_CONSTANT = FRONT_LINEAR_CONSTANT * 0.7071f;  // each sees half the sum
+const float SIM_HAND_READING = 600;     // a hand in front of a sensor
+const float SIM_BEAM_HALF_ANGLE = 10;   // degrees either side of the beam centre
+const int SIM_BEAM_RAYS = 5;
+const float SIM_MAX_VALUE = 1000;       // the reading with the sensor against a wall
+const float SIM_WALL_FACE = WORLD_CELL / 2 - WORLD_WALL_HALF;
+const float SIM_BACK_LENGTH = SIM_WALL_FACE - BACK_WALL_TO_CENTER;  // wheel axle to the back
+
+struct SimSensor {
+  uint8_t channel;  // ADC channel
+  bool front;       // lit by the front emitter
+  float x, y;       // mm forward and left of the middle of the wheel axle
+  float angle;      // degrees anticlockwise from straight ahead
+  float k;          // linearisation constant
+  float scale;      // raw counts per unit of value
+};
+
+class SimRobot {
+ public:
+  explicit SimRobot(const World &world) : m_world(world) {
+    float side_in = sinf(SIM_SIDE_SENSOR_ANGLE * WORLD_RADIANS_PER_DEGREE);
+    float side_y = SIM_WALL_FACE - side_in * SIM_SIDE_LINEAR_CONSTANT / sqrtf(SIDE_NOMINAL);
+    float side_reach = (SIM_WALL_FACE - side_y) / tanf(SIM_SIDE_SENSOR_ANGLE * WORLD_RADIANS_PER_DEGREE);
+    float side_x = WORLD_CELL + WORLD_WALL_HALF + SIM_EDGE_LAG - LEFT_EDGE_POS - side_reach;
+    float front_x = SIM_WALL_FACE - SIM_FRONT_LINEAR_CONSTANT * sqrtf(2.0f / FRONT_REFERENCE);
+    m_sensors[0] = {LFS_ADC_CHANNEL, true, front_x, SIM_FRONT_SENSOR_Y, 0, SIM_FRONT_LINEAR_CONSTANT, 1 / FRONT_LEFT_SCALE};
+    m_sensors[1] = {RFS_ADC_CHANNEL, true, front_x, -SIM_FRONT_SENSOR_Y, 0, SIM_FRONT_LINEAR_CONSTANT, 1 / FRONT_RIGHT_SCALE};
+    m_sensors[2] = {LSS_ADC_CHANNEL, false, side_x, side_y, SIM_SIDE_SENSOR_ANGLE, SIM_SIDE_LINEAR_CONSTANT, 1 / LEFT_SCALE};
+    m_sensors[3] = {RSS_ADC_CHANNEL, false, side_x, -side_y, -SIM_SIDE_SENSOR_ANGLE, SIM_SIDE_LINEAR_CONSTANT, 1 / RIGHT_SCALE};
+  }
+
+  /***
+   * Put the robot in the start cell facing north with its back against
+   * the wall behind, as it would be for a hand start.
+   */
+  void place_at_start() {
+    m_x = WORLD_CELL / 2;
+    m_y = WORLD_CELL / 2 - BACK_WALL_TO_CENTER;
+    m_theta = 90;
+    m_speed = 0;
+    m_omega = 0;
+    m_touching = false;
+  }
+
+  /// @brief  hold a hand in front of the left front sensor for a while
+  void show_hand(uint64_t from_us, uint64_t until_us) {
+    m_hand_from = from_us;
+    m_hand_until = until_us;
+  }
+
+  void set_noise(float fraction) {
+    m_noise = fraction;
+  }
+
+  /***
+   * The robot cannot drive through walls so there is no point carrying on
+   * after a crash. The handler is called as soon as the robot hits one.
+   */
+  void set_crash_handler(void (*handler)()) {
+    m_crash_handler = handler;
+  }
+
+  /***
+   * Move the robot on by dt seconds with the given motor voltages, using
+   * the motor model. Then call the encoder callback once for each count
+   * that each wheel moved.
+   */
+  template <typename Edge>
+  void step(float dt, float left_volts, float right_volts, Edge edge) {
+    float fwd_volts = (right_volts + left_volts) / 2;
+    float rot_volts = (right_volts - left_volts) / 2;
+    m_speed = motor_model(m_speed, fwd_volts, FWD_KM, FWD_TM, dt);
+    m_omega = motor_model(m_omega, rot_volts, ROT_KM, ROT_TM, dt);
+    move(m_speed * dt, m_omega * dt, edge);
+  }
+
+  /***
+   * Move the robot on by dt seconds at exactly the given forward speed in
+   * mm/s and rotation speed in deg/s. This is the kinematic model where
+   * the robot goes wherever it is told to.
+   */
+  template <typename Edge>
+  void follow(float dt, float speed, float omega, Edge edge) {
+    m_speed = speed;
+    m_omega = omega;
+    move(speed * dt, omega * dt, edge);
+  }
+
+  /***
+   * The ADC reading for a channel. The wall sensors only see a wall when
+   * their emitter is on.
+   */
+  int adc_reading(uint8_t channel, bool front_emitter, bool side_emitter, uint64_t now_us) {
+    if (channel == BATTERY_ADC_CHANNEL) {
+      return int(SIM_BATTERY_VOLTS / BATTERY_MULTIPLIER);
+    }
+    if (channel == SWITCHES_ADC_CHANNEL) {
+      return pgm_read_word_near(adc_thesholds);  // all the switches off
+    }
+    float reading = SIM_DARK_READING;
+    for (const SimSensor &sensor : m_sensors) {
+      if (sensor.channel != channel) {
+        continue;
+      }
+      if (sensor.front ? front_emitter : side_emitter) {
+        reading += sensor.scale * sensor_value(sensor);
+        if (sensor.channel == LFS_ADC_CHANNEL && now_us >= m_hand_from && now_us < m_hand_until) {
+          reading += SIM_HAND_READING;
+        }
+      }
+      break;
+    }
+    return constrain(int(reading), 0, 1023);
+  }
+
+  float x() const {
+    return m_x;
+  }
+
+  float y() const {
+    return m_y;
+  }
+
+  /// @brief  the heading in degrees, 0 to 360, anticlockwise from east
+  float heading() const {
+    float theta = fmodf(m_theta, 360);
+    return theta < 0 ? theta + 360 : theta;
+  }
+
+  int crashes() const {
+    return m_crashes;
+  }
+
+ private:
+  /***
+   * The robot can back up against a wall to line itself up. When it gets
+   * there it stops and the wheels slip, as they do on the real robot.
+   */
+  template <typename Edge>
+  void move(float distance, float turn, Edge edge) {
+    float wheel_turn = turn * WORLD_RADIANS_PER_DEGREE * MOUSE_RADIUS;
+    m_left_wheel += distance - wheel_turn;
+    m_right_wheel += distance + wheel_turn;
+    if (distance < 0 && m_world.ray_distance(m_x, m_y, m_theta + 180) <= SIM_BACK_LENGTH) {
+      distance = 0;
+    }
+    float heading = (m_theta + turn / 2) * WORLD_RADIANS_PER_DEGREE;
+    m_x += distance * cosf(heading);
+    m_y += distance * sinf(heading);
+    m_theta += turn;
+    while (m_left_counts != long(floorf(m_left_wheel / MM_PER_COUNT_LEFT))) {
+      int direction = m_left_wheel > m_left_counts * MM_PER_COUNT_LEFT ? 1 : -1;
+      m_left_counts += direction;
+      edge(0, direction);
+    }
+    while (m_right_counts != long(floorf(m_right_wheel / MM_PER_COUNT_RIGHT))) {
+      int direction = m_right_wheel > m_right_counts * MM_PER_COUNT_RIGHT ? 1 : -1;
+      m_right_counts += direction;
+      edge(1, direction);
+    }
+    bool touching = m_world.clearance(m_x, m_y) < SIM_CRASH_CLEARANCE;
+    if (touching && not m_touching) {
+      m_crashes++;
+      if (m_crash_handler) {
+        m_crash_handler();
+      }
+    }
+    m_touching = touching;
+  }
+
+  /***
+   * The friction takes BIAS_FF volts from the drive while the robot is
+   * moving and holds it still until the drive is bigger than that.
+   */
+  static float motor_model(float speed, float volts, float km, float tm, float dt) {
+    if (speed > 0) {
+      volts -= BIAS_FF;
+    } else if (speed < 0) {
+      volts += BIAS_FF;
+    } else if (fabsf(volts) <= BIAS_FF) {
+      return 0;
+    } else {
+      volts -= volts > 0 ? BIAS_FF : -BIAS_FF;
+    }
+    float new_speed = speed + (km * volts - speed) * dt / tm;
+    if ((speed > 0 && new_speed < 0) || (speed < 0 && new_speed > 0)) {
+      return 0;  // friction can stop the robot but not reverse it
+    }
+    return new_speed;
+  }
+
+  float sensor_value(const SimSensor &sensor) {
+    float theta = m_theta * WORLD_RADIANS_PER_DEGREE;
+    float c = cosf(theta);
+    float s = sinf(theta);
+    float x = m_x + sensor.x * c - sensor.y * s;
+    float y = m_y + sensor.x * s + sensor.y * c;
+    // the beam is a cone so average a few rays across it
+    float value = 0;
+    for (int i = 0; i < SIM_BEAM_RAYS; i++) {
+      float offset = SIM_BEAM_HALF_ANGLE * (2.0f * i / (SIM_BEAM_RAYS - 1) - 1);
+      float d = m_world.ray_distance(x, y, m_theta + sensor.angle + offset);
+      if (d < WORLD_MAX_RANGE) {
+        d = max(d, sensor.k / sqrtf(SIM_MAX_VALUE));
+        value += (sensor.k / d) * (sensor.k / d);
+      }
+    }
+    value /= SIM_BEAM_RAYS;
+    if (m_noise > 0) {
+      value *= 1 + m_noise * (2.0f * rand() / RAND_MAX - 1);
+    }
+    return value;
+  }
+
+  const World &m_world;
+  SimSensor m_sensors[4];
+  float m_x = 0;
+  float m_y = 0;
+  float m_theta = 0;
+  float m_speed = 0;
+  float m_omega = 0;
+  float m_left_wheel = 0;
+  float m_right_wheel = 0;
+  long m_left_counts = 0;
+  long m_right_counts = 0;
+  float m_noise = 0;
+  uint64_t m_hand_from = 0;
+  uint64_t m_hand_until = 0;
+  int m_crashes = 0;
+  bool m_touching = false;
+  void (*m_crash_handler)() = nullptr;
+};
+
+#endif
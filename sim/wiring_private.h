@@ -0,0 +1,20 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef SIM_WIRING_PRIVATE_H
+#define SIM_WIRING_PRIVATE_H
+
+#include "Arduino.h"
+
+#define sbi(sfr, bit) ((sfr) |= _BV(bit))
+#define cbi(sfr, bit) ((sfr) &= ~_BV(bit))
+
+#endif
@@ -0,0 +1,325 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/***
+ * The real maze that the simulated robot runs in. This is not the robot's
+ * map. It is only used to work out what the sensors can see and whether
+ * the robot has hit anything.
+ *
+ * Positions are in mm with the origin at the outside corner of the start
+ * cell, x to the east and y to the north. Angles are in degrees
+ * anticlockwise from east.
+ *
+ * Two kinds of maze file can be loaded:
+ *
+ *  - text files with posts drawn as 'o' (or '+') and walls as '-' and '|'.
+ *    The north edge of the maze is the first line. Cells marked with 'G'
+ *    are the goal. This is the format of most published maze collections.
+ *
+ *        o---o---o---o
+ *        | G         |
+ *        o   o---o   o
+ *        |   |       |
+ *        o   o---o---o
+ *        | S         |
+ *        o---o---o---o
+ *
+ *  - binary .maz files of 256 or 1024 bytes with one byte for each cell,
+ *    column by column from the south west corner, with bits for the
+ *    walls as N = 1, E = 2, S = 4, W = 8. The goal is the middle four
+ *    cells.
+ */
+
+const int WORLD_MAX_SIZE = 32;
+const float WORLD_CELL = 180.0f;
+const float WORLD_WALL_HALF = 6.0f;  // the walls are 12mm thick
+const float WORLD_MAX_RANGE = 400.0f;
+const float WORLD_RADIANS_PER_DEGREE = 3.14159265f / 180.0f;
+
+class World {
+ public:
+  enum { WALL_N = 1, WALL_E = 2, WALL_S = 4, WALL_W = 8 };
+
+  int width() const {
+    return m_width;
+  }
+
+  int height() const {
+    return m_height;
+  }
+
+  bool is_goal(int x, int y) const {
+    return m_goal[x][y];
+  }
+
+  bool has_wall(int x, int y, int wall) const {
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height) {
+      return true;
+    }
+    return (m_walls[x][y] & wall) != 0;
+  }
+
+  /// @brief  load a maze file. Prints a message and returns false on error
+  bool load(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == nullptr) {
+      fprintf(stderr, "cannot open %s\n", filename);
+      return false;
+    }
+    static char data[16384];
+    size_t size = fread(data, 1, sizeof(data) - 1, file);
+    fclose(file);
+    data[size] = 0;
+    bool ok;
+    if (size == 256 || size == 1024) {
+      ok = load_binary((const uint8_t *)data, size == 256 ? 16 : 32);
+    } else {
+      ok = load_text(data);
+    }
+    if (not ok) {
+      fprintf(stderr, "%s is not a maze file\n", filename);
+      return false;
+    }
+    make_consistent();
+    return true;
+  }
+
+  /***
+   * The distance along a ray to the first wall face or post that it hits,
+   * or WORLD_MAX_RANGE if there is nothing in range. This steps through
+   * the cell boundaries that the ray crosses in order.
+   */
+  float ray_distance(float x, float y, float angle) const {
+    float dx = cosf(angle * WORLD_RADIANS_PER_DEGREE);
+    float dy = sinf(angle * WORLD_RADIANS_PER_DEGREE);
+    float best = WORLD_MAX_RANGE;
+    // the vertical lines x = i * WORLD_CELL and their wall faces
+    if (fabsf(dx) > 1e-6f) {
+      int step = dx > 0 ? 1 : -1;
+      int i = int(floorf(x / WORLD_CELL)) + (dx > 0 ? 1 : 0);
+      for (;; i += step) {
+        float line = i * WORLD_CELL;
+        float face = line - step * WORLD_WALL_HALF;
+        float t = (face - x) / dx;
+        if (t > best) {
+          break;
+        }
+        if (t < 0) {
+          continue;
+        }
+        float hit_y = y + t * dy;
+        if (blocked_vertical(i, hit_y)) {
+          best = t;
+          break;
+        }
+      }
+    }
+    // the horizontal lines y = j * WORLD_CELL
+    if (fabsf(dy) > 1e-6f) {
+      int step = dy > 0 ? 1 : -1;
+      int j = int(floorf(y / WORLD_CELL)) + (dy > 0 ? 1 : 0);
+      for (;; j += step) {
+        float line = j * WORLD_CELL;
+        float face = line - step * WORLD_WALL_HALF;
+        float t = (face - y) / dy;
+        if (t > best) {
+          break;
+        }
+        if (t < 0) {
+          continue;
+        }
+        float hit_x = x + t * dx;
+        if (blocked_horizontal(j, hit_x)) {
+          best = t;
+          break;
+        }
+      }
+    }
+    return best;
+  }
+
+  /// @brief  the distance from a point to the nearest wall face or post
+  float clearance(float x, float y) const {
+    int cx = int(floorf(x / WORLD_CELL));
+    int cy = int(floorf(y / WORLD_CELL));
+    float best = WORLD_MAX_RANGE;
+    for (int i = cx; i <= cx + 1; i++) {
+      float d = fabsf(x - i * WORLD_CELL) - WORLD_WALL_HALF;
+      if (d < best && blocked_vertical(i, y)) {
+        best = d;
+      }
+    }
+    for (int j = cy; j <= cy + 1; j++) {
+      float d = fabsf(y - j * WORLD_CELL) - WORLD_WALL_HALF;
+      if (d < best && blocked_horizontal(j, x)) {
+        best = d;
+      }
+    }
+    return best;
+  }
+
+ private:
+  static bool near_post(float along) {
+    float offset = fmodf(along, WORLD_CELL);
+    if (offset < 0) {
+      offset += WORLD_CELL;
+    }
+    return offset <= WORLD_WALL_HALF || offset >= WORLD_CELL - WORLD_WALL_HALF;
+  }
+
+  /// @brief  is there a wall or post on the line x = i * WORLD_CELL at y
+  bool blocked_vertical(int i, float y) const {
+    if (y < 0 || y > m_height * WORLD_CELL || i <= 0 || i >= m_width) {
+      return true;
+    }
+    if (near_post(y)) {
+      return true;
+    }
+    return has_wall(i, int(y / WORLD_CELL), WALL_W);
+  }
+
+  /// @brief  is there a wall or post on the line y = j * WORLD_CELL at x
+  bool blocked_horizontal(int j, float x) const {
+    if (x < 0 || x > m_width * WORLD_CELL || j <= 0 || j >= m_height) {
+      return true;
+    }
+    if (near_post(x)) {
+      return true;
+    }
+    return has_wall(int(x / WORLD_CELL), j, WALL_S);
+  }
+
+  void clear(int width, int height) {
+    memset(m_walls, 0, sizeof(m_walls));
+    memset(m_goal, 0, sizeof(m_goal));
+    m_width = width;
+    m_height = height;
+  }
+
+  bool load_binary(const uint8_t *data, int size) {
+    clear(size, size);
+    for (int x = 0; x < size; x++) {
+      for (int y = 0; y < size; y++) {
+        m_walls[x][y] = data[x * size + y] & 0x0F;
+      }
+    }
+    for (int x = size / 2 - 1; x <= size / 2; x++) {
+      for (int y = size / 2 - 1; y <= size / 2; y++) {
+        m_goal[x][y] = true;
+      }
+    }
+    return true;
+  }
+
+  bool load_text(const char *data) {
+    const char *lines[2 * WORLD_MAX_SIZE + 1];
+    int lengths[2 * WORLD_MAX_SIZE + 1];
+    int count = 0;
+    const char *p = data;
+    while (*p && count < 2 * WORLD_MAX_SIZE + 1) {
+      const char *end = strchr(p, '\n');
+      int length = end ? int(end - p) : int(strlen(p));
+      while (length > 0 && (p[length - 1] == '\r' || p[length - 1] == ' ')) {
+        length--;
+      }
+      if (length > 0 && (p[0] == 'o' || p[0] == '+' || p[0] == '|')) {
+        lines[count] = p;
+        lengths[count] = length;
+        count++;
+      }
+      if (end == nullptr) {
+        break;
+      }
+      p = end + 1;
+    }
+    int width = (lengths[0] - 1) / 4;
+    int height = (count - 1) / 2;
+    if (count < 3 || width < 1 || height < 1 || width > WORLD_MAX_SIZE || height > WORLD_MAX_SIZE) {
+      return false;
+    }
+    clear(width, height);
+    auto at = [&](int row, int col) -> char { return col < lengths[row] ? lines[row][col] : ' '; };
+    for (int y = 0; y < height; y++) {
+      int row = 2 * (height - 1 - y) + 1;
+      for (int x = 0; x < width; x++) {
+        int col = 4 * x;
+        uint8_t walls = 0;
+        walls |= at(row - 1, col + 2) == '-' ? WALL_N : 0;
+        walls |= at(row + 1, col + 2) == '-' ? WALL_S : 0;
+        walls |= at(row, col) == '|' ? WALL_W : 0;
+        walls |= at(row, col + 4) == '|' ? WALL_E : 0;
+        m_walls[x][y] = walls;
+        for (int i = 1; i <= 3; i++) {
+          if (at(row, col + i) == 'G') {
+            m_goal[x][y] = true;
+          }
+        }
+      }
+    }
+    if (not any_goal()) {
+      // no goal marked so use the middle of the maze
+      for (int x = (width - 1) / 2; x <= width / 2; x++) {
+        for (int y = (height - 1) / 2; y <= height / 2; y++) {
+          m_goal[x][y] = true;
+        }
+      }
+    }
+    return true;
+  }
+
+  /// @brief  a wall seen from either side is there from both sides
+  void make_consistent() {
+    for (int x = 0; x < m_width; x++) {
+      for (int y = 0; y < m_height; y++) {
+        if (has_wall(x, y, WALL_E) || has_wall(x + 1, y, WALL_W)) {
+          set_wall(x, y, WALL_E);
+          set_wall(x + 1, y, WALL_W);
+        }
+        if (has_wall(x, y, WALL_N) || has_wall(x, y + 1, WALL_S)) {
+          set_wall(x, y, WALL_N);
+          set_wall(x, y + 1, WALL_S);
+        }
+      }
+    }
+  }
+
+  void set_wall(int x, int y, int wall) {
+    if (x < m_width && y < m_height) {
+      m_walls[x][y] |= wall;
+    }
+  }
+
+  bool any_goal() const {
+    for (int x = 0; x < m_width; x++) {
+      for (int y = 0; y < m_height; y++) {
+        if (m_goal[x][y]) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  uint8_t m_walls[WORLD_MAX_SIZE][WORLD_MAX_SIZE];
+  bool m_goal[WORLD_MAX_SIZE][WORLD_MAX_SIZE];
+  int m_width = 0;
+  int m_height = 0;
+};
+
+#endif
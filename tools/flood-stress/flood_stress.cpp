@@ -0,0 +1,413 @@
+/******************************************************************************
+ * Project: mazerunner-core                                                   *
+ * -----                                                                      *
+ * Copyright 2022 - 2023 Peter Harrison, Micromouseonline                     *
+ * -----                                                                      *
+ * Licence:                                                                   *
+ *     Use of this source code is governed by an MIT-style                    *
+ *     license that can be found in the LICENSE file or at                    *
+ *     https://opensource.org/licenses/MIT.                                   *
+ ******************************************************************************/
+
+/***
+ * Host-side stress test for the flood queues in maze.h.
+ *
+ * This floods thousands of mazes and reports the deepest that each kind of
+ * flood queue ever got. Use the results to set MAZE_FLOOD_QUEUE_SIZE. It is
+ * not part of the robot firmware and needs nothing from Arduino.
+ *
+ * The queues are made as big as the maze so that they never fill up here.
+ * The WallInfo storage is used because the bitboard flood has no queue.
+ * Build and run it from this directory with something like:
+ *
+ *    g++ -O2 -I../../mazerunner-core -DMAZE_USE_BITBOARDS=0 \
+ *        -DMAZE_QUEUE_STATS=1 -DMAZE_FLOOD_QUEUE_SIZE=MAZE_CELL_COUNT \
+ *        -DMAZE_WEIGHTED_FLOOD=1 \
+ *        flood_stress.cpp -o flood_stress
+ *    ./flood_stress [trials] [seed]
+ *
+ * Add -DMAZE_WIDTH=32 -DMAZE_HEIGHT=32 to test a half-size maze.
+ *
+ * The mazes are:
+ *    empty      - no internal walls at all
+ *    random     - each wall present with a random probability
+ *    backtrack  - perfect mazes with long corridors from a depth first search
+ *    kruskal    - perfect mazes with lots of short branches
+ *    braid      - kruskal mazes with most of the dead ends knocked through
+ *    climb      - a hill climb that keeps any change that makes a kruskal
+ *                 maze need a deeper queue. This is the adversarial case.
+ *
+ * For each maze there is a full flood and a weighted flood (if
+ * enabled) from several targets. Then there is a simulated search where
+ * the walls are revealed one at a time so that update_flood() does repairs.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include "maze.h"
+
+#if !MAZE_QUEUE_STATS
+#error "Build with -DMAZE_QUEUE_STATS=1"
+#endif
+
+Maze maze;
+
+// The generated walls. true means there is a wall
+bool north_wall[MAZE_WIDTH][MAZE_HEIGHT];
+bool east_wall[MAZE_WIDTH][MAZE_HEIGHT];
+
+struct Result {
+  const char *name;
+  int full;
+  int weighted;
+  int search;
+  bool filled;
+};
+
+int random_int(int limit) {
+  return rand() % limit;
+}
+
+//***************************************************************************//
+// Maze generators. All of them leave the outside walls in place
+
+void set_all_walls(bool state) {
+  for (int x = 0; x < MAZE_WIDTH; x++) {
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      north_wall[x][y] = state || y == MAZE_HEIGHT - 1;
+      east_wall[x][y] = state || x == MAZE_WIDTH - 1;
+    }
+  }
+}
+
+void make_random() {
+  int percent = 10 + random_int(60);
+  set_all_walls(false);
+  for (int x = 0; x < MAZE_WIDTH; x++) {
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      north_wall[x][y] |= random_int(100) < percent;
+      east_wall[x][y] |= random_int(100) < percent;
+    }
+  }
+}
+
+void knock_down(Location cell, Heading heading) {
+  switch (heading) {
+    case NORTH:
+      north_wall[cell.x][cell.y] = false;
+      break;
+    case EAST:
+      east_wall[cell.x][cell.y] = false;
+      break;
+    case SOUTH:
+      north_wall[cell.x][cell.y - 1] = false;
+      break;
+    default:
+      east_wall[cell.x - 1][cell.y] = false;
+      break;
+  }
+}
+
+bool can_move(Location cell, Heading heading) {
+  switch (heading) {
+    case NORTH:
+      return cell.y < MAZE_HEIGHT - 1;
+    case EAST:
+      return cell.x < MAZE_WIDTH - 1;
+    case SOUTH:
+      return cell.y > 0;
+    default:
+      return cell.x > 0;
+  }
+}
+
+void make_backtrack() {
+  static Location stack[MAZE_CELL_COUNT];
+  static bool seen[MAZE_WIDTH][MAZE_HEIGHT];
+  set_all_walls(true);
+  for (int x = 0; x < MAZE_WIDTH; x++) {
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      seen[x][y] = false;
+    }
+  }
+  int depth = 0;
+  stack[depth++] = Location(0, 0);
+  seen[0][0] = true;
+  while (depth > 0) {
+    Location here = stack[depth - 1];
+    Heading choices[HEADING_COUNT];
+    int count = 0;
+    for (int h = NORTH; h < HEADING_COUNT; h++) {
+      Heading heading = static_cast<Heading>(h);
+      if (can_move(here, heading)) {
+        Location next = here.neighbour(heading);
+        if (not seen[next.x][next.y]) {
+          choices[count++] = heading;
+        }
+      }
+    }
+    if (count == 0) {
+      depth--;
+      continue;
+    }
+    Heading heading = choices[random_int(count)];
+    knock_down(here, heading);
+    Location next = here.neighbour(heading);
+    seen[next.x][next.y] = true;
+    stack[depth++] = next;
+  }
+}
+
+int find_set(int *parent, int cell) {
+  while (parent[cell] != cell) {
+    parent[cell] = parent[parent[cell]];
+    cell = parent[cell];
+  }
+  return cell;
+}
+
+void make_kruskal() {
+  static int parent[MAZE_CELL_COUNT];
+  static int walls[2 * MAZE_CELL_COUNT];
+  set_all_walls(true);
+  int count = 0;
+  for (int i = 0; i < MAZE_CELL_COUNT; i++) {
+    parent[i] = i;
+    walls[count++] = 2 * i;      // north
+    walls[count++] = 2 * i + 1;  // east
+  }
+  for (int i = count - 1; i > 0; i--) {
+    int j = random_int(i + 1);
+    int temp = walls[i];
+    walls[i] = walls[j];
+    walls[j] = temp;
+  }
+  for (int i = 0; i < count; i++) {
+    int cell = walls[i] / 2;
+    Location here(cell / MAZE_HEIGHT, cell % MAZE_HEIGHT);
+    Heading heading = (walls[i] & 1) ? EAST : NORTH;
+    if (not can_move(here, heading)) {
+      continue;
+    }
+    Location next = here.neighbour(heading);
+    int a = find_set(parent, cell);
+    int b = find_set(parent, next.x * MAZE_HEIGHT + next.y);
+    if (a != b) {
+      parent[a] = b;
+      knock_down(here, heading);
+    }
+  }
+}
+
+bool has_wall(Location cell, Heading heading) {
+  switch (heading) {
+    case NORTH:
+      return north_wall[cell.x][cell.y];
+    case EAST:
+      return east_wall[cell.x][cell.y];
+    case SOUTH:
+      return cell.y == 0 || north_wall[cell.x][cell.y - 1];
+    default:
+      return cell.x == 0 || east_wall[cell.x - 1][cell.y];
+  }
+}
+
+void make_braid() {
+  make_kruskal();
+  for (int x = 0; x < MAZE_WIDTH; x++) {
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      Location here(x, y);
+      int walls = 0;
+      for (int h = NORTH; h < HEADING_COUNT; h++) {
+        walls += has_wall(here, static_cast<Heading>(h));
+      }
+      if (walls == 3 && random_int(4) != 0) {
+        Heading heading = static_cast<Heading>(random_int(HEADING_COUNT));
+        if (can_move(here, heading)) {
+          knock_down(here, heading);
+        }
+      }
+    }
+  }
+}
+
+//***************************************************************************//
+// Loading the generated walls into the maze and flooding it
+
+void load_maze() {
+  maze.initialise();
+  for (int x = 0; x < MAZE_WIDTH; x++) {
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      maze.update_wall_state(Location(x, y), NORTH, north_wall[x][y] ? WALL : EXIT);
+      maze.update_wall_state(Location(x, y), EAST, east_wall[x][y] ? WALL : EXIT);
+    }
+  }
+}
+
+Location random_target() {
+  if (random_int(2)) {
+    return Location(MAZE_WIDTH / 2 - 1 + random_int(2), MAZE_HEIGHT / 2 - 1 + random_int(2));
+  }
+  return Location(random_int(MAZE_WIDTH), random_int(MAZE_HEIGHT));
+}
+
+int full_flood_depth(Location target) {
+  maze.reset_queue_stats();
+  maze.flood(target);
+  return maze.queue_high_water();
+}
+
+int weighted_flood_depth(Location target) {
+#if MAZE_WEIGHTED_FLOOD
+  maze.reset_queue_stats();
+  maze.weighted_flood(target, 2, 6, 12);
+  return maze.queue_high_water();
+#else
+  (void)target;
+  return 0;
+#endif
+}
+
+// reveal the walls in a random order as if the robot were searching
+int search_depth(Location target, bool &filled) {
+  static int order[2 * MAZE_CELL_COUNT];
+  int count = 0;
+  for (int i = 0; i < 2 * MAZE_CELL_COUNT; i++) {
+    order[count++] = i;
+  }
+  for (int i = count - 1; i > 0; i--) {
+    int j = random_int(i + 1);
+    int temp = order[i];
+    order[i] = order[j];
+    order[j] = temp;
+  }
+  maze.initialise();
+  maze.set_mask(MASK_OPEN);
+  maze.flood(target);
+  maze.reset_queue_stats();
+  for (int i = 0; i < count; i++) {
+    int cell = order[i] / 2;
+    int x = cell / MAZE_HEIGHT;
+    int y = cell % MAZE_HEIGHT;
+    if (order[i] & 1) {
+      maze.update_wall_state(Location(x, y), EAST, east_wall[x][y] ? WALL : EXIT);
+    } else {
+      maze.update_wall_state(Location(x, y), NORTH, north_wall[x][y] ? WALL : EXIT);
+    }
+  }
+  filled = filled || maze.queue_filled();
+  return maze.queue_high_water();
+}
+
+int worst_full_flood() {
+  int worst = 0;
+  for (int x = 0; x < MAZE_WIDTH; x++) {
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      int depth = full_flood_depth(Location(x, y));
+      if (depth > worst) {
+        worst = depth;
+      }
+    }
+  }
+  return worst;
+}
+
+void test_maze(Result &result) {
+  load_maze();
+  maze.set_mask(MASK_CLOSED);
+  for (int i = 0; i < 4; i++) {
+    Location target = random_target();
+    int full = full_flood_depth(target);
+    result.filled = result.filled || maze.queue_filled();
+    int weighted = weighted_flood_depth(target);
+    result.filled = result.filled || maze.queue_filled();
+    if (full > result.full) {
+      result.full = full;
+    }
+    if (weighted > result.weighted) {
+      result.weighted = weighted;
+    }
+  }
+  int search = search_depth(random_target(), result.filled);
+  if (search > result.search) {
+    result.search = search;
+  }
+}
+
+// make small changes to a maze and keep any that need a deeper queue
+void hill_climb(Result &result, int steps) {
+  make_kruskal();
+  load_maze();
+  maze.set_mask(MASK_CLOSED);
+  int best = worst_full_flood();
+  for (int i = 0; i < steps; i++) {
+    int x = random_int(MAZE_WIDTH);
+    int y = random_int(MAZE_HEIGHT);
+    bool *wall = random_int(2) ? &north_wall[x][y] : &east_wall[x][y];
+    if ((wall == &north_wall[x][y] && y == MAZE_HEIGHT - 1) || (wall == &east_wall[x][y] && x == MAZE_WIDTH - 1)) {
+      continue;
+    }
+    *wall = not *wall;
+    load_maze();
+    maze.set_mask(MASK_CLOSED);
+    int depth = worst_full_flood();
+    if (depth >= best) {
+      best = depth;
+    } else {
+      *wall = not *wall;
+    }
+  }
+  if (best > result.full) {
+    result.full = best;
+  }
+  test_maze(result);
+}
+
+int main(int argc, char **argv) {
+  int trials = (argc > 1) ? atoi(argv[1]) : 1000;
+  srand((argc > 2) ? atoi(argv[2]) : 1);
+  Result results[] = {
+      {"empty", 0, 0, 0, false},   {"random", 0, 0, 0, false}, {"backtrack", 0, 0, 0, false},
+      {"kruskal", 0, 0, 0, false}, {"braid", 0, 0, 0, false},  {"climb", 0, 0, 0, false},
+  };
+  set_all_walls(false);
+  for (int x = 0; x < MAZE_WIDTH; x++) {
+    for (int y = 0; y < MAZE_HEIGHT; y++) {
+      load_maze();
+      maze.set_mask(MASK_CLOSED);
+      int depth = full_flood_depth(Location(x, y));
+      if (depth > results[0].full) {
+        results[0].full = depth;
+      }
+    }
+  }
+  test_maze(results[0]);
+  for (int i = 0; i < trials; i++) {
+    make_random();
+    test_maze(results[1]);
+    make_backtrack();
+    test_maze(results[2]);
+    make_kruskal();
+    test_maze(results[3]);
+    make_braid();
+    test_maze(results[4]);
+  }
+  for (int i = 0; i < trials / 100 + 1; i++) {
+    hill_climb(results[5], 200);
+  }
+
+  printf("Maze %dx%d, %d trials, queue size %d\n", MAZE_WIDTH, MAZE_HEIGHT, trials, MAZE_FLOOD_QUEUE_SIZE);
+  printf("%-10s %6s %9s %7s\n", "maze", "flood", "weighted", "search");
+  int worst = 0;
+  bool filled = false;
+  for (const Result &result : results) {
+    printf("%-10s %6d %9d %7d%s\n", result.name, result.full, result.weighted, result.search,
+           result.filled ? "  FILLED" : "");
+    worst = (result.full > worst) ? result.full : worst;
+    worst = (result.weighted > worst) ? result.weighted : worst;
+    worst = (result.search > worst) ? result.search : worst;
+    filled = filled || result.filled;
+  }
+  printf("Deepest queue: %d\n", worst);
+  return filled ? 1 : 0;
+}
@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+###############################################################################
+# Project: mazerunner-core                                                    #
+# -----                                                                       #
+# Copyright 2022 - 2023 Peter Harrison, Micromouseonline                      #
+# -----                                                                       #
+# Licence:                                                                    #
+#     Use of this source code is governed by an MIT-style                     #
+#     license that can be found in the LICENSE file or at                     #
+#     https://opensource.org/licenses/MIT.                                    #
+###############################################################################
+
+"""
+Make a set of 16x16 mazes that follow the contest rules, as text files that
+the simulator and maze_bench.py can read.
+
+These are not copies of real contest mazes. They are generated so that the
+benchmark has plenty of mazes that obey the same rules:
+
+    - the goal is the 2x2 area in the centre with no walls inside it and a
+      single entrance
+    - the start cell, in the south west corner, has walls to the east,
+      south and west so the only way out is to the north
+    - every post, apart from the one in the middle of the goal, has at
+      least one wall touching it
+    - the goal can be reached from the start but a robot that simply
+      follows the left or the right hand wall never gets there
+
+The mazes are made by carving a perfect maze and then knocking out walls to
+make loops. There are three kinds of carving. One gives long corridors, one
+lots of short branches and one lots of staircases for the diagonals. Each
+maze comes from its own seed so the same command always gives the same
+files:
+
+    python3 tools/maze-bench/make_mazes.py sim/mazes/generated 50
+
+Real contest mazes in the same text format can go in the same folder.
+"""
+
+import argparse
+import os
+import random
+import sys
+
+N = 16
+GOAL = {(7, 7), (7, 8), (8, 7), (8, 8)}
+NORTH, EAST, SOUTH, WEST = range(4)
+STEP = {NORTH: (0, 1), EAST: (1, 0), SOUTH: (0, -1), WEST: (-1, 0)}
+KINDS = ['corridors', 'branches', 'staircases']
+
+
+class Maze:
+    """Walls are held as north[x][y] and east[x][y] for each cell"""
+
+    def __init__(self):
+        self.north = [[True] * N for _ in range(N)]
+        self.east = [[True] * N for _ in range(N)]
+
+    def wall(self, x, y, heading):
+        dx, dy = STEP[heading]
+        nx, ny = x + dx, y + dy
+        if not (0 <= nx < N and 0 <= ny < N):
+            return True
+        if heading == NORTH:
+            return self.north[x][y]
+        if heading == EAST:
+            return self.east[x][y]
+        if heading == SOUTH:
+            return self.north[x][ny]
+        return self.east[nx][y]
+
+    def set_wall(self, x, y, heading, state):
+        dx, dy = STEP[heading]
+        nx, ny = x + dx, y + dy
+        if not (0 <= nx < N and 0 <= ny < N):
+            return
+        if heading == NORTH:
+            self.north[x][y] = state
+        elif heading == EAST:
+            self.east[x][y] = state
+        elif heading == SOUTH:
+            self.north[x][ny] = state
+        else:
+            self.east[nx][y] = state
+
+    def reachable(self, start):
+        seen = {start}
+        todo = [start]
+        while todo:
+            x, y = todo.pop()
+            for h in range(4):
+                if not self.wall(x, y, h):
+                    dx, dy = STEP[h]
+                    cell = (x + dx, y + dy)
+                    if cell not in seen:
+                        seen.add(cell)
+                        todo.append(cell)
+        return seen
+
+    def text(self):
+        lines = []
+        for y in range(N - 1, -1, -1):
+            line = 'o'
+            for x in range(N):
+                line += ('---' if y == N - 1 or self.north[x][y] else '   ') + 'o'
+            lines.append(line)
+            line = '|'
+            for x in range(N):
+                mark = ' G ' if (x, y) in GOAL else ' S ' if (x, y) == (0, 0) else '   '
+                line += mark + ('|' if x == N - 1 or self.east[x][y] else ' ')
+            lines.append(line)
+        lines.append('o' + '---o' * N)
+        return '\n'.join(lines) + '\n'
+
+
+def neighbours(cell):
+    x, y = cell
+    for h in range(4):
+        dx, dy = STEP[h]
+        if 0 <= x + dx < N and 0 <= y + dy < N:
+            yield h, (x + dx, y + dy)
+
+
+def carve(maze, rng, kind):
+    """Carve a perfect maze over every cell outside the goal"""
+    visited = set(GOAL)
+    if kind == 'branches':
+        # randomised Prim. Lots of short dead ends
+        visited.add((0, 0))
+        frontier = [((0, 0), h, c) for h, c in neighbours((0, 0))]
+        while frontier:
+            cell, heading, next_cell = frontier.pop(rng.randrange(len(frontier)))
+            if next_cell in visited:
+                continue
+            maze.set_wall(cell[0], cell[1], heading, False)
+            visited.add(next_cell)
+            frontier += [(next_cell, h, c) for h, c in neighbours(next_cell) if c not in visited]
+        return
+    # depth first. Long corridors, or staircases if it prefers to turn
+    # the opposite way to the last turn
+    stack = [((0, 0), None, None)]
+    visited.add((0, 0))
+    while stack:
+        cell, last, turn = stack[-1]
+        options = [(h, c) for h, c in neighbours(cell) if c not in visited]
+        if not options:
+            stack.pop()
+            continue
+        choice = rng.choice(options)
+        if kind == 'staircases' and last is not None and rng.random() < 0.8:
+            wanted = (last + (1 if turn == 'left' else -1)) % 4 if turn else (last + rng.choice([1, -1])) % 4
+            for h, c in options:
+                if h == wanted:
+                    choice = (h, c)
+        elif kind == 'corridors' and last is not None and rng.random() < 0.6:
+            for h, c in options:
+                if h == last:
+                    choice = (h, c)
+        heading, next_cell = choice
+        new_turn = turn
+        if last is not None and heading != last:
+            new_turn = 'left' if heading == (last - 1) % 4 else 'right'
+        maze.set_wall(cell[0], cell[1], heading, False)
+        visited.add(next_cell)
+        stack.append((next_cell, heading, new_turn))
+
+
+def open_goal(maze, rng):
+    maze.north[7][7] = maze.north[8][7] = False
+    maze.east[7][7] = maze.east[7][8] = False
+    entrances = [((7, 7), SOUTH), ((8, 7), SOUTH), ((7, 7), WEST), ((7, 8), WEST),
+                 ((7, 8), NORTH), ((8, 8), NORTH), ((8, 7), EAST), ((8, 8), EAST)]
+    for (x, y), h in entrances:
+        maze.set_wall(x, y, h, True)
+    (x, y), h = rng.choice(entrances)
+    maze.set_wall(x, y, h, False)
+
+
+def post_walls(maze, x, y):
+    """The walls that touch the post at the south west corner of cell x, y"""
+    walls = []
+    if 0 < x < N and 0 < y < N:
+        walls = [maze.north[x - 1][y - 1], maze.north[x][y - 1], maze.east[x - 1][y - 1], maze.east[x - 1][y]]
+    return walls
+
+
+def lonely_posts(maze):
+    posts = []
+    for x in range(1, N):
+        for y in range(1, N):
+            if (x, y) != (8, 8) and not any(post_walls(maze, x, y)):
+                posts.append((x, y))
+    return posts
+
+
+def follow_wall(maze, hand):
+    """True if following one wall from the start gets into the goal"""
+    x, y, heading = 0, 0, NORTH
+    turn = -1 if hand == 'left' else 1
+    for _ in range(4 * N * N * 4):
+        if (x, y) in GOAL:
+            return True
+        for change in (turn, 0, -turn, 2):
+            h = (heading + change) % 4
+            if not maze.wall(x, y, h):
+                heading = h
+                break
+        dx, dy = STEP[heading]
+        x, y = x + dx, y + dy
+        if (x, y, heading) == (0, 0, SOUTH):
+            return False
+    return False
+
+
+def knock_out(maze, rng, count):
+    """Make loops. A wall is only removed if no post is left on its own"""
+    tries = 0
+    while count > 0 and tries < 5000:
+        tries += 1
+        x, y = rng.randrange(N), rng.randrange(N)
+        h = rng.choice([NORTH, EAST])
+        dx, dy = STEP[h]
+        cells = {(x, y), (x + dx, y + dy)}
+        if cells & GOAL or (0, 0) in cells or (1, 0) in cells or not maze.wall(x, y, h):
+            continue
+        if x + dx >= N or y + dy >= N:
+            continue
+        maze.set_wall(x, y, h, False)
+        if lonely_posts(maze):
+            maze.set_wall(x, y, h, True)
+            continue
+        count -= 1
+
+
+def make_maze(seed):
+    rng = random.Random(seed)
+    kind = KINDS[seed % len(KINDS)]
+    for _ in range(100):
+        maze = Maze()
+        carve(maze, rng, kind)
+        open_goal(maze, rng)
+        maze.east[0][0] = True
+        maze.north[0][0] = False
+        knock_out(maze, rng, rng.randrange(1, 6))
+        if lonely_posts(maze):
+            continue
+        if not GOAL & maze.reachable((0, 0)):
+            continue
+        if follow_wall(maze, 'left') or follow_wall(maze, 'right'):
+            # break the goal away from the outer walls with a loop around it
+            continue
+        return kind, maze
+    return None, None
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Make 16x16 mazes that follow the contest rules')
+    parser.add_argument('folder', help='where to put the maze files')
+    parser.add_argument('count', type=int, nargs='?', default=50, help='how many mazes to make')
+    parser.add_argument('--seed', type=int, default=0, help='seed for the first maze')
+    args = parser.parse_args()
+    os.makedirs(args.folder, exist_ok=True)
+    made = 0
+    seed = args.seed
+    while made < args.count:
+        kind, maze = make_maze(seed)
+        if maze is not None:
+            name = os.path.join(args.folder, 'c%03d-%s.txt' % (seed, kind))
+            with open(name, 'w') as f:
+                f.write(maze.text())
+            made += 1
+        else:
+            print('no maze from seed %d' % seed, file=sys.stderr)
+        seed += 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+###############################################################################
+# Project: mazerunner-core                                                    #
+# -----                                                                       #
+# Copyright 2022 - 2023 Peter Harrison, Micromouseonline                      #
+# -----                                                                       #
+# Licence:                                                                    #
+#     Use of this source code is governed by an MIT-style                     #
+#     license that can be found in the LICENSE file or at                     #
+#     https://opensource.org/licenses/MIT.                                    #
+###############################################################################
+
+"""
+Run the search and the speed run over a set of mazes and compare the results.
+
+Give it maze files or folders of them. Text mazes (*.txt) and binary .maz
+files are both understood, as they are by the simulator. By default each
+maze is run in the native simulator, which must be built first:
+
+    g++ -std=gnu++11 -O2 -Isim -Imazerunner-core sim/main.cpp -o mazesim
+    python3 tools/maze-bench/maze_bench.py --sim ./mazesim sim/mazes/generated
+
+There is one line for each maze with the search and run times in simulated
+seconds, the cells explored, the calls to the flood and the repair with
+their average host time, the speed run path length and the time that
+Mouse::estimate_path_time() expected it to take. The totals and means come
+at the end. Any maze that does not PASS is listed, and the exit status is 1
+if there were any.
+
+Use --csv to get the results as CSV for a spreadsheet.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+
+SIM_COLUMNS = ['search', 'run', 'explored', 'floods', 'flood_us', 'repairs', 'repair_us', 'path', 'estimate']
+
+
+def find_mazes(paths):
+    mazes = []
+    for path in paths:
+        if os.path.isdir(path):
+            for name in sorted(os.listdir(path)):
+                if name.lower().endswith(('.txt', '.maz')):
+                    mazes.append(os.path.join(path, name))
+        else:
+            mazes.append(path)
+    return mazes
+
+
+def parse_summary(text):
+    """The values from the last key=value summary line of the simulator"""
+    for line in reversed(text.splitlines()):
+        if line.startswith('maze='):
+            return dict(item.split('=', 1) for item in line.split())
+    return None
+
+
+def run_sim(sim, maze, args):
+    command = [sim, '-q', '-t', str(args.time)]
+    if args.noise:
+        command += ['-n', str(args.noise)]
+    if args.search_only:
+        command.append('-s')
+    result = subprocess.run(command + [maze], stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                            universal_newlines=True)
+    summary = parse_summary(result.stdout)
+    if summary is None:
+        return {'result': 'ERROR'}, result.stderr.strip()
+    return summary, ''
+
+
+###############################################################################
+
+
+def number(value):
+    try:
+        return float(value)
+    except (TypeError, ValueError):
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the maze code over a set of mazes')
+    parser.add_argument('mazes', nargs='+', help='maze files or folders of them')
+    parser.add_argument('--sim', default='./mazesim', help='the native simulator. Default ./mazesim')
+    parser.add_argument('--noise', type=float, default=0, help='sensor noise for the simulator')
+    parser.add_argument('--time', type=float, default=1200, help='simulated time limit in seconds')
+    parser.add_argument('--search-only', action='store_true', help='no speed run')
+    parser.add_argument('--csv', action='store_true', help='CSV output')
+    args = parser.parse_args()
+
+    mazes = find_mazes(args.mazes)
+    if not mazes:
+        sys.exit('no maze files found')
+    columns = SIM_COLUMNS
+    if args.csv:
+        print(','.join(['maze'] + columns + ['result']))
+    else:
+        print(('%-24s' + ' %9s' * len(columns) + '  %s') % tuple(['maze'] + columns + ['result']))
+
+    totals = [0.0] * len(columns)
+    passed = 0
+    failures = []
+    for maze in mazes:
+        values, message = run_sim(args.sim, maze, args)
+        result = values.get('result', 'ERROR')
+        row = [values.get(column, '') for column in columns]
+        if args.csv:
+            print(','.join([maze] + row + [result]))
+        else:
+            print(('%-24s' + ' %9s' * len(columns) + '  %s') % tuple([os.path.basename(maze)[-24:]] + row + [result]))
+        if result == 'PASS':
+            passed += 1
+            for i, value in enumerate(row):
+                totals[i] += number(value) or 0
+        else:
+            failures.append((maze, result, message))
+
+    if not args.csv:
+        print()
+        print(('%-24s' + ' %9.1f' * len(columns)) % tuple(['total'] + totals))
+        if passed:
+            print(('%-24s' + ' %9.2f' * len(columns)) % tuple(['mean'] + [t / passed for t in totals]))
+        print('%d of %d mazes passed' % (passed, len(mazes)))
+    for maze, result, message in failures:
+        print('%s: %s %s' % (maze, result, message), file=sys.stderr)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+###############################################################################
+# Project: mazerunner-core                                                    #
+# -----                                                                       #
+# Copyright 2022 - 2023 Peter Harrison, Micromouseonline                      #
+# -----                                                                       #
+# Licence:                                                                    #
+#     Use of this source code is governed by an MIT-style                     #
+#     license that can be found in the LICENSE file or at                     #
+#     https://opensource.org/licenses/MIT.                                    #
+###############################################################################
+
+"""
+Decode a binary telemetry capture from the robot into CSV.
+
+The records are described in mazerunner-core/telemetry.h. The output has
+the same columns as the headers of the text reports so the same
+spreadsheets can be used for either.
+
+Capture the serial data to a file with any terminal program that can save
+raw bytes, then run something like:
+
+    python3 decode_telemetry.py capture.bin > run.csv
+
+With no file name the capture is read from stdin. Any text that the robot
+sent before or after the stream is skipped. Bad records and gaps in the
+sequence numbers are reported on stderr.
+"""
+
+import struct
+import sys
+
+SYNC = 0xA5
+
+TLM_PROFILE = 1
+TLM_SENSOR_TRACK = 2
+TLM_ACTION = 3
+
+HEADINGS = 'NESW'
+
+# payload format and CSV header for each record type
+RECORDS = {
+    TLM_PROFILE: ('<9h', 'time robotPos robotAngle fwdPos fwdSpeed rotPos rotSpeed fwdmVolts rotmVolts'),
+    TLM_SENSOR_TRACK: ('<9h', 'time pos angle lfs lss rss rfs cte steer'),
+    TLM_ACTION: ('<ccBBBhh', 'action note x y heading frontSum position'),
+}
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) if crc & 0x80 else (crc << 1)
+            crc &= 0xFF
+    return crc
+
+
+def records(data):
+    """Yield (type, sequence, fields) for every good record in the data."""
+    i = 0
+    bad = 0
+    while i < len(data):
+        if data[i] != SYNC or i + 3 > len(data) or data[i + 1] not in RECORDS:
+            i += 1
+            continue
+        kind = data[i + 1]
+        fmt = RECORDS[kind][0]
+        end = i + 3 + struct.calcsize(fmt)
+        if end + 1 > len(data):
+            break
+        if crc8(data[i + 1:end]) != data[end]:
+            bad += 1
+            i += 1
+            continue
+        yield kind, data[i + 2], struct.unpack(fmt, data[i + 3:end])
+        i = end + 1
+    if bad:
+        print(f'{bad} bad records skipped', file=sys.stderr)
+
+
+def format_row(kind, fields):
+    if kind == TLM_SENSOR_TRACK:
+        fields = fields[:7] + (fields[7] / 100.0, fields[8] / 100.0)
+    elif kind == TLM_ACTION:
+        action, note, x, y, heading, front_sum, position = fields
+        heading = HEADINGS[heading] if heading < len(HEADINGS) else '!'
+        fields = (action.decode('latin-1'), note.decode('latin-1'), x, y, heading, front_sum, position)
+    return ','.join(str(f) for f in fields)
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], 'rb') as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    last_kind = None
+    last_sequence = None
+    time_base = 0
+    last_time = None
+    gaps = 0
+    lost = 0
+    for kind, sequence, fields in records(data):
+        if last_sequence is not None:
+            missing = (sequence - last_sequence - 1) & 0xFF
+            if missing:
+                gaps += 1
+                lost += missing
+        last_sequence = sequence
+        if kind != TLM_ACTION:
+            # the time is only 16 bits so it wraps after about 65 seconds
+            time = fields[0] & 0xFFFF
+            if last_time is not None and time < last_time:
+                time_base += 0x10000
+            last_time = time
+            fields = (time_base + time,) + fields[1:]
+        if kind != last_kind:
+            print(','.join(RECORDS[kind][1].split()))
+            last_kind = kind
+        print(format_row(kind, fields))
+    if gaps:
+        print(f'{gaps} gaps in the sequence, {lost} records lost', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()